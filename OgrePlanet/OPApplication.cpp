@@ -26,6 +26,9 @@ THE SOFTWARE.
 #include "OPNoiseppDataSource.h"
 #include "OPIdentityDataSource.h"
 #include "OPPatchMeshLoaderQueue.h"
+#include "OPAsyncSampleQueue.h"
+#include "OPCpuDispatch.h"
+#include "OPCubeSphereKernel.h"
 
 #include <Threading/OgreDefaultWorkQueue.h>
 
@@ -115,7 +118,10 @@ namespace OgrePlanet
 		//workQueue->setWorkerThreadCount(4);
 		//workQueue->startup(true);
 
-		PatchMeshLoader::init(32);
+		CpuDispatch::init();
+		CubeSphere::setMapping(CUBE_MAPPING_TANGENT);
+		PatchMeshLoader::setVertexFormat(VERTEX_FORMAT_HEIGHT);
+		PatchMeshLoader::setCrackHiding(CRACK_HIDING_SKIRTS);
 
 		mPatchMeshLoaderQueue = new PatchMeshLoaderQueue();
 
@@ -127,7 +133,12 @@ namespace OgrePlanet
 		mFloatingOrigin = mgr->getRootSceneNode()->createChildSceneNode();
 
 		mPlanetNode = mFloatingOrigin->createChildSceneNode();
-		mPlanet = PlanetPtr(new Planet(mgr, mPlanetNode, 6371.0, 8.848, new NoiseppDataSource()));
+		// Larger patches near the ground, where most of them are
+		PatchResolution surfaceResolution(32);
+		surfaceResolution.setQuads(8, 64);
+		mPlanet = PlanetPtr(new Planet(mgr, mPlanetNode, 6371.0, 8.848, new NoiseppDataSource(), surfaceResolution));
+		// CPU bytes, GPU vertex bytes and patches
+		mPlanet->getBudget().setLimits(256 * 1024 * 1024, 128 * 1024 * 1024, 8192);
 		
 		//Ogre::SceneNode *camNode = mgr->getRootSceneNode()->createChildSceneNode();
 		Ogre::SceneNode *camNode = mPlanetNode->createChildSceneNode();
@@ -150,6 +161,24 @@ namespace OgrePlanet
 		workQueue->addRequestHandler(channel, mPatchMeshLoaderQueue);
 		workQueue->addResponseHandler(channel, mPatchMeshLoaderQueue);
 		workQueue->addRequest(channel, 0, Ogre::Any(0));
+
+		// I/O bound data sources are sampled on the remaining worker threads.
+		// PatchMeshLoaderQueue keeps one thread busy, so there must be at
+		// least one more for this to be of any use.
+		mAsyncSampleQueue = new AsyncSampleQueue();
+		Ogre::uint16 sampleChannel = workQueue->getChannel(mAsyncSampleQueue->getChannelName());
+		workQueue->addRequestHandler(sampleChannel, mAsyncSampleQueue);
+		workQueue->addResponseHandler(sampleChannel, mAsyncSampleQueue);
+		mAsyncSampleQueue->setEnabled(workQueue->getWorkerThreadCount() > 1);
+
+		// The loaders of merged patches are deleted on the remaining
+		// worker threads too
+		mPatchMeshLoaderDestroyer = new PatchMeshLoaderDestroyer();
+		Ogre::uint16 destroyerChannel = workQueue->getChannel(mPatchMeshLoaderDestroyer->getChannelName());
+		workQueue->addRequestHandler(destroyerChannel, mPatchMeshLoaderDestroyer);
+		workQueue->addResponseHandler(destroyerChannel, mPatchMeshLoaderDestroyer);
+		mPatchMeshLoaderDestroyer->setEnabled(workQueue->getWorkerThreadCount() > 1);
+		mPatchMeshLoaderQueue->setDestroyer(mPatchMeshLoaderDestroyer);
 	}
 
 	void Application::setupInputSystem()
@@ -189,7 +218,7 @@ namespace OgrePlanet
 		timer.reset();
 		Ogre::Real timeFactor = 60.0 * 60.0 * 24.0;
 
-		while (mPlanet->notifyPreRender() && mRoot->renderOneFrame() && mPlanet->notifyPostRender())
+		while (mRoot->renderOneFrame())
 		{
 			Ogre::Real time = timer.getMicroseconds() / 1000000.0;
 			timer.reset();
@@ -301,6 +330,10 @@ namespace OgrePlanet
 			{
 				mPlanet->setCameraPosition(mCam->getParentSceneNode()->getPosition());
 			}
+
+			// Frees the meshes of patches merged above, once the workers
+			// are done with them
+			mPatchMeshLoaderQueue->reclaim();
 			
 			Ogre::WindowEventUtilities::messagePump();
 		}
@@ -309,6 +342,8 @@ namespace OgrePlanet
 	void Application::shutDown()
 	{
 		PatchMeshLoader::cleanup();
+		mAsyncSampleQueue->setEnabled(false);
+		mPatchMeshLoaderDestroyer->setEnabled(false);
 		mPatchMeshLoaderQueue->setAbort();
 	}
 
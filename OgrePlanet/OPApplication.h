@@ -26,6 +26,7 @@ THE SOFTWARE.
 #include "OPPlanet.h"
 
 #include "OPPatchMeshLoaderQueue.h"
+#include "OPAsyncSampleQueue.h"
 
 #include <Ogre.h>
 #include <OIS/OIS.h>
@@ -52,6 +53,8 @@ namespace OgrePlanet
 		OIS::Mouse *mMouse;
 		OIS::InputManager *mInputManager;
 		PatchMeshLoaderQueue * mPatchMeshLoaderQueue;
+		PatchMeshLoaderDestroyer * mPatchMeshLoaderDestroyer;
+		AsyncSampleQueue * mAsyncSampleQueue;
 		Ogre::SceneNode * mFloatingOrigin;
 		OgreBites::SdkTrayManager * mTrayManager;
 		Ogre::RenderWindow * mWindow;
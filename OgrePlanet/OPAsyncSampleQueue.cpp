@@ -0,0 +1,91 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPAsyncSampleQueue.h"
+
+template<> OgrePlanet::AsyncSampleQueue* Ogre::Singleton<OgrePlanet::AsyncSampleQueue>::ms_Singleton = 0;
+
+namespace OgrePlanet
+{
+	AsyncSampleQueue* AsyncSampleQueue::getSingletonPtr(void)
+	{
+		return ms_Singleton;
+	}
+
+	AsyncSampleQueue& AsyncSampleQueue::getSingleton(void)
+	{
+		assert( ms_Singleton );  return ( *ms_Singleton );
+	}
+
+	AsyncSampleQueue::AsyncSampleQueue() :
+		mEnabled(false),
+		mChannel(Ogre::Root::getSingleton().getWorkQueue()->getChannel(getChannelName()))
+	{}
+
+	void AsyncSampleQueue::setEnabled(bool enabled)
+	{
+		mEnabled = enabled;
+	}
+
+	bool AsyncSampleQueue::isEnabled()
+	{
+		return mEnabled;
+	}
+
+	void AsyncSampleQueue::sampleBatch(DataSource * dataSource,
+		const float * xs, const float * ys, const float * zs, float * out, int n,
+		const DataSource::SampleCallback & callback)
+	{
+		SampleRequest request;
+		request.dataSource = dataSource;
+		request.xs = xs;
+		request.ys = ys;
+		request.zs = zs;
+		request.out = out;
+		request.n = n;
+		request.callback = callback;
+
+		Ogre::Root::getSingleton().getWorkQueue()->addRequest(mChannel, 0, Ogre::Any(request));
+	}
+
+	Ogre::WorkQueue::Response * AsyncSampleQueue::handleRequest(const Ogre::WorkQueue::Request * req, const Ogre::WorkQueue * srcQ)
+	{
+		SampleRequest request = Ogre::any_cast<SampleRequest>(req->getData());
+
+		request.dataSource->sampleBatch(request.xs, request.ys, request.zs, request.out, request.n);
+
+		// Call back from the worker thread, rather than waiting for the
+		// response to be processed on the main thread at the next frame.
+		request.callback();
+
+		return 0;
+	}
+
+	void AsyncSampleQueue::handleResponse(const Ogre::WorkQueue::Response * res, const Ogre::WorkQueue * srcQ)
+	{
+	}
+
+	Ogre::String AsyncSampleQueue::getChannelName()
+	{
+		return "AsyncSampleQueueChannel";
+	}
+}
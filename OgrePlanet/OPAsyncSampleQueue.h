@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef ASYNCSAMPLEQUEUE_H
+#define ASYNCSAMPLEQUEUE_H
+
+#include "OPDataSource.h"
+
+#include <Ogre.h>
+
+namespace OgrePlanet
+{
+	// Runs DataSource::sampleBatch() for I/O bound sources on the
+	// WorkQueue's worker threads, so that the thread preparing meshes
+	// doesn't sit idle while height data is being read.
+	class AsyncSampleQueue :
+		public Ogre::Singleton<AsyncSampleQueue>,
+		public Ogre::WorkQueue::RequestHandler,
+		public Ogre::WorkQueue::ResponseHandler
+	{
+	public:
+		static AsyncSampleQueue & getSingleton();
+		static AsyncSampleQueue * getSingletonPtr();
+
+		AsyncSampleQueue();
+
+		// Must be called after the handlers have been registered with the
+		// WorkQueue. Only enable the queue if the WorkQueue has a worker
+		// thread to spare (PatchMeshLoaderQueue occupies one permanently).
+		void setEnabled(bool enabled);
+		bool isEnabled();
+
+		void sampleBatch(DataSource * dataSource,
+			const float * xs, const float * ys, const float * zs, float * out, int n,
+			const DataSource::SampleCallback & callback);
+
+		Ogre::WorkQueue::Response * handleRequest(const Ogre::WorkQueue::Request * req, const Ogre::WorkQueue * srcQ);
+		void handleResponse(const Ogre::WorkQueue::Response * res, const Ogre::WorkQueue * srcQ);
+		Ogre::String getChannelName();
+
+	private:
+		struct SampleRequest
+		{
+			DataSource * dataSource;
+			const float * xs;
+			const float * ys;
+			const float * zs;
+			float * out;
+			int n;
+			DataSource::SampleCallback callback;
+		};
+
+		bool mEnabled;
+		Ogre::uint16 mChannel;
+	};
+}
+
+#endif // ASYNCSAMPLEQUEUE_H
@@ -0,0 +1,130 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPConstantGeometryCache.h"
+
+#include <algorithm>
+
+namespace OgrePlanet
+{
+	size_t ConstantGeometry::getSize() const
+	{
+		return sizeof(ConstantGeometry) +
+			vertices.size() * sizeof(float) +
+			packedVertices.size() * sizeof(Ogre::int16);
+	}
+
+	ConstantGeometryCache::Key::Key(VertexFormat format,
+		bool skirts,
+		int mapping,
+		int quads,
+		int morphStep,
+		Ogre::Real radius,
+		const Ogre::Vector3 & min,
+		const Ogre::Vector3 & max,
+		Ogre::Real texXMin,
+		Ogre::Real texXMax,
+		Ogre::Real texYMin,
+		Ogre::Real texYMax)
+	{
+		ints[0] = format;
+		ints[1] = skirts ? 1 : 0;
+		ints[2] = mapping;
+		ints[3] = quads;
+		ints[4] = morphStep;
+
+		// The corners of the patch on the cube give its face and
+		// position in the quadtree
+		reals[0] = radius;
+		reals[1] = min.x;
+		reals[2] = min.y;
+		reals[3] = min.z;
+		reals[4] = max.x;
+		reals[5] = max.y;
+		reals[6] = max.z;
+		reals[7] = texXMin;
+		reals[8] = texXMax;
+		reals[9] = texYMin;
+		reals[10] = texYMax;
+	}
+
+	bool ConstantGeometryCache::Key::operator<(const Key & other) const
+	{
+		if (!std::equal(ints, ints + 5, other.ints))
+		{
+			return std::lexicographical_compare(ints, ints + 5, other.ints, other.ints + 5);
+		}
+		return std::lexicographical_compare(reals, reals + 11, other.reals, other.reals + 11);
+	}
+
+	ConstantGeometryCache::ConstantGeometryCache(size_t capacity) :
+	mCapacity(capacity),
+		mSize(0)
+	{
+	}
+
+	ConstantGeometryPtr ConstantGeometryCache::find(const Key & key)
+	{
+		OGRE_LOCK_MUTEX(mMutex)
+
+		GeometryMap::iterator i = mGeometry.find(key);
+		if (i == mGeometry.end())
+		{
+			return ConstantGeometryPtr();
+		}
+
+		mUsage.splice(mUsage.begin(), mUsage, i->second.second);
+		return i->second.first;
+	}
+
+	void ConstantGeometryCache::insert(const Key & key, ConstantGeometryPtr geometry)
+	{
+		OGRE_LOCK_MUTEX(mMutex)
+
+		// Two loaders may have built the same geometry
+		if (mGeometry.find(key) != mGeometry.end())
+		{
+			return;
+		}
+
+		mUsage.push_front(key);
+		mGeometry[key] = std::make_pair(geometry, mUsage.begin());
+		mSize += geometry->getSize();
+
+		while (mSize > mCapacity && !mUsage.empty())
+		{
+			GeometryMap::iterator oldest = mGeometry.find(mUsage.back());
+			mSize -= oldest->second.first->getSize();
+			mGeometry.erase(oldest);
+			mUsage.pop_back();
+		}
+	}
+
+	void ConstantGeometryCache::clear()
+	{
+		OGRE_LOCK_MUTEX(mMutex)
+
+		mGeometry.clear();
+		mUsage.clear();
+		mSize = 0;
+	}
+}
@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef CONSTANTGEOMETRYCACHE_H
+#define CONSTANTGEOMETRYCACHE_H
+
+#include "OPPatchMeshKernel.h"
+
+#include <Ogre.h>
+#include <boost/shared_ptr.hpp>
+
+#include <list>
+#include <map>
+#include <vector>
+
+namespace OgrePlanet
+{
+	// Prepared vertex data of a patch, as PatchMeshLoader::loadResource()
+	// copies it into the vertex buffer
+	struct ConstantGeometry
+	{
+		std::vector<float> vertices;
+		std::vector<Ogre::int16> packedVertices;
+		Ogre::Vector3 center;
+		Ogre::AxisAlignedBox aabb;
+		Ogre::Vector4 positionScale;
+		Ogre::Vector4 radiusScale;
+
+		size_t getSize() const;
+	};
+
+	typedef boost::shared_ptr<const ConstantGeometry> ConstantGeometryPtr;
+
+	// Keeps the geometry of patches whose data source has a constant
+	// height (the ocean and the sky). Their geometry only depends on
+	// where the patch is on the cube, its resolution and the radius,
+	// so a patch that is merged and split again, or the same patch of
+	// another layer with the same radius, doesn't have to be built
+	// again.
+	//
+	// The least recently used geometry is dropped once the cache holds
+	// more than its capacity. Thread safe.
+	class ConstantGeometryCache
+	{
+	public:
+		struct Key
+		{
+			Key(VertexFormat format,
+				bool skirts,
+				int mapping,
+				int quads,
+				int morphStep,
+				Ogre::Real radius,
+				const Ogre::Vector3 & min,
+				const Ogre::Vector3 & max,
+				Ogre::Real texXMin,
+				Ogre::Real texXMax,
+				Ogre::Real texYMin,
+				Ogre::Real texYMax);
+
+			bool operator<(const Key & other) const;
+
+			int ints[5];
+			Ogre::Real reals[11];
+		};
+
+		// In bytes
+		static const size_t DEFAULT_CAPACITY = 16 * 1024 * 1024;
+
+		ConstantGeometryCache(size_t capacity = DEFAULT_CAPACITY);
+
+		// Null if the geometry isn't cached
+		ConstantGeometryPtr find(const Key & key);
+		void insert(const Key & key, ConstantGeometryPtr geometry);
+		void clear();
+
+	private:
+		typedef std::list<Key> KeyList;
+		typedef std::map<Key, std::pair<ConstantGeometryPtr, KeyList::iterator> > GeometryMap;
+
+		const size_t mCapacity;
+		size_t mSize;
+		GeometryMap mGeometry;
+		// Most recently used first
+		KeyList mUsage;
+
+		OGRE_MUTEX(mMutex)
+	};
+}
+
+#endif // CONSTANTGEOMETRYCACHE_H
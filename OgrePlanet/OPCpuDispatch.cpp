@@ -0,0 +1,201 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPCpuDispatch.h"
+#include "OPCubeSphereKernel.h"
+#include "OPPatchMeshKernel.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#if _MSC_VER >= 1600
+#include <immintrin.h>
+#endif
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#endif
+
+namespace OgrePlanet
+{
+	namespace
+	{
+		// info receives eax, ebx, ecx and edx
+		bool cpuid(unsigned int leaf, unsigned int subleaf, unsigned int info[4])
+		{
+#if defined(_MSC_VER)
+			int regs[4];
+			__cpuid(regs, 0);
+			if ((unsigned int)regs[0] < leaf)
+			{
+				return false;
+			}
+			__cpuidex(regs, leaf, subleaf);
+			for (int i = 0; i < 4; i++)
+			{
+				info[i] = (unsigned int)regs[i];
+			}
+			return true;
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+			if (__get_cpuid_max(0, 0) < leaf)
+			{
+				return false;
+			}
+			__cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		// Which register states the OS saves on context switches
+		unsigned long long xgetbv0()
+		{
+#if defined(_MSC_VER) && _MSC_VER >= 1600
+			return _xgetbv(0);
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+			unsigned int eax, edx;
+			__asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" : "=a" (eax), "=d" (edx) : "c" (0));
+			return ((unsigned long long)edx << 32) | eax;
+#else
+			return 0;
+#endif
+		}
+
+		CpuIsa parseIsa(const char * name, CpuIsa fallback)
+		{
+			for (int isa = CPU_ISA_SCALAR; isa <= CPU_ISA_AVX512; isa++)
+			{
+				if (std::strcmp(name, CpuDispatch::getIsaName((CpuIsa)isa)) == 0)
+				{
+					return (CpuIsa)isa;
+				}
+			}
+
+			Ogre::LogManager::getSingleton().logMessage("OgrePlanet: unknown OGREPLANET_ISA value '" + Ogre::String(name) + "', ignored.");
+			return fallback;
+		}
+	}
+
+	CpuIsa CpuDispatch::msIsa = (OGREPLANET_HAVE_SSE ? CPU_ISA_SSE2 : CPU_ISA_SCALAR);
+
+	void CpuDispatch::init()
+	{
+		CpuIsa isa = detectIsa();
+		const char * reason = "detected";
+
+		const char * env = std::getenv("OGREPLANET_ISA");
+		if (env != 0 && env[0] != '\0')
+		{
+			isa = parseIsa(env, isa);
+			reason = "forced by OGREPLANET_ISA";
+		}
+
+		bind(isa, reason);
+	}
+
+	void CpuDispatch::forceIsa(CpuIsa isa)
+	{
+		bind(isa, "forced");
+	}
+
+	CpuIsa CpuDispatch::detectIsa()
+	{
+		unsigned int info[4];
+
+		if (!OGREPLANET_HAVE_SSE || !cpuid(1, 0, info) || !(info[3] & (1 << 26)))
+		{
+			return CPU_ISA_SCALAR;
+		}
+
+		// AVX needs both CPU support and an OS that saves the ymm
+		// registers (OSXSAVE set, and XMM|YMM state enabled in XCR0)
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx)
+		{
+			return CPU_ISA_SSE2;
+		}
+
+		const unsigned long long xcr0 = xgetbv0();
+		if ((xcr0 & 0x6) != 0x6 || !cpuid(7, 0, info) || !(info[1] & (1 << 5)))
+		{
+			return CPU_ISA_SSE2;
+		}
+
+		// AVX-512F, with opmask and zmm state enabled as well
+		if ((info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6)
+		{
+			return CPU_ISA_AVX512;
+		}
+
+		return CPU_ISA_AVX2;
+	}
+
+	CpuIsa CpuDispatch::getIsa()
+	{
+		return msIsa;
+	}
+
+	const char * CpuDispatch::getIsaName(CpuIsa isa)
+	{
+		switch (isa)
+		{
+		case CPU_ISA_SCALAR:
+			return "scalar";
+		case CPU_ISA_SSE2:
+			return "sse2";
+		case CPU_ISA_AVX2:
+			return "avx2";
+		default:
+			return "avx512";
+		}
+	}
+
+	void CpuDispatch::bind(CpuIsa requested, const char * reason)
+	{
+		const CpuIsa detected = detectIsa();
+		CpuIsa isa = std::min(requested, detected);
+
+		// Widest kernels actually compiled in. There are no AVX-512
+		// kernels, those CPUs run the AVX2 ones.
+		CpuIsa kernels = std::min(isa, CPU_ISA_AVX2);
+		if (!OGREPLANET_HAVE_AVX2)
+		{
+			kernels = std::min(kernels, CPU_ISA_SSE2);
+		}
+		if (!OGREPLANET_HAVE_SSE)
+		{
+			kernels = CPU_ISA_SCALAR;
+		}
+
+		msIsa = kernels;
+		CubeSphere::bindKernels(kernels);
+		PatchMeshKernel::bindKernels(kernels);
+
+		Ogre::String message = "OgrePlanet: CPU supports " + Ogre::String(getIsaName(detected)) +
+			", " + reason + " " + getIsaName(requested) +
+			", using " + getIsaName(kernels) + " kernels.";
+		Ogre::LogManager::getSingleton().logMessage(message);
+	}
+}
@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef CPUDISPATCH_H
+#define CPUDISPATCH_H
+
+#include <Ogre.h>
+
+// Instruction sets the kernels can be compiled for. SSE is always
+// available on x86 compilers. The AVX2 kernels live in their own
+// translation unit (OPKernelsAVX2.cpp), which needs AVX intrinsics:
+// Visual Studio 2010 SP1 has them without any /arch switch, other
+// compilers need -mavx for that file only.
+//
+// OGREPLANET_HAVE_AVX2 has to be the same in every file, or the kernels
+// are built but never bound, so it can't follow __AVX__. Visual Studio
+// turns it on by itself, with other compilers define it to 1 for the
+// whole project when OPKernelsAVX2.cpp is built with -mavx.
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#define OGREPLANET_HAVE_SSE 1
+#else
+#define OGREPLANET_HAVE_SSE 0
+#endif
+
+#ifndef OGREPLANET_HAVE_AVX2
+#if defined(_MSC_VER) && _MSC_VER >= 1600
+#define OGREPLANET_HAVE_AVX2 OGREPLANET_HAVE_SSE
+#else
+#define OGREPLANET_HAVE_AVX2 0
+#endif
+#endif
+
+namespace OgrePlanet
+{
+	// Instruction set levels, in increasing order
+	enum CpuIsa
+	{
+		CPU_ISA_SCALAR = 0,
+		CPU_ISA_SSE2 = 1,
+		CPU_ISA_AVX2 = 2,
+		CPU_ISA_AVX512 = 3,
+	};
+
+	// Picks the fastest kernels for the CPU we're running on, so one
+	// binary can be deployed everywhere. Call init() once at startup,
+	// before any patches are built. Until then, the SSE2 kernels are used
+	// (or plain C++ if SSE isn't available at compile time).
+	class CpuDispatch
+	{
+	public:
+		// Detect the CPU and bind the kernels. The OGREPLANET_ISA
+		// environment variable ("scalar", "sse2", "avx2" or "avx512") can
+		// be used to force a lower level for testing.
+		static void init();
+
+		// Bind the kernels for the given level, for testing. Levels the
+		// CPU doesn't support are clamped to the detected level.
+		static void forceIsa(CpuIsa isa);
+
+		// Highest level supported by the CPU and the OS
+		static CpuIsa detectIsa();
+		// Level the kernels are currently bound for
+		static CpuIsa getIsa();
+		static const char * getIsaName(CpuIsa isa);
+
+	private:
+		static void bind(CpuIsa requested, const char * reason);
+
+		static CpuIsa msIsa;
+	};
+}
+
+#endif // CPUDISPATCH_H
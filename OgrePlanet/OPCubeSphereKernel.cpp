@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPCubeSphereKernel.h"
+
+namespace OgrePlanet
+{
+	CubeMapping CubeSphere::msMapping = CUBE_MAPPING_NORMALISE;
+#if OGREPLANET_HAVE_SSE
+	CubeSphere::ProjectGridKernelSelector CubeSphere::msSelectProjectGridKernel = &selectProjectGridKernel<CPU_ISA_SSE2>;
+#else
+	CubeSphere::ProjectGridKernelSelector CubeSphere::msSelectProjectGridKernel = &selectProjectGridKernel<CPU_ISA_SCALAR>;
+#endif
+
+	void CubeSphere::setMapping(CubeMapping mapping)
+	{
+		msMapping = mapping;
+	}
+
+	CubeMapping CubeSphere::getMapping()
+	{
+		return msMapping;
+	}
+
+	DataSource::Side CubeSphere::getSide(const Ogre::Vector3 & min, const Ogre::Vector3 & max)
+	{
+		// Patch corners are found by halving the face extents, so the
+		// coordinate along the face normal is always exactly +-1.
+		if (min.x == max.x)
+		{
+			return (min.x > 0 ? DataSource::RIGHT : DataSource::LEFT);
+		}
+		else if (min.y == max.y)
+		{
+			return (min.y > 0 ? DataSource::TOP : DataSource::BOTTOM);
+		}
+
+		assert(min.z == max.z);
+		return (min.z > 0 ? DataSource::FRONT : DataSource::BACK);
+	}
+
+	Ogre::Vector2 CubeSphere::getFaceCoordinates(DataSource::Side side, const Ogre::Vector3 & position)
+	{
+		switch (side)
+		{
+		case DataSource::RIGHT:
+		case DataSource::LEFT:
+			return Ogre::Vector2(position.z, position.y);
+		case DataSource::TOP:
+		case DataSource::BOTTOM:
+			return Ogre::Vector2(position.x, position.z);
+		default:
+			return Ogre::Vector2(position.x, position.y);
+		}
+	}
+
+	void CubeSphere::getGridFrame(const Ogre::Vector3 & min, const Ogre::Vector3 & max, int quads,
+		Ogre::Vector3 & origin,
+		Ogre::Vector3 & stepX,
+		Ogre::Vector3 & stepY)
+	{
+		// Grid x follows the face coordinate u, grid y follows v, see
+		// getFaceCoordinates()
+		const Ogre::Vector3 step = (max - min) / (Ogre::Real) quads;
+
+		origin = min;
+		stepX = Ogre::Vector3::ZERO;
+		stepY = Ogre::Vector3::ZERO;
+
+		switch (getSide(min, max))
+		{
+		case DataSource::RIGHT:
+		case DataSource::LEFT:
+			stepX.z = step.z;
+			stepY.y = step.y;
+			break;
+		case DataSource::TOP:
+		case DataSource::BOTTOM:
+			stepX.x = step.x;
+			stepY.z = step.z;
+			break;
+		default:
+			stepX.x = step.x;
+			stepY.y = step.y;
+			break;
+		}
+	}
+
+	float CubeSphere::warp(CubeMapping mapping, float u)
+	{
+		switch (mapping)
+		{
+		case CUBE_MAPPING_TANGENT:
+			// Evaluated in double, tan(pi/4) then rounds to exactly 1.0f
+			return (float)std::tan(u * 0.78539816339744830962);
+		default:
+			return u;
+		}
+	}
+
+	Ogre::Vector3 CubeSphere::project(const Ogre::Vector3 & position)
+	{
+		// The coordinate along the face normal is +-1, which warp()
+		// leaves alone, so all three can go through it
+		float x = warp(msMapping, position.x);
+		float y = warp(msMapping, position.y);
+		float z = warp(msMapping, position.z);
+		float r = reciprocalSqrt(x*x + y*y + z*z);
+		return Ogre::Vector3(x * r, y * r, z * r);
+	}
+
+	ProjectGridKernel CubeSphere::getProjectGridKernel(DataSource::Side side, int quads, int padding)
+	{
+		return msSelectProjectGridKernel(side, quads, padding);
+	}
+
+	void CubeSphere::bindKernels(CpuIsa isa)
+	{
+		switch (isa)
+		{
+#if OGREPLANET_HAVE_AVX2
+		case CPU_ISA_AVX2:
+		case CPU_ISA_AVX512:
+			msSelectProjectGridKernel = &selectProjectGridKernelAVX2;
+			break;
+#endif
+#if OGREPLANET_HAVE_SSE
+		case CPU_ISA_SSE2:
+			msSelectProjectGridKernel = &selectProjectGridKernel<CPU_ISA_SSE2>;
+			break;
+#endif
+		default:
+			msSelectProjectGridKernel = &selectProjectGridKernel<CPU_ISA_SCALAR>;
+			break;
+		}
+	}
+}
@@ -0,0 +1,295 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef CUBESPHEREKERNEL_H
+#define CUBESPHEREKERNEL_H
+
+#include "OPCpuDispatch.h"
+#include "OPDataSource.h"
+#include "OPScratchArena.h"
+#include "OPSimd.h"
+
+#include <Ogre.h>
+
+#if OGREPLANET_HAVE_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace OgrePlanet
+{
+	// How points on the cube are moved onto the sphere
+	enum CubeMapping
+	{
+		// Normalise the cube point. Quads near the face centres end up
+		// about 5 times the area of those near the corners.
+		CUBE_MAPPING_NORMALISE = 0,
+		// Warp each face coordinate by tan(u*pi/4) before normalising,
+		// so that grid lines are evenly spaced in angle. This brings the
+		// area ratio down to about 1.4.
+		CUBE_MAPPING_TANGENT = 1,
+	};
+
+	// Projects a (quads + 2*padding + 1)^2 grid on one cube face onto the
+	// unit sphere. (u0, v0) and (u1, v1) are the face coordinates of the
+	// patch corners. The result is written as separate x, y and z arrays.
+	typedef void (*ProjectGridKernel)(CubeMapping mapping,
+		int quads, int padding,
+		float u0, float v0, float u1, float v1,
+		float * xs, float * ys, float * zs);
+
+	class CubeSphere
+	{
+	public:
+		// Select the mapping used by every patch. This has to be done
+		// before any planet is created, patches built with different
+		// mappings won't line up.
+		static void setMapping(CubeMapping mapping);
+		static CubeMapping getMapping();
+
+		// Which cube face a patch lies on. min and max are the patch
+		// corners on the cube, as passed to Patch.
+		static DataSource::Side getSide(const Ogre::Vector3 & min, const Ogre::Vector3 & max);
+
+		// Face coordinates of a point on the cube, for the given face
+		static Ogre::Vector2 getFaceCoordinates(DataSource::Side side, const Ogre::Vector3 & position);
+
+		// The cube position of grid point (x, y) of a patch with the given
+		// corners is origin + x*stepX + y*stepY, before the mapping is
+		// applied. Used to rebuild the grid in vertex programs.
+		static void getGridFrame(const Ogre::Vector3 & min, const Ogre::Vector3 & max, int quads,
+			Ogre::Vector3 & origin,
+			Ogre::Vector3 & stepX,
+			Ogre::Vector3 & stepY);
+
+		// Face coordinate u in [-1, 1] after applying the mapping. -1, 0
+		// and 1 are left exactly where they are, so patch corners on
+		// face edges agree with the neighbouring face.
+		static float warp(CubeMapping mapping, float u);
+
+		// A point on the cube moved onto the unit sphere with the current
+		// mapping. For single points, use the grid kernels for patches.
+		static Ogre::Vector3 project(const Ogre::Vector3 & position);
+
+		// Returns a kernel specialised for the face, quads and padding if
+		// there is one, otherwise a generic kernel for the face.
+		static ProjectGridKernel getProjectGridKernel(DataSource::Side side, int quads, int padding);
+
+		// Use the kernels for the given instruction set, see CpuDispatch
+		static void bindKernels(CpuIsa isa);
+
+	private:
+		typedef ProjectGridKernel (*ProjectGridKernelSelector)(DataSource::Side side, int quads, int padding);
+
+		static CubeMapping msMapping;
+		static ProjectGridKernelSelector msSelectProjectGridKernel;
+	};
+
+	// Kernel selector compiled with AVX, defined in OPKernelsAVX2.cpp
+	ProjectGridKernel selectProjectGridKernelAVX2(DataSource::Side side, int quads, int padding);
+
+	// The kernels are in an unnamed namespace, see OPSimd.h
+	namespace
+	{
+		// Which axes the face coordinates (u, v) and the face normal map to,
+		// and which direction the normal points in.
+		template <int Side> struct FaceTraits;
+		template <> struct FaceTraits<DataSource::RIGHT>  { enum { U = 2, V = 1, N = 0, SIGN =  1 }; };
+		template <> struct FaceTraits<DataSource::LEFT>   { enum { U = 2, V = 1, N = 0, SIGN = -1 }; };
+		template <> struct FaceTraits<DataSource::TOP>    { enum { U = 0, V = 2, N = 1, SIGN =  1 }; };
+		template <> struct FaceTraits<DataSource::BOTTOM> { enum { U = 0, V = 2, N = 1, SIGN = -1 }; };
+		template <> struct FaceTraits<DataSource::FRONT>  { enum { U = 0, V = 1, N = 2, SIGN =  1 }; };
+		template <> struct FaceTraits<DataSource::BACK>   { enum { U = 0, V = 1, N = 2, SIGN = -1 }; };
+
+		// Projects one row of count samples, with face coordinates us[i]
+		// along the row and v across it. Specialised below for each
+		// instruction set, this one is plain C++.
+		template <int Isa, int Side>
+		struct ProjectRow
+		{
+			static void run(const float * us, float v, int count,
+				float * xs, float * ys, float * zs)
+			{
+				typedef FaceTraits<Side> Traits;
+
+				float * out[3] = { xs, ys, zs };
+				const float n = (float)Traits::SIGN;
+
+				for (int i = 0; i < count; i++)
+				{
+					float u = us[i];
+					float r = 1.0f / std::sqrt(u*u + (v*v + 1.0f));
+					out[Traits::U][i] = u * r;
+					out[Traits::V][i] = v * r;
+					out[Traits::N][i] = n * r;
+				}
+			}
+		};
+
+#if OGREPLANET_HAVE_SSE
+		template <int Side>
+		struct ProjectRow<CPU_ISA_SSE2, Side>
+		{
+			static void run(const float * us, float v, int count,
+				float * xs, float * ys, float * zs)
+			{
+				typedef FaceTraits<Side> Traits;
+
+				float * out[3] = { xs, ys, zs };
+				float * outU = out[Traits::U];
+				float * outV = out[Traits::V];
+				float * outN = out[Traits::N];
+				const float n = (float)Traits::SIGN;
+
+				const __m128 vN = _mm_set1_ps(n);
+				const __m128 vV = _mm_set1_ps(v);
+				const __m128 vVV1 = _mm_set1_ps(v*v + 1.0f);
+
+				int i = 0;
+				for (; i + 4 <= count; i += 4)
+				{
+					__m128 vU = _mm_loadu_ps(us + i);
+					__m128 r = reciprocalSqrt4(_mm_add_ps(_mm_mul_ps(vU, vU), vVV1));
+					_mm_storeu_ps(outU + i, _mm_mul_ps(vU, r));
+					_mm_storeu_ps(outV + i, _mm_mul_ps(vV, r));
+					_mm_storeu_ps(outN + i, _mm_mul_ps(vN, r));
+				}
+
+				for (; i < count; i++)
+				{
+					float u = us[i];
+					float r = reciprocalSqrt(u*u + (v*v + 1.0f));
+					outU[i] = u * r;
+					outV[i] = v * r;
+					outN[i] = n * r;
+				}
+			}
+		};
+#endif
+
+		// Fills coords[0..side) with the mapped face coordinates of a grid
+		// line. Only side values are computed per patch, the mapping is
+		// separable so the whole grid shares them.
+		inline void faceCoordinates(CubeMapping mapping, float start, float end,
+			int quads, int padding, int side, float * coords)
+		{
+			const float delta = (end - start) / quads;
+			for (int i = 0; i < side; i++)
+			{
+				coords[i] = CubeSphere::warp(mapping, start + delta * (float)(i - padding));
+			}
+		}
+
+		// Generic kernel, for any quads and padding
+		template <int Isa, int Side>
+		void projectGrid(CubeMapping mapping,
+			int quads, int padding,
+			float u0, float v0, float u1, float v1,
+			float * xs, float * ys, float * zs)
+		{
+			const int side = quads + 2*padding + 1;
+			ScratchArena::Scope scope;
+			float * us = scope.allocate<float>(side);
+			float * vs = scope.allocate<float>(side);
+			faceCoordinates(mapping, u0, u1, quads, padding, side, us);
+			faceCoordinates(mapping, v0, v1, quads, padding, side, vs);
+
+			for (int y = 0; y < side; y++)
+			{
+				const int row = side * y;
+				ProjectRow<Isa, Side>::run(us, vs[y], side, xs + row, ys + row, zs + row);
+			}
+		}
+
+		// Kernel specialised at compile time for one face, quads and padding
+		template <int Isa, int Side, int Quads, int Padding>
+		void projectGridFixed(CubeMapping mapping,
+			int /*quads*/, int /*padding*/,
+			float u0, float v0, float u1, float v1,
+			float * xs, float * ys, float * zs)
+		{
+			const int side = Quads + 2*Padding + 1;
+			float us[side];
+			float vs[side];
+			faceCoordinates(mapping, u0, u1, Quads, Padding, side, us);
+			faceCoordinates(mapping, v0, v1, Quads, Padding, side, vs);
+
+			for (int y = 0; y < side; y++)
+			{
+				const int row = side * y;
+				ProjectRow<Isa, Side>::run(us, vs[y], side, xs + row, ys + row, zs + row);
+			}
+		}
+
+		template <int Isa, int Side, int Quads>
+		ProjectGridKernel selectProjectGridPadding(int padding)
+		{
+			switch (padding)
+			{
+			case 1:
+				return &projectGridFixed<Isa, Side, Quads, 1>;
+			case 2:
+				return &projectGridFixed<Isa, Side, Quads, 2>;
+			default:
+				return &projectGrid<Isa, Side>;
+			}
+		}
+
+		template <int Isa, int Side>
+		ProjectGridKernel selectProjectGridQuads(int quads, int padding)
+		{
+			switch (quads)
+			{
+			case 16:
+				return selectProjectGridPadding<Isa, Side, 16>(padding);
+			case 32:
+				return selectProjectGridPadding<Isa, Side, 32>(padding);
+			case 64:
+				return selectProjectGridPadding<Isa, Side, 64>(padding);
+			default:
+				return &projectGrid<Isa, Side>;
+			}
+		}
+
+		// Kernel for the face, quads and padding, for one instruction set
+		template <int Isa>
+		ProjectGridKernel selectProjectGridKernel(DataSource::Side side, int quads, int padding)
+		{
+			switch (side)
+			{
+			case DataSource::RIGHT:
+				return selectProjectGridQuads<Isa, DataSource::RIGHT>(quads, padding);
+			case DataSource::LEFT:
+				return selectProjectGridQuads<Isa, DataSource::LEFT>(quads, padding);
+			case DataSource::TOP:
+				return selectProjectGridQuads<Isa, DataSource::TOP>(quads, padding);
+			case DataSource::BOTTOM:
+				return selectProjectGridQuads<Isa, DataSource::BOTTOM>(quads, padding);
+			case DataSource::FRONT:
+				return selectProjectGridQuads<Isa, DataSource::FRONT>(quads, padding);
+			default:
+				return selectProjectGridQuads<Isa, DataSource::BACK>(quads, padding);
+			}
+		}
+	}
+}
+
+#endif // CUBESPHEREKERNEL_H
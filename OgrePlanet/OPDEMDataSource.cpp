@@ -33,6 +33,16 @@ namespace OgrePlanet
 		return lookupValue(phi, theta);
 	}
 
+	void DEMDataSource::sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n)
+	{
+		Ogre::Radian phi, theta;
+		for (int i = 0; i < n; i++)
+		{
+			convertToSpherical(Ogre::Vector3(xs[i], ys[i], zs[i]), phi, theta);
+			out[i] = lookupValue(phi, theta);
+		}
+	}
+
 	void DEMDataSource::convertToSpherical(const Ogre::Vector3 & position, Ogre::Radian & phi, Ogre::Radian & theta)
 	{
 		Ogre::Real r = position.length();
@@ -31,6 +31,8 @@ namespace OgrePlanet
 	{
 	public:
 		Ogre::Real getValue(const Ogre::Vector3 &position);
+		void sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n);
+		bool isIOBound() { return true; }
 
 	private:
 		void convertToSpherical(const Ogre::Vector3 & position, Ogre::Radian & phi, Ogre::Radian & theta);
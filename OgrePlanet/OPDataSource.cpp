@@ -0,0 +1,197 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPDataSource.h"
+
+#include "OPAsyncSampleQueue.h"
+#include "OPScratchArena.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace OgrePlanet
+{
+	// std::min() takes it by reference
+	const int DataSource::SAMPLE_BATCH_CHUNK;
+
+	void DataSource::sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n)
+	{
+		Ogre::Vector3 positions[SAMPLE_BATCH_CHUNK];
+
+		for (int start = 0; start < n; start += SAMPLE_BATCH_CHUNK)
+		{
+			int count = std::min(SAMPLE_BATCH_CHUNK, n - start);
+
+			for (int i = 0; i < count; i++)
+			{
+				positions[i].x = xs[start + i];
+				positions[i].y = ys[start + i];
+				positions[i].z = zs[start + i];
+			}
+
+			for (int i = 0; i < count; i++)
+			{
+				out[start + i] = getValue(positions[i]);
+			}
+		}
+	}
+
+	void DataSource::sampleGrid(const float * xs, const float * ys, const float * zs,
+		int quads,
+		int padding,
+		Ogre::Real * out,
+		const QuantizedHeights * parentData,
+		int position)
+	{
+		const int side = quads + 2*padding + 1;
+		ScratchArena::Scope scope;
+
+		if (parentData == 0)
+		{
+			// Nothing to reuse, sample the whole grid in one go
+			float * values = scope.allocate<float>(side * side);
+			sampleBatch(xs, ys, zs, values, side * side);
+			std::copy(values, values + side * side, out);
+			return;
+		}
+
+		int * indices = scope.allocate<int>(side * side);
+		float * sampleXs = scope.allocate<float>(side * side);
+		float * sampleYs = scope.allocate<float>(side * side);
+		float * sampleZs = scope.allocate<float>(side * side);
+		float * values = scope.allocate<float>(side * side);
+
+		int n = GridSamples::gather(xs, ys, zs, quads, padding, out, parentData, position,
+			indices, sampleXs, sampleYs, sampleZs);
+
+		if (n > 0)
+		{
+			sampleBatch(sampleXs, sampleYs, sampleZs, values, n);
+			for (int i = 0; i < n; i++)
+			{
+				out[indices[i]] = values[i];
+			}
+		}
+	}
+
+	void DataSource::sampleBatchAsync(const float * xs, const float * ys, const float * zs, float * out, int n,
+		const SampleCallback & callback)
+	{
+		AsyncSampleQueue * queue = AsyncSampleQueue::getSingletonPtr();
+
+		if (isIOBound() && queue && queue->isEnabled())
+		{
+			queue->sampleBatch(this, xs, ys, zs, out, n, callback);
+		}
+		else
+		{
+			sampleBatch(xs, ys, zs, out, n);
+			callback();
+		}
+	}
+
+	bool DataSource::getHeightBounds(const Ogre::Vector3 & min, const Ogre::Vector3 & max, Ogre::Real & low, Ogre::Real & high)
+	{
+		if (!isConstant())
+		{
+			return false;
+		}
+
+		low = high = getValue(Ogre::Vector3::UNIT_Z);
+		return true;
+	}
+
+	void GridSamples::gather(const float * gridXs, const float * gridYs, const float * gridZs,
+		int quads,
+		int padding,
+		Ogre::Real * out,
+		const QuantizedHeights * parentData,
+		int position)
+	{
+		const int side = quads + 2*padding + 1;
+
+		indices.resize(side * side);
+		xs.resize(side * side);
+		ys.resize(side * side);
+		zs.resize(side * side);
+
+		int n = gather(gridXs, gridYs, gridZs, quads, padding, out, parentData, position,
+			&indices[0], &xs[0], &ys[0], &zs[0]);
+
+		indices.resize(n);
+		xs.resize(n);
+		ys.resize(n);
+		zs.resize(n);
+		values.resize(n);
+	}
+
+	int GridSamples::gather(const float * gridXs, const float * gridYs, const float * gridZs,
+		int quads,
+		int padding,
+		Ogre::Real * out,
+		const QuantizedHeights * parentData,
+		int position,
+		int * indices,
+		float * xs,
+		float * ys,
+		float * zs)
+	{
+		const int side = quads + 2*padding + 1;
+		int n = 0;
+
+		for (int y = 0-padding; y <= (quads + padding); y++)
+		{
+			for (int x = 0-padding; x <= (quads + padding); x++)
+			{
+				int index = side * (y + padding) + (x + padding);
+
+				if (parentData != 0 &&
+					(x % 2) == 0 &&
+					(y % 2) == 0)
+				{
+					int parentX = x / 2 + (position % 2 == 1 ? quads / 2 : 0);
+					int parentY = y / 2 + (position >= 2 ? quads / 2 : 0);
+					int parentIndex = side * (parentY + padding) + (parentX + padding);
+					out[index] = parentData->decode(parentIndex);
+				}
+				else
+				{
+					indices[n] = index;
+					xs[n] = gridXs[index];
+					ys[n] = gridYs[index];
+					zs[n] = gridZs[index];
+					n++;
+				}
+			}
+		}
+
+		return n;
+	}
+
+	void GridSamples::scatter(Ogre::Real * out) const
+	{
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			out[indices[i]] = values[i];
+		}
+	}
+}
@@ -23,14 +23,56 @@ THE SOFTWARE.
 #ifndef DATASOURCE_H
 #define DATASOURCE_H
 
+#include "OPQuantizedHeights.h"
+
 #include <Ogre.h>
 #include <boost/shared_array.hpp>
+#include <boost/function.hpp>
+
+#include <vector>
 
 namespace OgrePlanet
 {
+	// The samples of a patch grid that actually have to be evaluated
+	// (i.e. those that can't be copied from the parent patch), gathered
+	// into contiguous arrays suitable for DataSource::sampleBatch().
+	struct GridSamples
+	{
+		std::vector<int> indices;
+		std::vector<float> xs;
+		std::vector<float> ys;
+		std::vector<float> zs;
+		std::vector<float> values;
+
+		void gather(const float * gridXs, const float * gridYs, const float * gridZs,
+			int quads,
+			int padding,
+			Ogre::Real * out,
+			const QuantizedHeights * parentData = 0,
+			int position = 0);
+		void scatter(Ogre::Real * out) const;
+		int size() const { return (int)indices.size(); }
+
+		// Same as above, but writes the samples to caller provided
+		// arrays of (quads + 2*padding + 1)^2 elements. Returns the
+		// number of samples.
+		static int gather(const float * gridXs, const float * gridYs, const float * gridZs,
+			int quads,
+			int padding,
+			Ogre::Real * out,
+			const QuantizedHeights * parentData,
+			int position,
+			int * indices,
+			float * xs,
+			float * ys,
+			float * zs);
+	};
+
 	class DataSource
 	{
 	public:
+		typedef boost::function<void ()> SampleCallback;
+
 		enum Side {
 			FRONT = 0,
 			BACK = 1,
@@ -41,9 +83,50 @@ namespace OgrePlanet
 		};
 
 		virtual Ogre::Real getValue(const Ogre::Vector3 &position) = 0;
+
+		// Sample n arbitrary points given as separate x, y and z arrays.
+		// The default implementation falls back on getValue(), one chunk
+		// at a time. Sources that can evaluate many points at once
+		// (or that have per-call overhead) should override this.
+		virtual void sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n);
+
+		// Sample a (quads + 2*padding + 1)^2 grid of unit sphere positions
+		// through sampleBatch(). If parentData is given, every other sample
+		// is copied from the parent patch instead of being evaluated.
+		void sampleGrid(const float * xs, const float * ys, const float * zs,
+			int quads,
+			int padding,
+			Ogre::Real * out,
+			const QuantizedHeights * parentData = 0,
+			int position = 0);
+
+		// True if sampling may block on disk or network I/O. Sampling
+		// such a source through sampleBatchAsync() lets the caller keep
+		// doing CPU work while the data is read.
+		virtual bool isIOBound() { return false; }
+
+		// True if getValue() is the same for every position. Patches of
+		// such a source don't sample it, and take their normals from
+		// the sphere.
+		virtual bool isConstant() { return false; }
+
+		// Conservative bounds of getValue() over the part of the cube
+		// between min and max. Returns false if the source can't bound
+		// it without sampling. Called on the thread preparing the patch.
+		// The default implementation only knows about constant sources.
+		virtual bool getHeightBounds(const Ogre::Vector3 & min, const Ogre::Vector3 & max, Ogre::Real & low, Ogre::Real & high);
+
+		// Asynchronous version of sampleBatch(). The buffers must stay
+		// valid until callback has been called. callback may be called
+		// on any thread, or before this function returns.
+		virtual void sampleBatchAsync(const float * xs, const float * ys, const float * zs, float * out, int n,
+			const SampleCallback & callback);
+
 		virtual bool getValuesSupported() { return false; }
 		virtual boost::shared_array<Ogre::Real> getValues(int quads, int padding, const Ogre::Vector3 & min, const Ogre::Vector3 & max) { return boost::shared_array<Ogre::Real>(); }
 	protected:
+		static const int SAMPLE_BATCH_CHUNK = 256;
+
 	private:
 	};
 }
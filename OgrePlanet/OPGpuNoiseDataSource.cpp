@@ -8,6 +8,13 @@ namespace OgrePlanet
 		return 0;
 	}
 
+	void GpuNoiseDataSource::sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n)
+	{
+		// The GPU path only renders whole patches (see getValues()),
+		// arbitrary points are not supported. Match getValue().
+		std::fill(out, out + n, 0.0f);
+	}
+
 	boost::shared_array<Ogre::Real> GpuNoiseDataSource::getValues(int quads, int padding, const Ogre::Vector3 & min, const Ogre::Vector3 & max)
 	{
 		Ogre::Timer timer;
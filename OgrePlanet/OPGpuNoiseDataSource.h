@@ -31,6 +31,7 @@ namespace OgrePlanet
 	{
 	public:
 		Ogre::Real getValue(const Ogre::Vector3 &position);
+		void sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n);
 		bool getValuesSupported() { return true; }
 		boost::shared_array<Ogre::Real> getValues(int quads, int padding, const Ogre::Vector3 & min, const Ogre::Vector3 & max);
 	protected:
@@ -21,26 +21,76 @@ THE SOFTWARE.
 */
 
 #include "OPHeightDataResourceLoader.h"
+#include "OPScratchArena.h"
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <limits>
 
 namespace OgrePlanet
 {
 	HeightDataResourceLoader::HeightDataResourceLoader(DataSource * dataSource,
 		int quads,
-		Ogre::Vector3 & min,
-		Ogre::Vector3 & max,
+		const Ogre::Vector3 & min,
+		const Ogre::Vector3 & max,
+		int padding,
+		const QuantizedHeights * parentData,
+		int position)
+	{
+		reset(dataSource, quads, min, max, padding, parentData, position);
+	}
+
+	HeightDataResourceLoader::HeightDataResourceLoader() : 
+	mQuads(0),
+		mPadding(0),
+		mConstant(false),
+		mConstantHeight(0.0),
+		mMaxHeight(0.0),
+		mRetainHeightData(true),
+		mMin(Ogre::Vector3::ZERO),
+		mMax(Ogre::Vector3::ZERO),
+		mDataSource(0),
+		mParentData(0),
+		mPosition(0),
+		mSide(DataSource::FRONT),
+		mHeightDataRequested(false),
+		mHeightDataReady(false)
+	{
+	}
+
+	void HeightDataResourceLoader::clearHeightData()
+	{
+		std::vector<Ogre::Real>().swap(mData);
+		mHeights.clear();
+		mGridSamples = GridSamples();
+	}
+
+	void HeightDataResourceLoader::reset(DataSource * dataSource,
+		int quads,
+		const Ogre::Vector3 & min,
+		const Ogre::Vector3 & max,
 		int padding,
-		boost::shared_array<Ogre::Real> data,
-		boost::shared_array<Ogre::Real> parentData,
-		int position) : 
-	mDataSource(dataSource),
-		mQuads(quads),
-		mMin(min),
-		mMax(max),
-		mPadding(padding),
-		mData(data),
-		mParentData(parentData),
-		mPosition(position)
+		const QuantizedHeights * parentData,
+		int position)
 	{
+		clearHeightData();
+
+		mQuads = quads;
+		mPadding = padding;
+		mConstant = dataSource->isConstant();
+		mConstantHeight = mConstant ? dataSource->getValue(Ogre::Vector3::UNIT_Z) : 0.0f;
+		// Unknown until the data has been sampled
+		mMaxHeight = mConstant ? mConstantHeight : std::numeric_limits<Ogre::Real>::max();
+		mRetainHeightData = true;
+		mMin = min;
+		mMax = max;
+		mDataSource = dataSource;
+		mParentData = parentData;
+		mPosition = position;
+		mSide = CubeSphere::getSide(min, max);
+		mHeightDataRequested = false;
+		mHeightDataReady = false;
 	}
 
 	HeightDataResourceLoader::~HeightDataResourceLoader()
@@ -49,167 +99,125 @@ namespace OgrePlanet
 
 	void HeightDataResourceLoader::prepareResource(Ogre::Resource *resource)
 	{
-		assert(
-			(mMin.x == 1.0 && mMax.x == 1.0) ||
-			(mMin.x == -1.0 && mMax.x == -1.0) ||
-			(mMin.y == 1.0 && mMax.y == 1.0) ||
-			(mMin.y == -1.0 && mMax.y == -1.0) ||
-			(mMin.z == 1.0 && mMax.z == 1.0) ||
-			(mMin.z == -1.0 && mMax.z == -1.0));
-
-		// Create a height map, with one extra padding in each direction,
-		// so we can calculate normals later (if needed)
-		mUnitSpherePos = boost::shared_array<Ogre::Vector3>(new Ogre::Vector3[(mQuads + 2*mPadding +1) * (mQuads + 2*mPadding + 1)]);
-		//mData.reset(new Ogre::Real[(mQuads + 2*mPadding + 1) * (mQuads + 2*mPadding + 1)]);
-
-		Ogre::Vector3 pos;
-
-		// Use "texture coordinates"
-		// _xPos is where U axis changes
-		Ogre::Real *_xPos;
-		// _yPos is where V axis changes
-		Ogre::Real *_yPos;
-		// _zPos is where the normal would be
-		Ogre::Real *_zPos;
-
-		Ogre::Vector2 startPos;
-		Ogre::Vector2 endPos;
-
-		int a;
-		int b;
-		int c;
-
-		if (mMin.x == 1.0 && mMax.x == 1.0)
+		// Everything allocated from the arena is released when we return
+		ScratchArena::Scope scope;
+
+		const int side = mQuads + 2*mPadding + 1;
+		float * xs = scope.allocate<float>(side * side);
+		float * ys = scope.allocate<float>(side * side);
+		float * zs = scope.allocate<float>(side * side);
+		projectGrid(xs, ys, zs);
+
+		// The height data may already have been read through
+		// requestHeightData(). A constant source needs no height data.
+		if (!mHeightDataReady && !mConstant)
 		{
-			// Patch on right side
-			// On right side, T coordinate lies in Z axis
-			_xPos = &(pos.z);
-			// U coordinate lies in Y axis
-			_yPos = &(pos.y);
-			// X axis is normal
-			_zPos = &(pos.x);
-			startPos.x = mMin.z;
-			startPos.y = mMin.y;
-			endPos.x = mMax.z;
-			endPos.y = mMax.y;
-			a = -1;
-			b = -1;
-			c = 1;
-		}
-		if (mMin.x == -1.0 && mMax.x == -1.0)
-		{
-			// Patch on left side
-			_xPos = &(pos.z);
-			_yPos = &(pos.y);
-			_zPos = &(pos.x);
-			startPos.x = mMin.z;
-			startPos.y = mMin.y;
-			endPos.x = mMax.z;
-			endPos.y = mMax.y;
-			a = 1;
-			b = -1;
-			c = -1;
-		}
-		else if (mMin.y == 1.0 && mMax.y == 1.0)
-		{
-			// Patch on top side
-			_xPos = &(pos.x);
-			_yPos = &(pos.z);
-			_zPos = &(pos.y);
-			startPos.x = mMin.x;
-			startPos.y = mMin.z;
-			endPos.x = mMax.x;
-			endPos.y = mMax.z;
-			a = 1;
-			b = 1;
-			c = 1;
-		}
-		else if (mMin.y == -1.0 && mMax.y == -1.0)
-		{
-			// Patch on bottom side
-			_xPos = &(pos.x);
-			_yPos = &(pos.z);
-			_zPos = &(pos.y);
-			startPos.x = mMin.x;
-			startPos.y = mMin.z;
-			endPos.x = mMax.x;
-			endPos.y = mMax.z;
-			a = 1;
-			b = -1;
-			c = -1;
+			mData.resize(side * side);
+
+			if (mDataSource->getValuesSupported())
+			{
+				boost::shared_array<Ogre::Real> values = mDataSource->getValues(mQuads, mPadding, mMin, mMax);
+				std::copy(values.get(), values.get() + mData.size(), mData.begin());
+			}
+			else
+			{
+				mDataSource->sampleGrid(xs, ys, zs,
+					mQuads,
+					mPadding,
+					&mData[0],
+					mParentData,
+					mPosition);
+			}
+
+			mHeightDataReady = true;
 		}
-		else if (mMin.z == 1.0 && mMax.z == 1.0)
+
+		if (!mConstant)
 		{
-			// Patch on front side
-			_xPos = &(pos.x);
-			_yPos = &(pos.y);
-			_zPos = &(pos.z);
-			startPos.x = mMin.x;
-			startPos.y = mMin.y;
-			endPos.x = mMax.x;
-			endPos.y = mMax.y;
-			a = 1;
-			b = -1;
-			c = 1;
+			mHeights.encode(&mData[0], side * side);
+
+			// The bounds also hold for the patch's descendants, the
+			// samples only for what this patch draws
+			Ogre::Real low;
+			if (!mDataSource->getHeightBounds(mMin, mMax, low, mMaxHeight))
+			{
+				mMaxHeight = mHeights.getMax();
+			}
 		}
-		else if (mMin.z == -1.0 && mMax.z == -1.0)
+
+		prepareGeometry(resource, xs, ys, zs);
+
+		std::vector<Ogre::Real>().swap(mData);
+		if (!mRetainHeightData)
 		{
-			// Patch on back side
-			_xPos = &(pos.x);
-			_yPos = &(pos.y);
-			_zPos = &(pos.z);
-			startPos.x = mMin.x;
-			startPos.y = mMin.y;
-			endPos.x = mMax.x;
-			endPos.y = mMax.y;
-			a = -1;
-			b = -1;
-			c = -1;
+			mHeights.clear();
 		}
+	}
 
-		Ogre::Real &xPos = (*_xPos);
-		Ogre::Real &yPos = (*_yPos);
-		Ogre::Real &zPos = (*_zPos);
+	bool HeightDataResourceLoader::needsHeightDataRequest()
+	{
+		return !mConstant &&
+			mDataSource->isIOBound() &&
+			!mDataSource->getValuesSupported() &&
+			!mHeightDataRequested;
+	}
 
-		Ogre::Vector3 minBounds(MAXINT, MAXINT, MAXINT);
-		Ogre::Vector3 maxBounds(-MAXINT, -MAXINT, -MAXINT);
+	void HeightDataResourceLoader::requestHeightData(const DataSource::SampleCallback & callback)
+	{
+		mHeightDataRequested = true;
 
-		if (mDataSource->getValuesSupported())
 		{
-			mData = mDataSource->getValues(mQuads, mPadding, mMin, mMax);
+			// The projected grid is only needed to pick out the samples,
+			// prepareResource() projects it again later
+			ScratchArena::Scope scope;
+
+			const int side = mQuads + 2*mPadding + 1;
+			float * xs = scope.allocate<float>(side * side);
+			float * ys = scope.allocate<float>(side * side);
+			float * zs = scope.allocate<float>(side * side);
+			projectGrid(xs, ys, zs);
+
+			mData.resize(side * side);
+			mGridSamples.gather(xs, ys, zs,
+				mQuads,
+				mPadding,
+				&mData[0],
+				mParentData,
+				mPosition);
 		}
-		else
+
+		if (mGridSamples.size() == 0)
 		{
-			for (int y = 0-mPadding; y <= (mQuads + mPadding); y++)
-			{
-				for (int x = 0-mPadding; x <= (mQuads + mPadding); x++)
-				{
-					int index = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding);
-
-					xPos = (startPos.x + (endPos.x - startPos.x) * (((double) x)/mQuads));
-					yPos = (startPos.y + (endPos.y - startPos.y) * (((double) y)/mQuads));
-					zPos = c;
-					pos.normalise();
-					mUnitSpherePos[index] = pos;
-
-					if (mParentData.get() != 0 &&
-						(x % 2) == 0 &&
-						(y % 2) == 0)
-					{
-						int parentX = x / 2 + (mPosition % 2 == 1 ? mQuads / 2 : 0);
-						int parentY = y / 2 + (mPosition >= 2 ? mQuads / 2 : 0);
-						int parentIndex = (mQuads + 2*mPadding + 1) * (parentY + mPadding) + (parentX + mPadding);
-						Ogre::Real height = mParentData[parentIndex];
-						mData[index] = height;
-					}
-					else
-					{
-						Ogre::Real height = mDataSource->getValue(pos);
-						mData[index] = height;
-					}
-				}
-			}
+			heightDataSampled(callback);
+			return;
 		}
+
+		mDataSource->sampleBatchAsync(&mGridSamples.xs[0], &mGridSamples.ys[0], &mGridSamples.zs[0],
+			&mGridSamples.values[0],
+			mGridSamples.size(),
+			boost::bind(&HeightDataResourceLoader::heightDataSampled, this, callback));
+	}
+
+	void HeightDataResourceLoader::heightDataSampled(const DataSource::SampleCallback & callback)
+	{
+		mGridSamples.scatter(&mData[0]);
+		mGridSamples = GridSamples();
+		mHeightDataReady = true;
+
+		callback();
+	}
+
+	void HeightDataResourceLoader::projectGrid(float * xs, float * ys, float * zs)
+	{
+		// Project the grid (with padding, so we can calculate normals
+		// later if needed) onto the unit sphere
+		Ogre::Vector2 start = CubeSphere::getFaceCoordinates(mSide, mMin);
+		Ogre::Vector2 end = CubeSphere::getFaceCoordinates(mSide, mMax);
+		ProjectGridKernel kernel = CubeSphere::getProjectGridKernel(mSide, mQuads, mPadding);
+		kernel(CubeSphere::getMapping(),
+			mQuads, mPadding,
+			start.x, start.y, end.x, end.y,
+			xs, ys, zs);
 	}
 
 	const Ogre::Vector3 & HeightDataResourceLoader::getMin()
@@ -222,8 +230,13 @@ namespace OgrePlanet
 		return mMax;
 	}
 
-	boost::shared_array<Ogre::Real> HeightDataResourceLoader::getData()
+	size_t HeightDataResourceLoader::getHeightDataSize()
+	{
+		return mData.size() * sizeof(Ogre::Real) + mHeights.getSize();
+	}
+
+	const QuantizedHeights * HeightDataResourceLoader::getData()
 	{
-		return mData;
+		return mHeights.empty() ? 0 : &mHeights;
 	}
 }
\ No newline at end of file
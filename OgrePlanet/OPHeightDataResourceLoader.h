@@ -23,42 +23,114 @@ THE SOFTWARE.
 #ifndef HEIGHTDATARESOURCELOADER_H
 #define HEIGHTDATARESOURCELOADER_H
 
+#include "OPCubeSphereKernel.h"
 #include "OPDataSource.h"
 #include "OPPatchMeshLoaderDestroyer.h"
+#include "OPQuantizedHeights.h"
 #include <Ogre.h>
-#include <boost/shared_array.hpp>
+
+#include <vector>
 
 namespace OgrePlanet
 {
 	class HeightDataResourceLoader : public Ogre::ManualResourceLoader
 	{
 	public:
+		// parentData is the height data of the parent patch (see
+		// getData()), which must stay alive until this loader has
+		// prepared its resource. min and max are copied, the loader may
+		// outlive the patch that created it.
 		HeightDataResourceLoader(DataSource * dataSource,
 			int quads,
-			Ogre::Vector3 & min,
-			Ogre::Vector3 & max,
+			const Ogre::Vector3 & min,
+			const Ogre::Vector3 & max,
 			int padding,
-			boost::shared_array<Ogre::Real> data,
-			boost::shared_array<Ogre::Real> parentData = boost::shared_array<Ogre::Real>(),
+			const QuantizedHeights * parentData = 0,
 			int position = 0);
 		virtual ~HeightDataResourceLoader() = 0;
 		void prepareResource(Ogre::Resource * resource);
+
+		// True if the height data comes from an I/O bound source and
+		// hasn't been requested through requestHeightData() yet.
+		bool needsHeightDataRequest();
+		// Start reading the height data asynchronously. callback is
+		// called (possibly on another thread) once prepareResource()
+		// can run without blocking on I/O.
+		void requestHeightData(const DataSource::SampleCallback & callback);
+
 		const Ogre::Vector3 & getMin();
 		const Ogre::Vector3 & getMax();
-		boost::shared_array<Ogre::Real> getData();
+		// Height data, (quads + 2*padding + 1)^2 samples. Valid once the
+		// resource has been prepared, null for a constant data source or
+		// if the data isn't retained (see below).
+		const QuantizedHeights * getData();
+		// Highest height of the patch, from the data source's bounds if
+		// it has them (see DataSource::getHeightBounds()), otherwise
+		// from the samples. Valid once the resource has been prepared.
+		Ogre::Real getMaxHeight() { return mMaxHeight; }
+
+		// The height data is only kept for the children of the patch,
+		// see parentData. Without it, it is freed as soon as the
+		// resource has been prepared and getData() returns null.
+		void setRetainHeightData(bool retain) { mRetainHeightData = retain; }
+		// In bytes
+		size_t getHeightDataSize();
 
 	protected:
-		boost::shared_array<Ogre::Vector3> mUnitSpherePos;
-		boost::shared_array<Ogre::Real> mData;
-		const int mQuads;
-		const int mPadding;
+		// For loaders that are reset() before use
+		HeightDataResourceLoader();
+
+		void clearHeightData();
+		// Reinitialises the loader in place as if it had just been
+		// constructed with these arguments, freeing any height data
+		void reset(DataSource * dataSource,
+			int quads,
+			const Ogre::Vector3 & min,
+			const Ogre::Vector3 & max,
+			int padding,
+			const QuantizedHeights * parentData,
+			int position);
+
+		// Called by prepareResource() once the height data is available.
+		// xs, ys and zs is the grid projected onto the unit sphere, they
+		// live in this thread's ScratchArena and are only valid during
+		// the call.
+		virtual void prepareGeometry(Ogre::Resource * resource,
+			const float * xs,
+			const float * ys,
+			const float * zs) {}
+
+		// The data source is constant (see DataSource::isConstant()),
+		// mData and mHeights are left empty and every height is
+		// mConstantHeight
+		bool isConstant() { return mConstant; }
+
+		// The samples as read from the data source. Only allocated while
+		// the height data is being read and the resource prepared.
+		std::vector<Ogre::Real> mData;
+		// mData quantised, what prepareGeometry() should build from and
+		// what is kept afterwards
+		QuantizedHeights mHeights;
+		int mQuads;
+		int mPadding;
+		bool mConstant;
+		Ogre::Real mConstantHeight;
+		Ogre::Real mMaxHeight;
+		bool mRetainHeightData;
 
 	private:
-		const Ogre::Vector3 & mMin;
-		const Ogre::Vector3 & mMax;
+		void projectGrid(float * xs, float * ys, float * zs);
+		void heightDataSampled(const DataSource::SampleCallback & callback);
+
+		Ogre::Vector3 mMin;
+		Ogre::Vector3 mMax;
 		DataSource * mDataSource;
-		boost::shared_array<Ogre::Real> mParentData;
+		const QuantizedHeights * mParentData;
 		int mPosition;
+		DataSource::Side mSide;
+		GridSamples mGridSamples;
+		bool mHeightDataRequested;
+		bool mHeightDataReady;
 	};
 }
 
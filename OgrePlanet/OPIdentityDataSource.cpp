@@ -28,4 +28,9 @@ namespace OgrePlanet
 	{
 		return 0;
 	}
+
+	void IdentityDataSource::sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n)
+	{
+		std::fill(out, out + n, 0.0f);
+	}
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// 8-wide versions of the terrain kernels. Only called when CpuDispatch
+// has found AVX2 support, so nothing in here may run on older CPUs. The
+// approximate reciprocal square root gives the same result for ymm, xmm
+// and scalar operands, so vertices shared between patches still match
+// whichever lane they end up in.
+
+#include "OPCubeSphereKernel.h"
+#include "OPPatchMeshKernel.h"
+
+#if OGREPLANET_HAVE_AVX2
+
+#if !defined(_MSC_VER) && !defined(__AVX__)
+#error "OPKernelsAVX2.cpp has to be compiled with -mavx, or OGREPLANET_HAVE_AVX2 defined to 0"
+#endif
+
+#include <immintrin.h>
+
+namespace OgrePlanet
+{
+	namespace
+	{
+		inline __m256 reciprocalSqrt8(__m256 x)
+		{
+			const __m256 half = _mm256_set1_ps(0.5f);
+			const __m256 threeHalves = _mm256_set1_ps(1.5f);
+			__m256 r = _mm256_rsqrt_ps(x);
+			return _mm256_mul_ps(r, _mm256_sub_ps(threeHalves, _mm256_mul_ps(_mm256_mul_ps(half, x), _mm256_mul_ps(r, r))));
+		}
+
+		struct SimdAVX
+		{
+			typedef __m256 V;
+			typedef SimdSSE Tail;
+			enum { WIDTH = 8 };
+
+			static V load(const float * p) { return _mm256_loadu_ps(p); }
+			static V loadUShort(const unsigned short * p)
+			{
+				// Widened in two halves, _mm256_cvtepu16_epi32 needs AVX2
+				// and Visual Studio 2010 only has AVX
+				__m128i s = _mm_loadu_si128((const __m128i *) p);
+				__m128i lo = _mm_unpacklo_epi16(s, _mm_setzero_si128());
+				__m128i hi = _mm_unpackhi_epi16(s, _mm_setzero_si128());
+				return _mm256_cvtepi32_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1));
+			}
+			static void store(float * p, V v) { _mm256_storeu_ps(p, v); }
+			static V set1(float f) { return _mm256_set1_ps(f); }
+			static V add(V a, V b) { return _mm256_add_ps(a, b); }
+			static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+			static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+			static V min(V a, V b) { return _mm256_min_ps(a, b); }
+			static V max(V a, V b) { return _mm256_max_ps(a, b); }
+			static V rsqrt(V x) { return reciprocalSqrt8(x); }
+			static V selectOdd(V even, V odd, int x)
+			{
+				// Lanes alternate even, odd, ...
+				assert((x & 7) == 0);
+				const __m256 mask = _mm256_castsi256_ps(_mm256_set_epi32(-1, 0, -1, 0, -1, 0, -1, 0));
+				return _mm256_blendv_ps(even, odd, mask);
+			}
+			// Avoid the AVX to SSE transition penalty in the tail
+			static void end() { _mm256_zeroupper(); }
+		};
+
+		// Partial specialisations have to be in the namespace of the
+		// template, see OPCubeSphereKernel.h
+		template <int Side>
+		struct ProjectRow<CPU_ISA_AVX2, Side>
+		{
+			static void run(const float * us, float v, int count,
+				float * xs, float * ys, float * zs)
+			{
+				typedef FaceTraits<Side> Traits;
+
+				float * out[3] = { xs, ys, zs };
+				float * outU = out[Traits::U];
+				float * outV = out[Traits::V];
+				float * outN = out[Traits::N];
+				const float n = (float)Traits::SIGN;
+
+				const __m256 vN = _mm256_set1_ps(n);
+				const __m256 vV = _mm256_set1_ps(v);
+				const __m256 vVV1 = _mm256_set1_ps(v*v + 1.0f);
+
+				int i = 0;
+				for (; i + 8 <= count; i += 8)
+				{
+					__m256 vU = _mm256_loadu_ps(us + i);
+					__m256 r = reciprocalSqrt8(_mm256_add_ps(_mm256_mul_ps(vU, vU), vVV1));
+					_mm256_storeu_ps(outU + i, _mm256_mul_ps(vU, r));
+					_mm256_storeu_ps(outV + i, _mm256_mul_ps(vV, r));
+					_mm256_storeu_ps(outN + i, _mm256_mul_ps(vN, r));
+				}
+
+				_mm256_zeroupper();
+
+				ProjectRow<CPU_ISA_SSE2, Side>::run(us + i, v, count - i, xs + i, ys + i, zs + i);
+			}
+		};
+	}
+
+	ProjectGridKernel selectProjectGridKernelAVX2(DataSource::Side side, int quads, int padding)
+	{
+		return selectProjectGridKernel<CPU_ISA_AVX2>(side, quads, padding);
+	}
+
+	void displaceGridAVX2(const float * xs, const float * ys, const float * zs,
+		const Ogre::uint16 * heights,
+		float heightOffset,
+		float heightScale,
+		int n,
+		float baseRadius,
+		float scalingFactor,
+		float * px, float * py, float * pz,
+		float * boundsMin,
+		float * boundsMax)
+	{
+		displaceGrid<SimdAVX>(xs, ys, zs, heights, heightOffset, heightScale, n, baseRadius, scalingFactor, px, py, pz, boundsMin, boundsMax);
+	}
+
+	void buildVerticesAVX2(const float * px, const float * py, const float * pz,
+		int quads,
+		int padding,
+		int morphStep,
+		const float * center,
+		float texXMin,
+		float texXMax,
+		float texYMin,
+		float texYMax,
+		float * vertices)
+	{
+		buildVertices<SimdAVX>(px, py, pz, quads, padding, morphStep, center, texXMin, texXMax, texYMin, texYMax, vertices);
+	}
+}
+
+#endif // OGREPLANET_HAVE_AVX2
@@ -94,4 +94,15 @@ namespace OgrePlanet
 		return element->getValue(position.x, position.y, position.z, cache);
 	};
 
+	void NoiseppDataSource::sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n)
+	{
+		// Take the lock once for the whole batch instead of once per sample
+		OGRE_LOCK_AUTO_MUTEX
+		for (int i = 0; i < n; i++)
+		{
+			pipeline->cleanCache(cache);
+			out[i] = element->getValue(xs[i], ys[i], zs[i], cache);
+		}
+	}
+
 }
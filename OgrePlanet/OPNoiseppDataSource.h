@@ -35,6 +35,7 @@ namespace OgrePlanet
 		NoiseppDataSource();
 		~NoiseppDataSource();
 		Ogre::Real getValue(const Ogre::Vector3 &position);
+		void sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n);
 
 	protected:
 		OGRE_AUTO_MUTEX
@@ -22,22 +22,28 @@ THE SOFTWARE.
 
 #include "OPPatch.h"
 
+#include "OPCubeSphereKernel.h"
 #include "OPPatchMeshLoaderQueue.h"
 #include "OPUtil.h"
-#include "OPStitching.h"
 
 #include <boost/shared_array.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <algorithm>
+
 namespace OgrePlanet
 {
-	std::set<Ogre::String> Patch::patchNameSet;
+	std::map<Ogre::String, Patch *> Patch::patchRegistry;
+	std::vector<Patch *> Patch::dirtyPatches;
+	std::vector<void *> Patch::msFreePatches;
+	Ogre::Real Patch::msSplitDistance = 1.0;
+	Ogre::Real Patch::msMergeDistance = 1.5;
+	unsigned long Patch::msMinShownTime = 500;
 
 	Patch::Patch(
 		const Ogre::String & name,
 		const Ogre::String & materialName,
-		Ogre::SceneManager * mgr,
-		Ogre::SceneNode * parentNode,
+		PlanetRenderable * planetRenderable,
 		const Ogre::Vector3 & min,
 		const Ogre::Vector3 & max,
 		Ogre::Real texXMin,
@@ -47,7 +53,7 @@ namespace OgrePlanet
 		const Ogre::Real baseRadius,
 		const Ogre::Real scalingFactor,
 		DataSource * dataSource,
-		int quads,
+		const PatchResolution & resolution,
 		Ogre::RenderQueueGroupID renderQueue,
 		bool prepareInBackground,
 		int depth,
@@ -57,8 +63,7 @@ namespace OgrePlanet
 		int position) :
 	mName(name),
 		mMaterialName(materialName),
-		mMgr(mgr),
-		mNode(0),
+		mPlanetRenderable(planetRenderable),
 		mMin(min),
 		mMax(max),
 		mTexXMin(texXMin),
@@ -68,17 +73,22 @@ namespace OgrePlanet
 		mBaseRadius(baseRadius),
 		mScalingFactor(scalingFactor),
 		mDataSource(dataSource),
-		mQuads(quads),
+		mResolution(&resolution),
+		mQuads(resolution.getQuads(depth)),
 		mRenderQueue(renderQueue),
-		mEntity(0),
 		mTicket(0),
 		mDepth(depth),
 		mMinDepth(minDepth),
 		mMaxDepth(maxDepth),
+		mSeaLevel(parent != 0 ? parent->mSeaLevel : 0.0),
+		mSubmergedMargin(parent != 0 ? parent->mSubmergedMargin : 0.0),
+		mBudget(parent != 0 ? parent->mBudget : 0),
+		mLastVisibleFrame(0),
+		mCoarsen(false),
 		mParent(parent),
-		mHeightData(new Ogre::Real[(quads + 2*2 + 1) * (quads + 2*2 + 1)]),
-		mParentSceneNode(parentNode),
-		mGeometryUpdated(false)
+		mRegistered(false),
+		mStitchingDirty(false),
+		mShownTime(0)
 	{
 		//mPatchMeshLoader = new PatchMeshLoader(
 		//	mDataSource,
@@ -95,9 +105,16 @@ namespace OgrePlanet
 		//	mHeightData,
 		//	(parent != 0 ? mParent->getHeightData() : boost::shared_array<Ogre::Real>()),
 		//	position);
-		mPatchMeshLoader = new PatchMeshLoader(
+		const int morphStep = mResolution->getMorphStep(mDepth);
+		const bool sameGrid = (parent != 0 &&
+			parent->mQuads == mQuads &&
+			PatchMeshKernel::getPadding(mResolution->getMorphStep(mDepth - 1)) == PatchMeshKernel::getPadding(morphStep));
+
+		PatchMeshLoaderQueue::getSingleton().acquireMesh(mMesh, mPatchMeshLoader);
+		mPatchMeshLoader->reset(
 			mDataSource,
 			mQuads,
+			morphStep,
 			mMin,
 			mMax,
 			mTexXMin,
@@ -106,19 +123,24 @@ namespace OgrePlanet
 			mTexYMax,
 			mBaseRadius,
 			mScalingFactor,
-			mAABB,
-			mHeightData,
-			(parent != 0 ? mParent->getHeightData() : boost::shared_array<Ogre::Real>()),
+			// Every other sample can be copied from the parent if it has
+			// the same grid
+			(sameGrid ? mParent->getHeightData() : 0),
 			position);
 
+		// Only children copy from the height data
+		mPatchMeshLoader->setRetainHeightData(canSplit());
+
 		for (int i = 0; i < 4; i++)
 		{
 			mSubPatch[i] = 0;
 		}
 
-		mMesh = Ogre::MeshManager::getSingleton().createManual(mName + "Mesh",
-			Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
-			mPatchMeshLoader);
+		mRenderable = mPlanetRenderable->createPatch(
+			mMesh,
+			mMaterialName,
+			mRenderQueue,
+			mMaxDepth - mDepth);
 
 		if (prepareInBackground)
 		{
@@ -142,98 +164,198 @@ namespace OgrePlanet
 		}
 
 		if (mParent) {
-			Ogre::String ln = leftNeighbour = getLeftNeighbourName(mName);
-			if (Ogre::StringUtil::match(mName, "*top*", false) && !Ogre::StringUtil::match(leftNeighbour, "*top*", false)) {
-				 ln = leftNeighbour = rotateCCW(leftNeighbour);
-			} else if (Ogre::StringUtil::match(mName, "*bottom*", false) && !Ogre::StringUtil::match(leftNeighbour, "*bottom*", false)) {
-				ln = leftNeighbour = rotateCW(leftNeighbour);
+			mNeighbourName[STITCHING_SIDE_W] = getLeftNeighbourName(mName);
+			if (Ogre::StringUtil::match(mName, "*top*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_W], "*top*", false)) {
+				 mNeighbourName[STITCHING_SIDE_W] = rotateCCW(mNeighbourName[STITCHING_SIDE_W]);
+			} else if (Ogre::StringUtil::match(mName, "*bottom*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_W], "*bottom*", false)) {
+				mNeighbourName[STITCHING_SIDE_W] = rotateCW(mNeighbourName[STITCHING_SIDE_W]);
 			}
 
-			Ogre::String rn = rightNeighbour = getRightNeighbourName(mName);
-			if (Ogre::StringUtil::match(mName, "*top*", false) && !Ogre::StringUtil::match(rightNeighbour, "*top*", false)) {
-				rn = rightNeighbour = rotateCW(rightNeighbour);
-			} else if (Ogre::StringUtil::match(mName, "*bottom*", false) && !Ogre::StringUtil::match(rightNeighbour, "*bottom*", false)) {
-				rn = rightNeighbour = rotateCCW(rightNeighbour);
+			mNeighbourName[STITCHING_SIDE_E] = getRightNeighbourName(mName);
+			if (Ogre::StringUtil::match(mName, "*top*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_E], "*top*", false)) {
+				mNeighbourName[STITCHING_SIDE_E] = rotateCW(mNeighbourName[STITCHING_SIDE_E]);
+			} else if (Ogre::StringUtil::match(mName, "*bottom*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_E], "*bottom*", false)) {
+				mNeighbourName[STITCHING_SIDE_E] = rotateCCW(mNeighbourName[STITCHING_SIDE_E]);
 			}
 
-			Ogre::String un = upNeighbour = getUpNeighbourName(mName);
-			if (Ogre::StringUtil::match(mName, "*top*", false) && !Ogre::StringUtil::match(upNeighbour, "*top*", false)) {
-				un = upNeighbour = rotate180(upNeighbour);
-			} else if (Ogre::StringUtil::match(mName, "*left*", false) && !Ogre::StringUtil::match(upNeighbour, "*left*", false)) {
-				un = upNeighbour = rotateCW(upNeighbour);
-			} else if (Ogre::StringUtil::match(mName, "*right*", false) && !Ogre::StringUtil::match(upNeighbour, "*right*", false)) {
-				un = upNeighbour = rotateCCW(upNeighbour);
-			} else if (Ogre::StringUtil::match(mName, "*back*", false) && !Ogre::StringUtil::match(upNeighbour, "*back*", false)) {
-				un = upNeighbour = rotate180(upNeighbour);
+			mNeighbourName[STITCHING_SIDE_N] = getUpNeighbourName(mName);
+			if (Ogre::StringUtil::match(mName, "*top*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_N], "*top*", false)) {
+				mNeighbourName[STITCHING_SIDE_N] = rotate180(mNeighbourName[STITCHING_SIDE_N]);
+			} else if (Ogre::StringUtil::match(mName, "*left*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_N], "*left*", false)) {
+				mNeighbourName[STITCHING_SIDE_N] = rotateCW(mNeighbourName[STITCHING_SIDE_N]);
+			} else if (Ogre::StringUtil::match(mName, "*right*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_N], "*right*", false)) {
+				mNeighbourName[STITCHING_SIDE_N] = rotateCCW(mNeighbourName[STITCHING_SIDE_N]);
+			} else if (Ogre::StringUtil::match(mName, "*back*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_N], "*back*", false)) {
+				mNeighbourName[STITCHING_SIDE_N] = rotate180(mNeighbourName[STITCHING_SIDE_N]);
 			}
 
-			Ogre::String dn = downNeighbour = getDownNeighbourName(mName);
-			if (Ogre::StringUtil::match(mName, "*bottom*", false) && !Ogre::StringUtil::match(downNeighbour, "*bottom*", false)) {
-				dn = downNeighbour = rotate180(downNeighbour);
-			} else if (Ogre::StringUtil::match(mName, "*left*", false) && !Ogre::StringUtil::match(downNeighbour, "*left*", false)) {
-				dn = downNeighbour = rotateCCW(downNeighbour);
-			} else if (Ogre::StringUtil::match(mName, "*right*", false) && !Ogre::StringUtil::match(downNeighbour, "*right*", false)) {
-				dn = downNeighbour = rotateCW(downNeighbour);
-			} else if (Ogre::StringUtil::match(mName, "*back*", false) && !Ogre::StringUtil::match(downNeighbour, "*back*", false)) {
-				dn = downNeighbour = rotate180(downNeighbour);
+			mNeighbourName[STITCHING_SIDE_S] = getDownNeighbourName(mName);
+			if (Ogre::StringUtil::match(mName, "*bottom*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_S], "*bottom*", false)) {
+				mNeighbourName[STITCHING_SIDE_S] = rotate180(mNeighbourName[STITCHING_SIDE_S]);
+			} else if (Ogre::StringUtil::match(mName, "*left*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_S], "*left*", false)) {
+				mNeighbourName[STITCHING_SIDE_S] = rotateCCW(mNeighbourName[STITCHING_SIDE_S]);
+			} else if (Ogre::StringUtil::match(mName, "*right*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_S], "*right*", false)) {
+				mNeighbourName[STITCHING_SIDE_S] = rotateCW(mNeighbourName[STITCHING_SIDE_S]);
+			} else if (Ogre::StringUtil::match(mName, "*back*", false) && !Ogre::StringUtil::match(mNeighbourName[STITCHING_SIDE_S], "*back*", false)) {
+				mNeighbourName[STITCHING_SIDE_S] = rotate180(mNeighbourName[STITCHING_SIDE_S]);
 			}
 		}
 	}
 
-	// This destructor is not thread safe. When you delete a patch,
-	// you better be damn sure that patch's mesh isn't waiting to be prepared
-	// by the PatchMeshLoaderQueue.
+	// Safe while the mesh is still being prepared. The mesh and its
+	// loader are only freed, or reused, once no worker can be using
+	// them, see PatchMeshLoaderQueue::retireMesh().
 	Patch::~Patch()
 	{
 		hide();
-		patchNameSet.erase(mName);
-		Ogre::MeshManager::getSingleton().remove(mMesh->getHandle());
-		delete mPatchMeshLoader;
+		mPlanetRenderable->destroyPatch(mRenderable);
+		unregisterPatch();
+
+		// Registered or not, updateDirtyStitching() must not see us again
+		if (mStitchingDirty)
+		{
+			dirtyPatches.erase(std::find(dirtyPatches.begin(), dirtyPatches.end(), this));
+		}
+
+		PatchMeshLoaderQueue::getSingleton().retireMesh(mMesh, mPatchMeshLoader);
+	}
+
+	void * Patch::operator new(size_t size)
+	{
+		assert(size == sizeof(Patch));
+
+		if (msFreePatches.empty())
+		{
+			return ::operator new(size);
+		}
+
+		void * p = msFreePatches.back();
+		msFreePatches.pop_back();
+		return p;
+	}
+
+	void Patch::operator delete(void * p)
+	{
+		if (p != 0)
+		{
+			msFreePatches.push_back(p);
+		}
 	}
 
-	void Patch::setCameraPosition(const Ogre::Vector3 & position)
+	void Patch::freePool()
 	{
+		for (std::vector<void *>::iterator i = msFreePatches.begin(); i != msFreePatches.end(); ++i)
+		{
+			::operator delete(*i);
+		}
+		std::vector<void *>().swap(msFreePatches);
+	}
+
+	void Patch::setCameraPosition(const Ogre::Vector3 & position, unsigned long now)
+	{
+		// Attached patches are reached through the children they are
+		// attached to
 		for (int i = 0; i < 4; i++)
 		{
 			if (mSubPatch[i])
 			{
-				mSubPatch[i]->setCameraPosition(position);
+				mSubPatch[i]->setCameraPosition(position, now);
 			}
 		}
 
-		if ((mEntity ||
+		// Submerged patches are neither drawn nor refined, the layers
+		// attached to them stay at this depth
+		bool submerged = isSubmerged(position);
+		mRenderable->setCulled(submerged);
+
+		mLastVisibleFrame = mRenderable->getQueuedFrame();
+		for (std::vector<Patch *>::iterator i = mAttached.begin(); i != mAttached.end(); ++i)
+		{
+			mLastVisibleFrame = std::max(mLastVisibleFrame, (*i)->mRenderable->getQueuedFrame());
+		}
+		for (int i = 0; i < 4; i++)
+		{
+			if (mSubPatch[i])
+			{
+				mLastVisibleFrame = std::max(mLastVisibleFrame, mSubPatch[i]->mLastVisibleFrame);
+			}
+		}
+
+		if (mBudget)
+		{
+			mBudget->add(getUsage());
+		}
+
+		if (mCoarsen && isLeaf())
+		{
+			mCoarsen = false;
+		}
+
+		// Off screen detail is the first to go when memory is short
+		bool starved = mBudget &&
+			mBudget->getLoad() > PatchBudget::LOW_WATER_MARK &&
+			!isOnScreen();
+
+		// Either we are shown, or our children are. If not, children
+		// that were left behind by an earlier merge have to go first.
+		bool splittable = mRenderable->isShown() ||
 			(mSubPatch[0] &&
 			mSubPatch[1] &&
 			mSubPatch[2] &&
-			mSubPatch[3])) &&
-			(mDepth < mMinDepth ||
-			((mMaxDepth == -1 || mDepth < mMaxDepth) &&
-			Util::distance(position - mPatchCenter, mAABB) < mAABB.getSize().length())))
-		{
-			if (mSubPatch[0] && mSubPatch[0]->isPrepared() &&
-				mSubPatch[1] && mSubPatch[1]->isPrepared() &&
-				mSubPatch[2] && mSubPatch[2]->isPrepared() &&
-				mSubPatch[3] && mSubPatch[3]->isPrepared())
+			mSubPatch[3]);
+
+		// Split and merge at different distances, so a camera near the
+		// threshold doesn't create and destroy the same children over
+		// and over
+		// The bounds are known once we have been shown
+		Ogre::Real distance = splittable ? Util::distance(position - mPatchCenter, mAABB) : 0.0;
+		Ogre::Real size = mAABB.getSize().length();
+		bool forceSplit = mDepth < mMinDepth;
+		bool split = forceSplit || (canSplit() && !mCoarsen && !starved && distance < size * msSplitDistance);
+		bool merge = !forceSplit && (mCoarsen || !canSplit() || distance > size * msMergeDistance);
+
+		if (splittable && !submerged && split)
+		{
+			// Attached patches split along with us, unless they are as
+			// deep as they go
+			bool childrenPrepared = areChildrenPrepared();
+			for (std::vector<Patch *>::iterator i = mAttached.begin(); i != mAttached.end(); ++i)
+			{
+				if ((*i)->canSplit() && !(*i)->areChildrenPrepared())
+				{
+					childrenPrepared = false;
+				}
+			}
+
+			if (childrenPrepared)
 			{
-				if (mParent &&
-					(patchNameSet.find(leftNeighbour) == patchNameSet.end() ||
-					patchNameSet.find(rightNeighbour) == patchNameSet.end() ||
-					patchNameSet.find(upNeighbour) == patchNameSet.end() ||
-					patchNameSet.find(downNeighbour) == patchNameSet.end()))
+				bool canStitch = canStitchChildren();
+				for (std::vector<Patch *>::iterator i = mAttached.begin(); i != mAttached.end(); ++i)
 				{
-					// Don't show children if it would cause a crack
+					if ((*i)->canSplit() && !(*i)->canStitchChildren())
+					{
+						canStitch = false;
+					}
+				}
+
+				if (!canStitch)
+				{
+					// Don't show children if they couldn't be stitched to
+					// their neighbours without a crack
 					return;
 				}
 
 				// We are showing, but we are too close and our subPatches are ready to be shown
 				// so show sub-patches and hide ourselves.
-				for (int i = 0; i < 4; i++)
+				showChildren();
+				for (std::vector<Patch *>::iterator i = mAttached.begin(); i != mAttached.end(); ++i)
 				{
-					mSubPatch[i]->show();
+					if ((*i)->canSplit())
+					{
+						(*i)->showChildren();
+					}
 				}
 
-				hide();
-
 				return;
 			}
 			else if (mSubPatch[0] == 0 ||
@@ -241,163 +363,36 @@ namespace OgrePlanet
 				mSubPatch[2] == 0 ||
 				mSubPatch[3] == 0)
 			{
-				Ogre::Vector3 center(
-					mMin.x + (mMax.x - mMin.x)/2,
-					mMin.y + (mMax.y - mMin.y)/2,
-					mMin.z + (mMax.z - mMin.z)/2);
-
-				Ogre::Vector3 topCenter;
-				Ogre::Vector3 bottomCenter;
-				Ogre::Vector3 leftCenter;
-				Ogre::Vector3 rightCenter;
-
-				if (mMin.x == mMax.x)
-				{
-					// This patch is perpendicular to the x axis
-					// (right/left patches)
-					topCenter = Ogre::Vector3(mMin.x, mMin.y, center.z);
-					bottomCenter = Ogre::Vector3(mMax.x, mMax.y, center.z);
-					leftCenter = Ogre::Vector3(mMin.x, center.y, mMin.z);
-					rightCenter = Ogre::Vector3(mMax.x, center.y, mMax.z);
-				}
-				else if (mMin.y == mMax.y)
-				{
-					// This patch is perpendicular to the y axis
-					// (top/bottom patches)
-					topCenter = Ogre::Vector3(center.x, mMin.y, mMin.z);
-					bottomCenter = Ogre::Vector3(center.x, mMax.y, mMax.z);
-					leftCenter = Ogre::Vector3(mMin.x, mMin.y, center.z);
-					rightCenter = Ogre::Vector3(mMax.x, mMax.y, center.z);
-				}
-				else if (mMin.z == mMax.z)
+				createChildren();
+				for (std::vector<Patch *>::iterator i = mAttached.begin(); i != mAttached.end(); ++i)
 				{
-					// This patch is perpendicular to the z axis
-					// (front/back patches)
-					topCenter = Ogre::Vector3(center.x, mMin.y, mMin.z);
-					bottomCenter = Ogre::Vector3(center.x, mMax.y, mMax.z);
-					leftCenter = Ogre::Vector3(mMin.x, center.y, mMin.z);
-					rightCenter = Ogre::Vector3(mMax.x, center.y, mMax.z);
-				}
-				else
-				{
-					assert(false);
-				}
-
-				if (mSubPatch[0] == 0)
-				{
-					// "Upper left" patch
-					mSubPatch[0] = new Patch(
-						mName + "0",
-						mMaterialName,
-						mMgr,
-						mParentSceneNode,
-						mMin,
-						center,
-						(mDepth < mMaxDepth - 9) ? 0 : mTexXMin,
-						(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexXMin + (mTexXMax - mTexXMin) / 2.0,
-						(mDepth < mMaxDepth - 9) ? 0 : mTexYMin,
-						(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexYMin + (mTexYMax - mTexYMin) / 2.0,
-						mBaseRadius,
-						mScalingFactor,
-						mDataSource,
-						mQuads,
-						mRenderQueue,
-						true,
-						mDepth+1,
-						mMinDepth,
-						mMaxDepth,
-						this,
-						0);
-				}
-
-				if (mSubPatch[1] == 0)
-				{
-					// "Upper right" patch
-					mSubPatch[1] = new Patch(
-						mName + "1",
-						mMaterialName,
-						mMgr,
-						mParentSceneNode,
-						topCenter,
-						rightCenter,
-						(mDepth < mMaxDepth - 9) ? 0 : mTexXMin + (mTexXMax - mTexXMin) / 2.0,
-						(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexXMax,
-						(mDepth < mMaxDepth - 9) ? 0 : mTexYMin,
-						(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexYMin + (mTexYMax - mTexYMin) / 2.0,
-						mBaseRadius,
-						mScalingFactor,
-						mDataSource,
-						mQuads,
-						mRenderQueue,
-						true,
-						mDepth+1,
-						mMinDepth,
-						mMaxDepth,
-						this,
-						1);
-				}
-
-				if (mSubPatch[2] == 0)
-				{
-					// "Lower left" patch
-					mSubPatch[2] = new Patch(
-						mName + "2",
-						mMaterialName,
-						mMgr,
-						mParentSceneNode,
-						leftCenter,
-						bottomCenter,
-						(mDepth < mMaxDepth - 9) ? 0 : mTexXMin,
-						(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexXMin + (mTexXMax - mTexXMin) / 2.0,
-						(mDepth < mMaxDepth - 9) ? 0 : mTexYMin + (mTexYMax - mTexYMin) / 2.0,
-						(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexYMax,
-						mBaseRadius,
-						mScalingFactor,
-						mDataSource,
-						mQuads,
-						mRenderQueue,
-						true,
-						mDepth+1,
-						mMinDepth,
-						mMaxDepth,
-						this,
-						2);
+					if ((*i)->canSplit())
+					{
+						(*i)->createChildren();
+					}
 				}
 
-				if (mSubPatch[3] == 0)
+				// Each child carries the attached patches' children in the
+				// same place
+				for (int child = 0; child < 4; child++)
 				{
-					// "Lower right" patch
-					mSubPatch[3] = new Patch(
-						mName + "3",
-						mMaterialName,
-						mMgr,
-						mParentSceneNode,
-						center,
-						mMax,
-						(mDepth < mMaxDepth - 9) ? 0 : mTexXMin + (mTexXMax - mTexXMin) / 2.0,
-						(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexXMax,
-						(mDepth < mMaxDepth - 9) ? 0 : mTexYMin + (mTexYMax - mTexYMin) / 2.0,
-						(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexYMax,
-						mBaseRadius,
-						mScalingFactor,
-						mDataSource,
-						mQuads,
-						mRenderQueue,
-						true,
-						mDepth+1,
-						mMinDepth,
-						mMaxDepth,
-						this,
-						3);
+					mSubPatch[child]->mAttached.clear();
+					for (std::vector<Patch *>::iterator i = mAttached.begin(); i != mAttached.end(); ++i)
+					{
+						if ((*i)->mSubPatch[child])
+						{
+							mSubPatch[child]->mAttached.push_back((*i)->mSubPatch[child]);
+						}
+					}
 				}
 			}
 		}
-		else
+		else if (!splittable || submerged || merge)
 		{
 			// We are too far away to split.
 			// If we have children, we have to remove them.
 			// This can only be done after the children's meshes have been prepared (this is done on another thread).
-			if (isLoaded())
+			if (isLoaded() && canMergeChildren(now))
 			{
 				// We have no entity, but nothing is preventing us from creating one.
 				// (I.e. the mesh we need is either prepared or loaded.)
@@ -409,18 +404,43 @@ namespace OgrePlanet
 				{
 					// If we have no children, or if the children we have are
 					// leafs, it's time to hide the children and show ourselves instead.
-					if (!mEntity)
+					if (!mRenderable->isShown())
 					{
 						show();
 					}
 
-					for (int i = 0; i < 4; i++)
+					for (std::vector<Patch *>::iterator i = mAttached.begin(); i != mAttached.end(); ++i)
+					{
+						if (!(*i)->mRenderable->isShown())
+						{
+							(*i)->show();
+						}
+					}
+
+					for (int child = 0; child < 4; child++)
 					{
-						if (mSubPatch[i] && mSubPatch[i]->isReady())
+						if (!mSubPatch[child] || !mSubPatch[child]->isReady())
 						{
-							mSubPatch[i]->hide();
-							delete mSubPatch[i];
-							mSubPatch[i] = 0;
+							continue;
+						}
+
+						// The attached patches' children go with ours
+						bool attachedReady = true;
+						for (std::vector<Patch *>::iterator i = mAttached.begin(); i != mAttached.end(); ++i)
+						{
+							if ((*i)->mSubPatch[child] && !(*i)->mSubPatch[child]->isReady())
+							{
+								attachedReady = false;
+							}
+						}
+
+						if (attachedReady)
+						{
+							for (std::vector<Patch *>::iterator i = mAttached.begin(); i != mAttached.end(); ++i)
+							{
+								(*i)->destroyChild(child);
+							}
+							destroyChild(child);
 						}
 					}
 				}
@@ -428,6 +448,338 @@ namespace OgrePlanet
 		}
 	}
 
+	void Patch::attach(Patch * patch)
+	{
+		assert(patch->mMin == mMin && patch->mMax == mMax && patch->mDepth == mDepth);
+		mAttached.push_back(patch);
+	}
+
+	void Patch::setSeaLevel(Ogre::Real seaLevel, Ogre::Real margin)
+	{
+		mSeaLevel = seaLevel;
+		mSubmergedMargin = margin;
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (mSubPatch[i])
+			{
+				mSubPatch[i]->setSeaLevel(seaLevel, margin);
+			}
+		}
+	}
+
+	void Patch::setBudget(PatchBudget * budget)
+	{
+		mBudget = budget;
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (mSubPatch[i])
+			{
+				mSubPatch[i]->setBudget(budget);
+			}
+		}
+	}
+
+	PatchBudget::Usage Patch::getUsage()
+	{
+		PatchBudget::Usage usage;
+		usage.patches = 1 + mAttached.size();
+
+		// Meshes being prepared on another thread are left out
+		if (isReady())
+		{
+			usage.cpuBytes += mPatchMeshLoader->getCpuSize();
+			usage.gpuBytes += mPatchMeshLoader->getGpuSize();
+		}
+
+		for (std::vector<Patch *>::iterator i = mAttached.begin(); i != mAttached.end(); ++i)
+		{
+			if ((*i)->isReady())
+			{
+				usage.cpuBytes += (*i)->mPatchMeshLoader->getCpuSize();
+				usage.gpuBytes += (*i)->mPatchMeshLoader->getGpuSize();
+			}
+		}
+
+		return usage;
+	}
+
+	PatchBudget::Usage Patch::getChildrenUsage()
+	{
+		PatchBudget::Usage usage;
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (mSubPatch[i])
+			{
+				usage += mSubPatch[i]->getUsage();
+			}
+		}
+
+		return usage;
+	}
+
+	void Patch::collectMergeCandidates(std::vector<Patch *> & candidates)
+	{
+		if (isLeaf())
+		{
+			return;
+		}
+
+		bool childrenAreLeaves = true;
+		for (int i = 0; i < 4; i++)
+		{
+			if (mSubPatch[i] && !mSubPatch[i]->isLeaf())
+			{
+				childrenAreLeaves = false;
+				mSubPatch[i]->collectMergeCandidates(candidates);
+			}
+		}
+
+		if (childrenAreLeaves && mDepth >= mMinDepth && !isOnScreen())
+		{
+			candidates.push_back(this);
+		}
+	}
+
+	bool Patch::isOnScreen()
+	{
+		// Queued in the frame that was just rendered, or the one being
+		// rendered
+		return mLastVisibleFrame + 1 >= Ogre::Root::getSingleton().getNextFrameNumber();
+	}
+
+	bool Patch::canSplit()
+	{
+		return mMaxDepth == -1 || mDepth < mMaxDepth;
+	}
+
+	bool Patch::isSubmerged(const Ogre::Vector3 & position)
+	{
+		// The highest height is only known once the mesh is prepared
+		if (mSeaLevel <= 0.0 || !isReady() || position.length() < mSeaLevel)
+		{
+			return false;
+		}
+
+		return mBaseRadius + mPatchMeshLoader->getMaxHeight() * mScalingFactor < mSeaLevel - mSubmergedMargin;
+	}
+
+	bool Patch::areChildrenPrepared()
+	{
+		return mSubPatch[0] && mSubPatch[0]->isPrepared() &&
+			mSubPatch[1] && mSubPatch[1]->isPrepared() &&
+			mSubPatch[2] && mSubPatch[2]->isPrepared() &&
+			mSubPatch[3] && mSubPatch[3]->isPrepared();
+	}
+
+	bool Patch::canMergeChildren(unsigned long now)
+	{
+		if (isLeaf())
+		{
+			return true;
+		}
+
+		// Children that were just shown stay for a while, so they aren't
+		// merged again as soon as the camera moves back
+		for (int i = 0; i < 4; i++)
+		{
+			if (mSubPatch[i] &&
+				mSubPatch[i]->mRenderable->isShown() &&
+				now - mSubPatch[i]->mShownTime < msMinShownTime)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool Patch::canStitchChildren()
+	{
+		// Skirts hide cracks against neighbours of any size
+		if (mPatchMeshLoader->hasSkirts())
+		{
+			return true;
+		}
+
+		int childLevels = mResolution->getLevelDifference(mDepth + 1, mDepth);
+		return getStitchLevel(STITCHING_SIDE_W) + childLevels <= StitchingIndices::MAX_LEVEL &&
+			getStitchLevel(STITCHING_SIDE_E) + childLevels <= StitchingIndices::MAX_LEVEL &&
+			getStitchLevel(STITCHING_SIDE_N) + childLevels <= StitchingIndices::MAX_LEVEL &&
+			getStitchLevel(STITCHING_SIDE_S) + childLevels <= StitchingIndices::MAX_LEVEL;
+	}
+
+	void Patch::showChildren()
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			mSubPatch[i]->show();
+		}
+
+		hide();
+	}
+
+	void Patch::destroyChild(int child)
+	{
+		if (mSubPatch[child])
+		{
+			mSubPatch[child]->hide();
+			delete mSubPatch[child];
+			mSubPatch[child] = 0;
+		}
+	}
+
+	void Patch::createChildren()
+	{
+		Ogre::Vector3 center(
+			mMin.x + (mMax.x - mMin.x)/2,
+			mMin.y + (mMax.y - mMin.y)/2,
+			mMin.z + (mMax.z - mMin.z)/2);
+
+		Ogre::Vector3 topCenter;
+		Ogre::Vector3 bottomCenter;
+		Ogre::Vector3 leftCenter;
+		Ogre::Vector3 rightCenter;
+
+		if (mMin.x == mMax.x)
+		{
+			// This patch is perpendicular to the x axis
+			// (right/left patches)
+			topCenter = Ogre::Vector3(mMin.x, mMin.y, center.z);
+			bottomCenter = Ogre::Vector3(mMax.x, mMax.y, center.z);
+			leftCenter = Ogre::Vector3(mMin.x, center.y, mMin.z);
+			rightCenter = Ogre::Vector3(mMax.x, center.y, mMax.z);
+		}
+		else if (mMin.y == mMax.y)
+		{
+			// This patch is perpendicular to the y axis
+			// (top/bottom patches)
+			topCenter = Ogre::Vector3(center.x, mMin.y, mMin.z);
+			bottomCenter = Ogre::Vector3(center.x, mMax.y, mMax.z);
+			leftCenter = Ogre::Vector3(mMin.x, mMin.y, center.z);
+			rightCenter = Ogre::Vector3(mMax.x, mMax.y, center.z);
+		}
+		else if (mMin.z == mMax.z)
+		{
+			// This patch is perpendicular to the z axis
+			// (front/back patches)
+			topCenter = Ogre::Vector3(center.x, mMin.y, mMin.z);
+			bottomCenter = Ogre::Vector3(center.x, mMax.y, mMax.z);
+			leftCenter = Ogre::Vector3(mMin.x, center.y, mMin.z);
+			rightCenter = Ogre::Vector3(mMax.x, center.y, mMax.z);
+		}
+		else
+		{
+			assert(false);
+		}
+
+		if (mSubPatch[0] == 0)
+		{
+			// "Upper left" patch
+			mSubPatch[0] = new Patch(
+				mName + "0",
+				mMaterialName,
+				mPlanetRenderable,
+				mMin,
+				center,
+				(mDepth < mMaxDepth - 9) ? 0 : mTexXMin,
+				(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexXMin + (mTexXMax - mTexXMin) / 2.0,
+				(mDepth < mMaxDepth - 9) ? 0 : mTexYMin,
+				(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexYMin + (mTexYMax - mTexYMin) / 2.0,
+				mBaseRadius,
+				mScalingFactor,
+				mDataSource,
+				*mResolution,
+				mRenderQueue,
+				true,
+				mDepth+1,
+				mMinDepth,
+				mMaxDepth,
+				this,
+				0);
+		}
+
+		if (mSubPatch[1] == 0)
+		{
+			// "Upper right" patch
+			mSubPatch[1] = new Patch(
+				mName + "1",
+				mMaterialName,
+				mPlanetRenderable,
+				topCenter,
+				rightCenter,
+				(mDepth < mMaxDepth - 9) ? 0 : mTexXMin + (mTexXMax - mTexXMin) / 2.0,
+				(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexXMax,
+				(mDepth < mMaxDepth - 9) ? 0 : mTexYMin,
+				(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexYMin + (mTexYMax - mTexYMin) / 2.0,
+				mBaseRadius,
+				mScalingFactor,
+				mDataSource,
+				*mResolution,
+				mRenderQueue,
+				true,
+				mDepth+1,
+				mMinDepth,
+				mMaxDepth,
+				this,
+				1);
+		}
+
+		if (mSubPatch[2] == 0)
+		{
+			// "Lower left" patch
+			mSubPatch[2] = new Patch(
+				mName + "2",
+				mMaterialName,
+				mPlanetRenderable,
+				leftCenter,
+				bottomCenter,
+				(mDepth < mMaxDepth - 9) ? 0 : mTexXMin,
+				(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexXMin + (mTexXMax - mTexXMin) / 2.0,
+				(mDepth < mMaxDepth - 9) ? 0 : mTexYMin + (mTexYMax - mTexYMin) / 2.0,
+				(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexYMax,
+				mBaseRadius,
+				mScalingFactor,
+				mDataSource,
+				*mResolution,
+				mRenderQueue,
+				true,
+				mDepth+1,
+				mMinDepth,
+				mMaxDepth,
+				this,
+				2);
+		}
+
+		if (mSubPatch[3] == 0)
+		{
+			// "Lower right" patch
+			mSubPatch[3] = new Patch(
+				mName + "3",
+				mMaterialName,
+				mPlanetRenderable,
+				center,
+				mMax,
+				(mDepth < mMaxDepth - 9) ? 0 : mTexXMin + (mTexXMax - mTexXMin) / 2.0,
+				(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexXMax,
+				(mDepth < mMaxDepth - 9) ? 0 : mTexYMin + (mTexYMax - mTexYMin) / 2.0,
+				(mDepth < mMaxDepth - 9) ? Ogre::Math::Pow(2.0, mMaxDepth - mDepth - 1.0) : mTexYMax,
+				mBaseRadius,
+				mScalingFactor,
+				mDataSource,
+				*mResolution,
+				mRenderQueue,
+				true,
+				mDepth+1,
+				mMinDepth,
+				mMaxDepth,
+				this,
+				3);
+		}
+	}
+
 	bool Patch::isPrepared()
 	{
 		return mMesh->isPrepared();
@@ -453,69 +805,67 @@ namespace OgrePlanet
 
 	void Patch::show()
 	{
-		if (!mEntity)
+		mPatchCenter = mPatchMeshLoader->getCenter();
+		mAABB = mPatchMeshLoader->getAABB();
+
+		if (!mRenderable->isShown())
 		{
-			mEntity = mMgr->createEntity(mName + "Entity", mName + "Mesh");
-			mEntity->setMaterialName(mMaterialName);
-			mEntity->setRenderQueueGroupAndPriority(mRenderQueue, mMaxDepth - mDepth);
+			// The mesh was only prepared in the background
+			mMesh->load();
+
+			mRenderable->setCenter(mPatchCenter, mAABB);
+			mPlanetRenderable->showPatch(mRenderable);
+
+			mShownTime = Ogre::Root::getSingleton().getTimer()->getMilliseconds();
+			mRenderable->setConstant(3, Ogre::Vector4((Ogre::Real) mShownTime, 0.0, 0.0, 0.0));
+			mRenderable->setConstant(6, Ogre::Vector4(mPatchCenter.x, mPatchCenter.y, mPatchCenter.z, 0.0));
 
-			for (unsigned int i = 0; i < mEntity->getNumSubEntities(); i++)
+			if (mPatchMeshLoader->isPacked() || mPatchMeshLoader->isHeightOnly())
 			{
-				Ogre::Real time = (Ogre::Real)Ogre::Root::getSingleton().getTimer()->getMilliseconds();
-				mEntity->getSubEntity(i)->setCustomParameter(3, Ogre::Vector4(time, 0.0, 0.0, 0.0));
-			}
+				// What the vertex program needs to unpack the vertices,
+				// see OPPackedVertex.hlsl
+				Ogre::Vector3 origin;
+				Ogre::Vector3 stepX;
+				Ogre::Vector3 stepY;
+				CubeSphere::getGridFrame(mMin, mMax, mQuads, origin, stepX, stepY);
 
-			//for (unsigned int i = 0; i < mEntity->getNumSubEntities(); i++)
-			//{
-			//	Ogre::GpuProgramPtr fragProg = mEntity->getSubEntity(i)->
-			//		getMaterial()->
-			//		getBestTechnique()->
-			//		getPass(0)->
-			//		getFragmentProgram();
-			//	
-			//	fragProg->setParameter("baseRadius", boost::lexical_cast<Ogre::String, Ogre::Real>(mBaseRadius));
-			//	fragProg->setParameter("scalingFactor", boost::lexical_cast<Ogre::String, Ogre::Real>(mScalingFactor));
-			//}
-		}
+				mRenderable->setConstant(8, Ogre::Vector4(mTexXMin, mTexYMin, mTexXMax - mTexXMin, mTexYMax - mTexYMin));
+				mRenderable->setConstant(9, Ogre::Vector4((Ogre::Real) mQuads, 0.0, 0.0, 0.0));
 
-		mPatchCenter = mPatchMeshLoader->getCenter();
+				if (mPatchMeshLoader->isPacked())
+				{
+					mRenderable->setConstant(7, mPatchMeshLoader->getPositionScale());
+				}
+				else
+				{
+					mRenderable->setConstant(10, Ogre::Vector4(origin.x, origin.y, origin.z, (Ogre::Real) CubeSphere::getMapping()));
+					mRenderable->setConstant(11, Ogre::Vector4(stepX.x, stepX.y, stepX.z, 0.0));
+					mRenderable->setConstant(12, Ogre::Vector4(stepY.x, stepY.y, stepY.z, 0.0));
+					mRenderable->setConstant(13, mPatchMeshLoader->getRadiusScale());
+					mRenderable->setConstant(14, Ogre::Vector4(mPatchCenter.x, mPatchCenter.y, mPatchCenter.z, 0.0));
+				}
+			}
 
-		//if (mParent != 0)
-		//{
-		//	mNode = mParentNode->createChildSceneNode(mPatchCenter - mParent->mPatchCenter);
-		//}
-		//else
-		//{
-		//	mNode = mParentNode->createChildSceneNode(mPatchCenter);
-		//}
-		if (!mNode)
-		{
-			mNode = mParentSceneNode->createChildSceneNode(mPatchCenter);
+			// The stitching constants start out cleared
+			if (!mPatchMeshLoader->hasSkirts())
+			{
+				markStitchingDirty();
+			}
 		}
-		
-		if (!mEntity->isAttached())
+
+		// Patches with skirts don't need to know their neighbours
+		if (!mPatchMeshLoader->hasSkirts())
 		{
-			mNode->attachObject(mEntity);
+			registerPatch();
 		}
-		//mPatchNormal = mAABB.getCenter().normalisedCopy();
-		//mPatchCenter = mBaseRadius * mPatchNormal;
-		patchNameSet.insert(mName);
-		mGeometryUpdated = true;
 	}
 
 	void Patch::hide()
 	{
-		if (mEntity != 0)
+		if (mRenderable->isShown())
 		{
-			mNode->detachObject(mEntity);
-			mMgr->destroyEntity(mEntity);
-			mEntity = 0;
-
-			mMgr->destroySceneNode(mNode);
-			mNode = 0;
+			mPlanetRenderable->hidePatch(mRenderable);
 		}
-
-		mGeometryUpdated = true;
 	}
 
 	std::list<Ogre::String> Patch::getNeighbourNameList()
@@ -678,15 +1028,7 @@ namespace OgrePlanet
 	void Patch::setMaterialName(const Ogre::String & materialName)
 	{
 		mMaterialName = materialName;
-
-		if (mEntity)
-		{
-			for (unsigned int i = 0; i < mEntity->getNumSubEntities(); i++)
-			{
-				mEntity->getSubEntity(i)->setMaterialName(materialName);
-				mEntity->getSubEntity(i)->setMaterialName(materialName + "DepthPass");
-			}
-		}
+		mRenderable->setMaterialName(materialName);
 
 		for (int i = 0; i < 4; i++)
 		{
@@ -704,12 +1046,9 @@ namespace OgrePlanet
 
 	void Patch::setTextureSize(size_t size)
 	{
-		if (mEntity)
+		if (mRenderable->isShown())
 		{
-			for (unsigned int i = 0; i < mEntity->getNumSubEntities(); i++)
-			{
-				mEntity->getSubEntity(i)->setCustomParameter(1, Ogre::Vector4((float)size, 0.0, 0.0, 0.0));
-			}
+			mRenderable->setConstant(1, Ogre::Vector4((float)size, 0.0, 0.0, 0.0));
 		}
 
 		for (int i = 0; i < 4; i++)
@@ -721,9 +1060,9 @@ namespace OgrePlanet
 		}
 	}
 
-	boost::shared_array<Ogre::Real> Patch::getHeightData()
+	const QuantizedHeights * Patch::getHeightData()
 	{
-		return mHeightData;
+		return mPatchMeshLoader->getData();
 	}
 
 	Ogre::String Patch::rotateCW(Ogre::String patchName)
@@ -771,159 +1110,147 @@ namespace OgrePlanet
 		return patchName;
 	}
 
-	void Patch::updateStitching()
+	void Patch::registerPatch()
 	{
-		if (mEntity)
+		if (mRegistered)
 		{
-			int index = 0;
-			Ogre::Vector4 stitch = Ogre::Vector4::ZERO;
-
-			if (mParent) {
-				if (patchNameSet.find(leftNeighbour) == patchNameSet.end()) {
-					index |= STITCHING_W;
-					stitch.x = 1.0;
-				}
-				if (patchNameSet.find(rightNeighbour) == patchNameSet.end()) {
-					index |= STITCHING_E;
-					stitch.y = 1.0;
-				}
-				if (patchNameSet.find(upNeighbour) == patchNameSet.end()) {
-					index |= STITCHING_N;
-					stitch.z = 1.0;
-				}
-				if (patchNameSet.find(downNeighbour) == patchNameSet.end()) {
-					index |= STITCHING_S;
-					stitch.w = 1.0;
-				}
-			}
-
-			mMesh->getSubMesh(0)->indexData->indexCount = PatchMeshLoader::indexBuffer[index]->getNumIndexes();
-			mMesh->getSubMesh(0)->indexData->indexBuffer = PatchMeshLoader::indexBuffer[index];
-
-			for (unsigned int i = 0; i < mEntity->getNumSubEntities(); i++)
-			{
-				Ogre::Real time = (Ogre::Real)Ogre::Root::getSingleton().getTimer()->getMilliseconds();
-
-				mEntity->getSubEntity(i)->setCustomParameter(4, Ogre::Vector4(time, 0.0, 0.0, 0.0));
-				mEntity->getSubEntity(i)->setCustomParameter(5, stitch);
-			}
+			return;
 		}
 
-		for (int i = 0; i < 4; i++) {
-			if (mSubPatch[i]) {
-				mSubPatch[i]->updateStitching();
-			}
-		}
+		patchRegistry[mName] = this;
+		mRegistered = true;
+
+		markNeighboursDirty();
+		markStitchingDirty();
 	}
 
-	bool Patch::isVisible(Ogre::Camera * cam) {
-		for (int i = 0; i < 4; i++) {
-			if (mSubPatch[i] && mSubPatch[i]->isVisible(cam)) {
-				return true;
-			}
+	void Patch::unregisterPatch()
+	{
+		if (!mRegistered)
+		{
+			return;
 		}
 
-		if (mEntity && mEntity->isAttached() && cam->isVisible(mEntity->getBoundingBox())) {
-			return true;
-		}
+		patchRegistry.erase(mName);
+		mRegistered = false;
 
-		return false;
+		markNeighboursDirty();
 	}
 
-	//void Patch::notifyPreRender(Ogre::Camera * cam) {
-	void Patch::notifyPreRender() {
-		for (int i = 0; i < 4; i++) {
-			if (mSubPatch[i]) {
-				mSubPatch[i]->notifyPreRender();
+	void Patch::markNeighboursDirty()
+	{
+		// Patches bordering this one are the same size neighbours and
+		// those of their descendants that lie along the shared edge
+		for (int side = 0; side < 4; side++) {
+			std::map<Ogre::String, Patch *>::iterator neighbour = patchRegistry.find(mNeighbourName[side]);
+			if (neighbour != patchRegistry.end()) {
+				neighbour->second->markBorderingDirty(mName);
 			}
 		}
+	}
 
-		Ogre::Real baseRadius = 6371.0; // Hack, because otherwise atmosphere isn't culled correctly
-											// (It has another baseRadius...)
-
-		// Do horizon culling
-		Ogre::Vector3 planetPosition = getPlanetPositionWorldSpace();
-		Ogre::Vector3 planetDirection = planetPosition.normalisedCopy();
-		Ogre::Vector3 patchPosition = planetPosition + (getPlanetOrientationWorldSpace() * mPatchCenter);
-		Ogre::Vector3 patchDirection = patchPosition.normalisedCopy();
-		Ogre::Real patchRadius = mAABB.getHalfSize().length();
-
-		Ogre::Real cosAngleToPlanetHorizon = Ogre::Math::Sqrt(planetPosition.squaredLength() - baseRadius*baseRadius) / planetPosition.length();
-		Ogre::Radian angleToPlanetHorizon = Ogre::Math::ACos(cosAngleToPlanetHorizon);
-
-		Ogre::Real cosAngleToPatchHorizon = Ogre::Math::Sqrt(patchPosition.squaredLength() - patchRadius*patchRadius) / patchPosition.length();
-		Ogre::Radian angleToPatchHorizon = Ogre::Math::ACos(cosAngleToPatchHorizon);
-
-		Ogre::Real distanceToPlanetHorizon = Ogre::Math::Sqrt(planetPosition.squaredLength() - baseRadius*baseRadius);
-		Ogre::Radian angleBetweenPlanetAndPatch = Ogre::Math::ACos(planetDirection.dotProduct(patchDirection));
+	void Patch::markBorderingDirty(const Ogre::String & patchName)
+	{
+		for (int side = 0; side < 4; side++) {
+			if (mNeighbourName[side].compare(0, patchName.length(), patchName) == 0) {
+				// Patches that haven't been shown yet are stitched when
+				// they register
+				if (mRegistered) {
+					markStitchingDirty();
+				}
 
-		bool isBehindHorizonPlane = ((patchPosition.dotProduct(planetDirection) - patchRadius) > (distanceToPlanetHorizon * cosAngleToPlanetHorizon));
-		//bool isBehindHorizonPlane = true;
-		bool isInHorizonCone = ((angleBetweenPlanetAndPatch + angleToPatchHorizon) < angleToPlanetHorizon);
-		//bool isInHorizonCone = true;
+				// Only children of a bordering patch can border it
+				for (int i = 0; i < 4; i++) {
+					if (mSubPatch[i]) {
+						mSubPatch[i]->markBorderingDirty(patchName);
+					}
+				}
 
-		if (mNode && mEntity && mEntity->isAttached() && isBehindHorizonPlane && isInHorizonCone)
-		{
-			mNode->detachObject(mEntity);
+				return;
+			}
 		}
-		else if (mNode && mEntity && !mEntity->isAttached() && !(isBehindHorizonPlane && isInHorizonCone))
+	}
+
+	void Patch::markStitchingDirty()
+	{
+		if (!mStitchingDirty)
 		{
-			mNode->attachObject(mEntity);
+			mStitchingDirty = true;
+			dirtyPatches.push_back(this);
 		}
+	}
 
-		if (mEntity && mEntity->isAttached())
+	int Patch::getStitchLevel(int side)
+	{
+		if (!mParent)
 		{
-			for (int i = 0; i < mEntity->getNumSubEntities(); i++)
-			{
-				mEntity->getSubEntity(i)->setCustomParameter(6, Ogre::Vector4(mPatchCenter.x, mPatchCenter.y, mPatchCenter.z, 0.0));
-			}
+			return 0;
 		}
-	}
 
-	void Patch::notifyPostRender() {
-		for (int i = 0; i < 4; i++) {
-			if (mSubPatch[i]) {
-				mSubPatch[i]->notifyPostRender();
-			}
+		// The closest registered ancestor of the same size neighbour is
+		// what is shown next to us
+		Ogre::String name = mNeighbourName[side];
+		int level = 0;
+
+		while (level < mDepth && patchRegistry.find(name) == patchRegistry.end()) {
+			name.erase(name.length() - 1);
+			level++;
 		}
 
-		mGeometryUpdated = false;
+		// In vertex spacing, the neighbour may have a different number
+		// of quads
+		return mResolution->getLevelDifference(mDepth, mDepth - level);
 	}
 
-	const Ogre::Vector3 Patch::getPlanetPositionWorldSpace()
+	void Patch::setLodDistances(Ogre::Real split, Ogre::Real merge)
 	{
-		//if (mParent)
-		//{
-		//	return mParent->getPlanetPositionWorldSpace();
-		//}
-		//else
-		//{
-		//	return mParentNode->_getDerivedPosition();
-		//}
+		assert(split > 0.0 && merge >= split);
+		msSplitDistance = split;
+		msMergeDistance = merge;
+	}
 
-		return mParentSceneNode->_getDerivedPosition();
+	void Patch::setMinShownTime(unsigned long milliseconds)
+	{
+		msMinShownTime = milliseconds;
 	}
 
-	const Ogre::Quaternion Patch::getPlanetOrientationWorldSpace()
+	void Patch::updateDirtyStitching()
 	{
-		//if (mParent)
-		//{
-		//	return mParent->getPlanetOrientationWorldSpace();
-		//}
-		//else
-		//{
-		//	return mParentNode->_getDerivedOrientation();
-		//}
+		for (std::vector<Patch *>::iterator i = dirtyPatches.begin(); i != dirtyPatches.end(); ++i)
+		{
+			(*i)->mStitchingDirty = false;
+			(*i)->updateStitching();
+		}
 
-		return mParentSceneNode->_getDerivedOrientation();
+		dirtyPatches.clear();
 	}
 
-	bool Patch::geometryUpdated()
+	void Patch::updateStitching()
 	{
-		return ((mSubPatch[0] && mSubPatch[0]->geometryUpdated()) ||
-			(mSubPatch[1] && mSubPatch[1]->geometryUpdated()) ||
-			(mSubPatch[2] && mSubPatch[2]->geometryUpdated()) ||
-			(mSubPatch[3] && mSubPatch[3]->geometryUpdated()) ||
-			mGeometryUpdated);
+		if (mRenderable->isShown())
+		{
+			// A neighbour that coarsened after we were split can be more
+			// levels away than the index buffers handle
+			int levels[4];
+			for (int side = 0; side < 4; side++) {
+				levels[side] = std::min(getStitchLevel(side), (int) StitchingIndices::MAX_LEVEL);
+			}
+
+			// The vertex programs only check for > 0.5
+			Ogre::Vector4 stitch(
+				(Ogre::Real) levels[STITCHING_SIDE_W],
+				(Ogre::Real) levels[STITCHING_SIDE_E],
+				(Ogre::Real) levels[STITCHING_SIDE_N],
+				(Ogre::Real) levels[STITCHING_SIDE_S]);
+
+			Ogre::HardwareIndexBufferSharedPtr indexBuffer = PatchMeshLoader::getIndexBuffer(mQuads, levels);
+			mMesh->getSubMesh(0)->indexData->indexCount = indexBuffer->getNumIndexes();
+			mMesh->getSubMesh(0)->indexData->indexBuffer = indexBuffer;
+
+			Ogre::Real time = (Ogre::Real)Ogre::Root::getSingleton().getTimer()->getMilliseconds();
+
+			mRenderable->setConstant(4, Ogre::Vector4(time, 0.0, 0.0, 0.0));
+			mRenderable->setConstant(5, stitch);
+		}
 	}
 }
\ No newline at end of file
@@ -24,7 +24,11 @@ THE SOFTWARE.
 #define PATCH_H
 
 #include "OPDataSource.h"
+#include "OPPatchBudget.h"
 #include "OPPatchMeshLoader.h"
+#include "OPPatchResolution.h"
+#include "OPPlanetRenderable.h"
+#include "OPStitching.h"
 
 #include <Ogre.h>
 #include <boost/shared_array.hpp>
@@ -38,8 +42,7 @@ namespace OgrePlanet
 		Patch(
 			const Ogre::String & name,
 			const Ogre::String & materialName,
-			Ogre::SceneManager * mgr,
-			Ogre::SceneNode * parentNode,
+			PlanetRenderable * planetRenderable,
 			const Ogre::Vector3 & min,
 			const Ogre::Vector3 & max,
 			Ogre::Real texXMin,
@@ -49,7 +52,7 @@ namespace OgrePlanet
 			const Ogre::Real baseRadius,
 			const Ogre::Real scalingFactor,
 			DataSource * dataSource,
-			int quads,
+			const PatchResolution & resolution,
 			Ogre::RenderQueueGroupID renderQueue,
 			bool prepareInBackground = true,
 			int depth = 0,
@@ -60,7 +63,48 @@ namespace OgrePlanet
 
 		~Patch();
 
-		void setCameraPosition(const Ogre::Vector3 & position);
+		// Patches are allocated from a free list, so the memory of
+		// merged patches is reused by the next split. Only create and
+		// delete them on the main thread.
+		static void * operator new(size_t size);
+		static void operator delete(void * p);
+		// Frees the memory of deleted patches
+		static void freePool();
+
+		// Splits and merges this patch and its descendants, and the
+		// patches attached to them. Only call it on patches that aren't
+		// attached to another. now is the time in milliseconds, read
+		// once per traversal.
+		void setCameraPosition(const Ogre::Vector3 & position, unsigned long now);
+		// Makes another layer (the ocean or the sky) covering the same
+		// part of the cube follow this patch. It splits when this patch
+		// splits, as long as it is above its own max depth, and merges
+		// with it. The patch is not owned.
+		void attach(Patch * patch);
+		// Hides this patch and keeps it from splitting while all of it
+		// is more than margin below seaLevel (a radius) and the camera
+		// is above seaLevel, e.g. terrain under the ocean. Also applies
+		// to the patch's descendants. A seaLevel of 0 turns it off.
+		void setSeaLevel(Ogre::Real seaLevel, Ogre::Real margin);
+		// Where setCameraPosition() adds up the usage of this patch, its
+		// descendants and the patches attached to them. Patches that are
+		// off screen don't split while the budget is nearly used up.
+		void setBudget(PatchBudget * budget);
+		// What this patch and the patches attached to it use
+		PatchBudget::Usage getUsage();
+		// What the children and the patches attached to them use
+		PatchBudget::Usage getChildrenUsage();
+		// Adds the patches in this subtree that could merge their
+		// children (which are all leaves) and have been off screen since
+		// the last frame
+		void collectMergeCandidates(std::vector<Patch *> & candidates);
+		// Merges the children as soon as possible, however close the
+		// camera is
+		void coarsen() { mCoarsen = true; }
+		bool isCoarsening() { return mCoarsen; }
+		// Last frame anything in this subtree, or attached to it, was
+		// queued for rendering
+		unsigned long getLastVisibleFrame() { return mLastVisibleFrame; }
 		void setMaterialName(const Ogre::String & materialName);
 		Ogre::String & getMaterialName();
 		void setTextureSize(size_t size);
@@ -76,24 +120,51 @@ namespace OgrePlanet
 		Ogre::String rotateCW(Ogre::String patchName);
 		Ogre::String rotateCCW(Ogre::String patchName);
 		Ogre::String rotate180(Ogre::String patchName);
-		void updateStitching();
-		bool isVisible(Ogre::Camera * cam);
-		void notifyPreRender();
-		void notifyPostRender();
-		bool geometryUpdated();
+		// Recomputes the stitching of patches whose neighbours have
+		// come or gone since the last call
+		static void updateDirtyStitching();
+		// A patch splits when the camera is closer than split times its
+		// size, and merges again when it is farther than merge times its
+		// size. In between it stays as it is.
+		static void setLodDistances(Ogre::Real split, Ogre::Real merge);
+		// How long children have to have been shown before their parent
+		// may merge them again
+		static void setMinShownTime(unsigned long milliseconds);
 
 	private:
-		static std::set<Ogre::String> patchNameSet;
+		// Patches that have been shown, by name
+		static std::map<Ogre::String, Patch *> patchRegistry;
+		static std::vector<Patch *> dirtyPatches;
+		// Memory of deleted patches, see operator new
+		static std::vector<void *> msFreePatches;
+		static Ogre::Real msSplitDistance;
+		static Ogre::Real msMergeDistance;
+		static unsigned long msMinShownTime;
+
+		void registerPatch();
+		void unregisterPatch();
+		void markNeighboursDirty();
+		void markBorderingDirty(const Ogre::String & patchName);
+		void markStitchingDirty();
+		int getStitchLevel(int side);
+		void updateStitching();
 
 		boost::shared_array<Ogre::Vector3> buildHeightMap();
+		bool canSplit();
+		bool isSubmerged(const Ogre::Vector3 & position);
+		bool isOnScreen();
+		bool areChildrenPrepared();
+		bool canStitchChildren();
+		bool canMergeChildren(unsigned long now);
+		void createChildren();
+		void showChildren();
+		void destroyChild(int child);
 		void show();
 		void hide();
 		bool destroyChildren();
-		boost::shared_array<Ogre::Real> getHeightData();
-		const Ogre::Vector3 getPlanetPositionWorldSpace();
-		const Ogre::Quaternion Patch::getPlanetOrientationWorldSpace();
+		const QuantizedHeights * getHeightData();
 
-		Ogre::Entity * mEntity;
+		PatchRenderable * mRenderable;
 		Ogre::MeshPtr mMesh;
 		Ogre::AxisAlignedBox mAABB;
 		Patch * mSubPatch[4];
@@ -102,12 +173,12 @@ namespace OgrePlanet
 
 		Ogre::String mName;
 		Ogre::String mMaterialName;
-		Ogre::SceneManager * mMgr;
-		Ogre::SceneNode * mNode;
+		PlanetRenderable * mPlanetRenderable;
 		Ogre::Vector3 mMin;
 		Ogre::Vector3 mMax;
 		Ogre::Real mBaseRadius;
 		Ogre::Real mScalingFactor;
+		const PatchResolution * mResolution;
 		int mQuads;
 		Ogre::RenderQueueGroupID mRenderQueue;
 		Ogre::BackgroundProcessTicket mTicket;
@@ -119,18 +190,25 @@ namespace OgrePlanet
 		Ogre::Real mTexYMin;
 		Ogre::Real mTexYMax;
 		Ogre::Vector3 mPatchCenter;
+		// See setSeaLevel()
+		Ogre::Real mSeaLevel;
+		Ogre::Real mSubmergedMargin;
+		// See setBudget()
+		PatchBudget * mBudget;
+		unsigned long mLastVisibleFrame;
+		bool mCoarsen;
 
 		Patch * mParent;
-		boost::shared_array<Ogre::Real> mHeightData;
-
-		Ogre::String leftNeighbour;
-		Ogre::String rightNeighbour;
-		Ogre::String upNeighbour;
-		Ogre::String downNeighbour;
+		// Layers in the same place, see attach()
+		std::vector<Patch *> mAttached;
 
-		Ogre::SceneNode * mParentSceneNode;
+		// Same size neighbours, by StitchingSide
+		Ogre::String mNeighbourName[4];
+		bool mRegistered;
+		bool mStitchingDirty;
 
-		bool mGeometryUpdated;
+		// When show() last showed the patch
+		unsigned long mShownTime;
 	};
 }
 
@@ -0,0 +1,86 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPPatchBudget.h"
+
+#include <algorithm>
+
+namespace OgrePlanet
+{
+	const Ogre::Real PatchBudget::LOW_WATER_MARK = 0.9;
+
+	PatchBudget::Usage & PatchBudget::Usage::operator+=(const Usage & other)
+	{
+		cpuBytes += other.cpuBytes;
+		gpuBytes += other.gpuBytes;
+		patches += other.patches;
+		return *this;
+	}
+
+	PatchBudget::Usage & PatchBudget::Usage::operator-=(const Usage & other)
+	{
+		cpuBytes -= std::min(cpuBytes, other.cpuBytes);
+		gpuBytes -= std::min(gpuBytes, other.gpuBytes);
+		patches -= std::min(patches, other.patches);
+		return *this;
+	}
+
+	PatchBudget::PatchBudget()
+	{
+	}
+
+	void PatchBudget::setLimits(size_t cpuBytes, size_t gpuBytes, size_t patches)
+	{
+		mLimits.cpuBytes = cpuBytes;
+		mLimits.gpuBytes = gpuBytes;
+		mLimits.patches = patches;
+	}
+
+	Ogre::Real PatchBudget::getLoad(const Usage & usage) const
+	{
+		Ogre::Real load = 0.0;
+
+		if (mLimits.cpuBytes)
+		{
+			load = std::max(load, (Ogre::Real) usage.cpuBytes / mLimits.cpuBytes);
+		}
+
+		if (mLimits.gpuBytes)
+		{
+			load = std::max(load, (Ogre::Real) usage.gpuBytes / mLimits.gpuBytes);
+		}
+
+		if (mLimits.patches)
+		{
+			load = std::max(load, (Ogre::Real) usage.patches / mLimits.patches);
+		}
+
+		return load;
+	}
+
+	Ogre::String PatchBudget::toString(const Usage & usage)
+	{
+		return Ogre::StringConverter::toString(usage.patches) + " patches, " +
+			Ogre::StringConverter::toString(usage.cpuBytes / 1024) + " KB CPU, " +
+			Ogre::StringConverter::toString(usage.gpuBytes / 1024) + " KB GPU";
+	}
+}
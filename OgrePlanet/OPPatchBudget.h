@@ -0,0 +1,91 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef PATCHBUDGET_H
+#define PATCHBUDGET_H
+
+#include <Ogre.h>
+
+namespace OgrePlanet
+{
+	// Limits on what the patches of a planet may use. The patches add
+	// up their usage as they are traversed (see
+	// Patch::setCameraPosition()), and while it is over a limit the
+	// planet merges the subtrees that have been off screen the longest.
+	class PatchBudget
+	{
+	public:
+		struct Usage
+		{
+			Usage() : cpuBytes(0), gpuBytes(0), patches(0) {}
+
+			Usage & operator+=(const Usage & other);
+			// Never goes below zero
+			Usage & operator-=(const Usage & other);
+
+			// Height and vertex data
+			size_t cpuBytes;
+			// Vertex buffer slots of a patch. For the planet, the vertex
+			// buffers allocated, see setGpuBytes().
+			size_t gpuBytes;
+			size_t patches;
+		};
+
+		// Coarsening stops once the usage is below this part of every
+		// limit, and above it patches that are off screen don't split
+		static const Ogre::Real LOW_WATER_MARK;
+
+		// Without limits
+		PatchBudget();
+
+		// 0 means no limit
+		void setLimits(size_t cpuBytes, size_t gpuBytes, size_t patches);
+		const Usage & getLimits() const { return mLimits; }
+
+		// Adds up the usage of one traversal of the patches
+		void beginTraversal() { mTraversalUsage = Usage(); }
+		void add(const Usage & usage) { mTraversalUsage += usage; }
+		void endTraversal() { mUsage = mTraversalUsage; }
+		// Replaces the GPU usage of the last traversal with what is
+		// actually allocated. The pools free a buffer only when all of
+		// its slots are free, so that can be more than the patches use.
+		void setGpuBytes(size_t gpuBytes) { mUsage.gpuBytes = gpuBytes; }
+		// What the patches used in the last traversal
+		const Usage & getUsage() const { return mUsage; }
+
+		// The largest ratio of usage to limit, 0 without limits
+		Ogre::Real getLoad(const Usage & usage) const;
+		Ogre::Real getLoad() const { return getLoad(mUsage); }
+		bool isOverBudget() const { return getLoad() > 1.0; }
+		bool isOverGpuLimit() const { return mLimits.gpuBytes && mUsage.gpuBytes > mLimits.gpuBytes; }
+
+		// For the log, e.g. "812 patches, 10240 KB CPU, 4096 KB GPU"
+		static Ogre::String toString(const Usage & usage);
+
+	private:
+		Usage mLimits;
+		Usage mUsage;
+		Usage mTraversalUsage;
+	};
+}
+
+#endif // PATCHBUDGET_H
@@ -0,0 +1,365 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPPatchMeshKernel.h"
+#include "OPStitching.h"
+
+#include <cmath>
+#include <limits>
+
+namespace OgrePlanet
+{
+	namespace
+	{
+		const float SHORT_RANGE = 32767.0f;
+
+		Ogre::int16 quantise(float value, float invScale)
+		{
+			float q = std::floor(value * invScale + 0.5f);
+			return (Ogre::int16) std::max(-SHORT_RANGE, std::min(SHORT_RANGE, q));
+		}
+
+		// Octahedral encoding of a unit vector, two components in [-1, 1]
+		void octEncode(const float * n, Ogre::int16 * out)
+		{
+			float l1 = std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]);
+			float x = n[0] / l1;
+			float y = n[1] / l1;
+
+			if (n[2] < 0.0f)
+			{
+				float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+				float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+				x = fx;
+				y = fy;
+			}
+
+			out[0] = quantise(x, SHORT_RANGE);
+			out[1] = quantise(y, SHORT_RANGE);
+		}
+	}
+
+#if OGREPLANET_HAVE_SSE
+	DisplaceGridKernel PatchMeshKernel::displaceGrid = &OgrePlanet::displaceGrid<SimdSSE>;
+	BuildVerticesKernel PatchMeshKernel::buildVertices = &OgrePlanet::buildVertices<SimdSSE>;
+#else
+	DisplaceGridKernel PatchMeshKernel::displaceGrid = &OgrePlanet::displaceGrid<SimdScalar>;
+	BuildVerticesKernel PatchMeshKernel::buildVertices = &OgrePlanet::buildVertices<SimdScalar>;
+#endif
+
+	void PatchMeshKernel::bindKernels(CpuIsa isa)
+	{
+		switch (isa)
+		{
+#if OGREPLANET_HAVE_AVX2
+		case CPU_ISA_AVX2:
+		case CPU_ISA_AVX512:
+			displaceGrid = &displaceGridAVX2;
+			buildVertices = &buildVerticesAVX2;
+			break;
+#endif
+#if OGREPLANET_HAVE_SSE
+		case CPU_ISA_SSE2:
+			displaceGrid = &OgrePlanet::displaceGrid<SimdSSE>;
+			buildVertices = &OgrePlanet::buildVertices<SimdSSE>;
+			break;
+#endif
+		default:
+			displaceGrid = &OgrePlanet::displaceGrid<SimdScalar>;
+			buildVertices = &OgrePlanet::buildVertices<SimdScalar>;
+			break;
+		}
+	}
+
+	int PatchMeshKernel::getPadding(int morphStep)
+	{
+		// One vertex of padding for the normals, one parent vertex for the
+		// parent level normals
+		return std::max(2, morphStep);
+	}
+
+	void PatchMeshKernel::buildConstantVertices(const float * px, const float * py, const float * pz,
+		const float * xs, const float * ys, const float * zs,
+		int quads,
+		int padding,
+		int morphStep,
+		const float * center,
+		float texXMin,
+		float texXMax,
+		float texYMin,
+		float texYMax,
+		float * vertices)
+	{
+		const int side = quads + 2*padding + 1;
+		const float * p[3] = { px, py, pz };
+		const float * n[3] = { xs, ys, zs };
+
+		float * out = vertices;
+
+		for (int y = 0; y <= quads; y++)
+		{
+			const int row = side * (y + padding) + padding;
+
+			const float jy = ((float) y)/quads;
+			const float texY = (1 - jy) * texYMin + jy * texYMax;
+			const float edgeY = (y == 0 ? 0.0f : (y == quads ? 1.0f : 0.5f));
+
+			for (int x = 0; x <= quads; x++)
+			{
+				const int i = row + x;
+				const float jx = ((float) x)/quads;
+
+				// Geomorph target, on the parent triangle the vertex lies
+				// in, see getMorphTarget()
+				int dx[3];
+				int dy[3];
+				float weight[3];
+				const int corners = getMorphTarget(x, y, morphStep, dx, dy, weight);
+
+				float morph[3] = { 0.0f, 0.0f, 0.0f };
+				for (int k = 0; k < corners; k++)
+				{
+					for (int c = 0; c < 3; c++)
+					{
+						morph[c] += weight[k] * p[c][i + side * dy[k] + dx[k]];
+					}
+				}
+				float r = 1.0f / std::sqrt(morph[0]*morph[0] + morph[1]*morph[1] + morph[2]*morph[2]);
+
+				*out++ = p[0][i] - center[0];
+				*out++ = p[1][i] - center[1];
+				*out++ = p[2][i] - center[2];
+
+				*out++ = n[0][i];
+				*out++ = n[1][i];
+				*out++ = n[2][i];
+
+				*out++ = (1 - jx) * texXMin + jx * texXMax;
+				*out++ = texY;
+				*out++ = (x == 0 ? 0.0f : (x == quads ? 1.0f : 0.5f));
+				*out++ = edgeY;
+
+				*out++ = morph[0] - center[0];
+				*out++ = morph[1] - center[1];
+				*out++ = morph[2] - center[2];
+
+				*out++ = morph[0] * r;
+				*out++ = morph[1] * r;
+				*out++ = morph[2] * r;
+			}
+		}
+	}
+
+	float PatchMeshKernel::buildSkirts(int quads,
+		const float * center,
+		float margin,
+		float * vertices)
+	{
+		const int gridVertices = (quads + 1) * (quads + 1);
+		const int count = gridVertices + SkirtIndices::getVertexCount(quads);
+
+		// A coarser neighbour's edge interpolates between vertices on
+		// our edge, so it stays within the radius range of the edge
+		float minRadius = std::numeric_limits<float>::max();
+		float maxRadius = -std::numeric_limits<float>::max();
+		for (int i = gridVertices; i < count; i++)
+		{
+			int x, y;
+			SkirtIndices::getGridPosition(quads, i, x, y);
+			const float * v = vertices + FLOATS_PER_VERTEX * ((quads + 1) * y + x);
+			float r = std::sqrt((v[0] + center[0]) * (v[0] + center[0]) +
+				(v[1] + center[1]) * (v[1] + center[1]) +
+				(v[2] + center[2]) * (v[2] + center[2]));
+			minRadius = std::min(minRadius, r);
+			maxRadius = std::max(maxRadius, r);
+		}
+
+		// Length of the first edge, vertices 0 and quads
+		const float * first = vertices;
+		const float * last = vertices + FLOATS_PER_VERTEX * quads;
+		float size = std::sqrt((last[0] - first[0]) * (last[0] - first[0]) +
+			(last[1] - first[1]) * (last[1] - first[1]) +
+			(last[2] - first[2]) * (last[2] - first[2]));
+
+		const float depth = (maxRadius - minRadius) + margin * size;
+
+		for (int i = gridVertices; i < count; i++)
+		{
+			int x, y;
+			SkirtIndices::getGridPosition(quads, i, x, y);
+			const float * edge = vertices + FLOATS_PER_VERTEX * ((quads + 1) * y + x);
+			float * v = vertices + FLOATS_PER_VERTEX * i;
+			std::copy(edge, edge + FLOATS_PER_VERTEX, v);
+
+			// Straight down, towards the planet centre
+			float up[3] = { v[0] + center[0], v[1] + center[1], v[2] + center[2] };
+			float invLength = 1.0f / std::sqrt(up[0] * up[0] + up[1] * up[1] + up[2] * up[2]);
+			for (int c = 0; c < 3; c++)
+			{
+				v[c] -= up[c] * invLength * depth;
+				v[10 + c] -= up[c] * invLength * depth;
+			}
+		}
+
+		return depth;
+	}
+
+	void PatchMeshKernel::packVertices(const float * vertices,
+		int quads,
+		bool skirts,
+		float * positionScale,
+		Ogre::int16 * packed)
+	{
+		const int count = (quads + 1) * (quads + 1) + (skirts ? SkirtIndices::getVertexCount(quads) : 0);
+
+		// Largest magnitude of each position component and of the
+		// geomorph delta
+		float maxPosition[3] = { 0.0f, 0.0f, 0.0f };
+		float maxDelta = 0.0f;
+		for (int i = 0; i < count; i++)
+		{
+			const float * v = vertices + FLOATS_PER_VERTEX * i;
+			for (int c = 0; c < 3; c++)
+			{
+				maxPosition[c] = std::max(maxPosition[c], std::fabs(v[c]));
+				maxDelta = std::max(maxDelta, std::fabs(v[10 + c] - v[c]));
+			}
+		}
+
+		float invScale[4];
+		for (int c = 0; c < 4; c++)
+		{
+			float range = (c < 3 ? maxPosition[c] : maxDelta);
+			positionScale[c] = range / SHORT_RANGE;
+			invScale[c] = (range > 0.0f ? SHORT_RANGE / range : 0.0f);
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			const float * v = vertices + FLOATS_PER_VERTEX * i;
+			int x, y;
+			SkirtIndices::getGridPosition(quads, i, x, y);
+
+			*packed++ = quantise(v[0], invScale[0]);
+			*packed++ = quantise(v[1], invScale[1]);
+			*packed++ = quantise(v[2], invScale[2]);
+			*packed++ = (Ogre::int16) x;
+
+			octEncode(v + 3, packed);
+			octEncode(v + 13, packed + 2);
+			packed += 4;
+
+			*packed++ = quantise(v[10] - v[0], invScale[3]);
+			*packed++ = quantise(v[11] - v[1], invScale[3]);
+			*packed++ = quantise(v[12] - v[2], invScale[3]);
+			*packed++ = (Ogre::int16) y;
+		}
+	}
+
+	void PatchMeshKernel::packHeights(const float * vertices,
+		const Ogre::uint16 * heights,
+		float heightOffset,
+		float heightScale,
+		int quads,
+		int padding,
+		int morphStep,
+		bool skirts,
+		float skirtDepth,
+		float baseRadius,
+		float scalingFactor,
+		float * radiusScale,
+		Ogre::int16 * packed)
+	{
+		const int side = quads + 2*padding + 1;
+		const int gridVertices = (quads + 1) * (quads + 1);
+		const int count = gridVertices + (skirts ? SkirtIndices::getVertexCount(quads) : 0);
+
+		float minRadius = std::numeric_limits<float>::max();
+		float maxRadius = -std::numeric_limits<float>::max();
+		float maxDelta = 0.0f;
+		for (int pass = 0; pass < 2; pass++)
+		{
+			float invScale[2];
+			if (pass == 1)
+			{
+				// Quantise around the middle of the radius range
+				float range = 0.5f * (maxRadius - minRadius);
+				float deltaRange = maxDelta;
+				radiusScale[0] = 0.5f * (minRadius + maxRadius);
+				radiusScale[1] = range / SHORT_RANGE;
+				radiusScale[2] = deltaRange / SHORT_RANGE;
+				invScale[0] = (range > 0.0f ? SHORT_RANGE / range : 0.0f);
+				invScale[1] = (deltaRange > 0.0f ? SHORT_RANGE / deltaRange : 0.0f);
+			}
+
+			for (int i = 0; i < count; i++)
+			{
+				int x, y;
+				SkirtIndices::getGridPosition(quads, i, x, y);
+				const Ogre::uint16 * h = heights + side * (y + padding) + padding + x;
+
+				// Geomorph target, on the parent triangle the vertex lies
+				// in, see getMorphTarget(). In 16 bit units until the end.
+				int dx[3];
+				int dy[3];
+				float weight[3];
+				const int corners = getMorphTarget(x, y, morphStep, dx, dy, weight);
+				float morph = 0.0f;
+				for (int k = 0; k < corners; k++)
+				{
+					morph += weight[k] * h[side * dy[k] + dx[k]];
+				}
+
+				// Skirt vertices hang below the edge vertex
+				float height = heightOffset + heightScale * h[0];
+				float radius = baseRadius + height * scalingFactor - (i < gridVertices ? 0.0f : skirtDepth);
+				float delta = (morph - h[0]) * heightScale * scalingFactor;
+
+				if (pass == 0)
+				{
+					minRadius = std::min(minRadius, radius);
+					maxRadius = std::max(maxRadius, radius);
+					maxDelta = std::max(maxDelta, std::fabs(delta));
+					continue;
+				}
+
+				*packed++ = quantise(radius - radiusScale[0], invScale[0]);
+				*packed++ = quantise(delta, invScale[1]);
+				octEncode(vertices + FLOATS_PER_VERTEX * i + 3, packed);
+				packed += 2;
+			}
+		}
+	}
+
+	void PatchMeshKernel::buildGrid(int quads, bool skirts, Ogre::int16 * grid)
+	{
+		const int count = (quads + 1) * (quads + 1) + (skirts ? SkirtIndices::getVertexCount(quads) : 0);
+
+		for (int i = 0; i < count; i++)
+		{
+			int x, y;
+			SkirtIndices::getGridPosition(quads, i, x, y);
+			*grid++ = (Ogre::int16) x;
+			*grid++ = (Ogre::int16) y;
+		}
+	}
+}
@@ -0,0 +1,615 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef PATCHMESHKERNEL_H
+#define PATCHMESHKERNEL_H
+
+#include "OPCpuDispatch.h"
+#include "OPScratchArena.h"
+#include "OPSimd.h"
+
+#include <Ogre.h>
+
+#include <algorithm>
+#include <cfloat>
+
+namespace OgrePlanet
+{
+	// Moves n unit sphere positions out to baseRadius + height *
+	// scalingFactor, where height = heightOffset + heightScale *
+	// heights[i] (see QuantizedHeights). Input and output are separate
+	// x, y and z arrays. boundsMin/boundsMax receive the xyz bounds of
+	// the result.
+	typedef void (*DisplaceGridKernel)(const float * xs, const float * ys, const float * zs,
+		const Ogre::uint16 * heights,
+		float heightOffset,
+		float heightScale,
+		int n,
+		float baseRadius,
+		float scalingFactor,
+		float * px, float * py, float * pz,
+		float * boundsMin,
+		float * boundsMax);
+
+	// Builds the (quads + 1)^2 interleaved vertices of a patch from its
+	// (quads + 2*padding + 1)^2 grid of positions. The geomorph targets
+	// lie on the parent patch, whose vertices are morphStep (a power of
+	// two) apart in the grid; padding must be at least
+	// PatchMeshKernel::getPadding(morphStep).
+	// center is subtracted from the positions, texture coordinates run
+	// from texMin to texMax. vertices receives FLOATS_PER_VERTEX floats
+	// per vertex:
+	//   position (3), normal (3),
+	//   texture coordinate (u, v, edge flag x, edge flag y),
+	//   geomorph target position (3), geomorph target normal (3)
+	typedef void (*BuildVerticesKernel)(const float * px, const float * py, const float * pz,
+		int quads,
+		int padding,
+		int morphStep,
+		const float * center,
+		float texXMin,
+		float texXMax,
+		float texYMin,
+		float texYMax,
+		float * vertices);
+
+	// Vertex layout of patch meshes
+	enum VertexFormat
+	{
+		// FLOATS_PER_VERTEX floats, as written by buildVertices
+		VERTEX_FORMAT_FLOAT,
+		// SHORTS_PER_PACKED_VERTEX shorts, as written by packVertices
+		VERTEX_FORMAT_PACKED,
+		// SHORTS_PER_HEIGHT_VERTEX shorts, as written by packHeights, in
+		// a second stream next to a grid shared by all patches. The
+		// vertex program projects the grid onto the sphere.
+		VERTEX_FORMAT_HEIGHT
+	};
+
+	// Kernels used by PatchMeshLoader, bound by CpuDispatch
+	class PatchMeshKernel
+	{
+	public:
+		static const int FLOATS_PER_VERTEX = 16;
+		static const int SHORTS_PER_PACKED_VERTEX = 12;
+		static const int SHORTS_PER_HEIGHT_VERTEX = 4;
+
+		static DisplaceGridKernel displaceGrid;
+		static BuildVerticesKernel buildVertices;
+
+		// Use the kernels for the given instruction set, see CpuDispatch
+		static void bindKernels(CpuIsa isa);
+
+		// Padding the grid of a patch needs around it, for the normals
+		// of its vertices and of its parent's vertices, which are
+		// morphStep apart
+		static int getPadding(int morphStep);
+
+		// Same as buildVertices, for a grid of constant height. xs, ys
+		// and zs are the unit sphere positions p* were displaced from,
+		// and are the normals. The geomorph target normals are those of
+		// the geomorph target positions.
+		static void buildConstantVertices(const float * px, const float * py, const float * pz,
+			const float * xs, const float * ys, const float * zs,
+			int quads,
+			int padding,
+			int morphStep,
+			const float * center,
+			float texXMin,
+			float texXMax,
+			float texYMin,
+			float texYMax,
+			float * vertices);
+
+		// Appends the skirt vertices to the (quads + 1)^2 vertices written
+		// by buildVertices, vertices must have room for them. Each is a
+		// copy of an edge vertex moved towards the planet centre, below
+		// the lowest edge vertex by margin times the length of an edge.
+		// See SkirtIndices for the order. Returns how far the skirts
+		// reach below the edge.
+		static float buildSkirts(int quads,
+			const float * center,
+			float margin,
+			float * vertices);
+
+		// Packs the (quads + 1)^2 vertices written by buildVertices, and
+		// the skirt vertices if skirts is set, into
+		// SHORTS_PER_PACKED_VERTEX shorts per vertex:
+		//   position (3), grid x,
+		//   octahedral normal (2), octahedral geomorph target normal (2),
+		//   geomorph target position - position (3), grid y
+		// Positions are divided by positionScale.xyz and the geomorph
+		// delta by positionScale.w, both chosen here to use the full
+		// range of a short. Texture coordinates and edge flags are not
+		// stored, the vertex program rebuilds them from the grid x and y.
+		static void packVertices(const float * vertices,
+			int quads,
+			bool skirts,
+			float * positionScale,
+			Ogre::int16 * packed);
+
+		// Packs the per patch part of the (quads + 1)^2 vertices of the
+		// height format, and the skirt vertices if skirts is set, into
+		// SHORTS_PER_HEIGHT_VERTEX shorts per vertex:
+		//   radius, geomorph target radius - radius,
+		//   octahedral normal (2)
+		// heights is the (quads + 2*padding + 1)^2 height grid, as in
+		// displaceGrid, and vertices the output of buildVertices and
+		// buildSkirts, for the normals. morphStep is as in buildVertices.
+		// Skirt vertices are skirtDepth
+		// below their edge vertex.
+		// The radius is radiusScale[0] + radiusScale[1] * packed radius,
+		// the geomorph delta is radiusScale[2] * packed delta.
+		static void packHeights(const float * vertices,
+			const Ogre::uint16 * heights,
+			float heightOffset,
+			float heightScale,
+			int quads,
+			int padding,
+			int morphStep,
+			bool skirts,
+			float skirtDepth,
+			float baseRadius,
+			float scalingFactor,
+			float * radiusScale,
+			Ogre::int16 * packed);
+
+		// Grid x and y of the (quads + 1)^2 vertices, and of the skirt
+		// vertices if skirts is set, as two shorts per vertex. The
+		// shared stream of the height format.
+		static void buildGrid(int quads, bool skirts, Ogre::int16 * grid);
+	};
+
+	// Kernels compiled with AVX, defined in OPKernelsAVX2.cpp
+	void displaceGridAVX2(const float * xs, const float * ys, const float * zs,
+		const Ogre::uint16 * heights,
+		float heightOffset,
+		float heightScale,
+		int n,
+		float baseRadius,
+		float scalingFactor,
+		float * px, float * py, float * pz,
+		float * boundsMin,
+		float * boundsMax);
+	void buildVerticesAVX2(const float * px, const float * py, const float * pz,
+		int quads,
+		int padding,
+		int morphStep,
+		const float * center,
+		float texXMin,
+		float texXMax,
+		float texYMin,
+		float texYMax,
+		float * vertices);
+
+	// The kernels are in an unnamed namespace, see OPSimd.h
+	namespace
+	{
+		// Displaces elements [i, n) and grows the bounds to fit them
+		template <class Simd>
+		struct DisplaceGrid
+		{
+			// baseRadius and scalingFactor have the height offset and scale
+			// folded in
+			static void run(const float * xs, const float * ys, const float * zs,
+				const Ogre::uint16 * heights,
+				int i,
+				int n,
+				float baseRadius,
+				float scalingFactor,
+				float * px, float * py, float * pz,
+				float * boundsMin,
+				float * boundsMax)
+			{
+				typedef typename Simd::V V;
+
+				const V vBase = Simd::set1(baseRadius);
+				const V vScale = Simd::set1(scalingFactor);
+				V vMin[3];
+				V vMax[3];
+				for (int c = 0; c < 3; c++)
+				{
+					vMin[c] = Simd::set1(boundsMin[c]);
+					vMax[c] = Simd::set1(boundsMax[c]);
+				}
+
+				const float * in[3] = { xs, ys, zs };
+				float * out[3] = { px, py, pz };
+
+				for (; i + Simd::WIDTH <= n; i += Simd::WIDTH)
+				{
+					V r = Simd::add(vBase, Simd::mul(Simd::loadUShort(heights + i), vScale));
+					for (int c = 0; c < 3; c++)
+					{
+						V p = Simd::mul(Simd::load(in[c] + i), r);
+						Simd::store(out[c] + i, p);
+						vMin[c] = Simd::min(vMin[c], p);
+						vMax[c] = Simd::max(vMax[c], p);
+					}
+				}
+
+				for (int c = 0; c < 3; c++)
+				{
+					float lanes[2][Simd::WIDTH];
+					Simd::store(lanes[0], vMin[c]);
+					Simd::store(lanes[1], vMax[c]);
+					for (int k = 0; k < Simd::WIDTH; k++)
+					{
+						boundsMin[c] = (lanes[0][k] < boundsMin[c] ? lanes[0][k] : boundsMin[c]);
+						boundsMax[c] = (boundsMax[c] < lanes[1][k] ? lanes[1][k] : boundsMax[c]);
+					}
+				}
+
+				Simd::end();
+				if (Simd::WIDTH > 1)
+				{
+					DisplaceGrid<typename Simd::Tail>::run(xs, ys, zs, heights, i, n, baseRadius, scalingFactor, px, py, pz, boundsMin, boundsMax);
+				}
+			}
+		};
+
+		// Normals for elements [x, end) of a row, from the 6 surrounding
+		// vertices with triangle-area weighting. p* point at the row in a
+		// grid with the given stride, which has at least one element of
+		// padding in each direction.
+		template <class Simd>
+		struct VertexNormals
+		{
+			static void run(const float * px, const float * py, const float * pz,
+				int stride,
+				int x,
+				int end,
+				float * nx, float * ny, float * nz)
+			{
+				typedef typename Simd::V V;
+
+				// The neighbours, in counter clockwise order (in grid
+				// space): next x, next x prev y, prev y, prev x,
+				// prev x next y, next y
+				const int offset[6] = { 1, 1 - stride, -stride, -1, stride - 1, stride };
+
+				for (; x + Simd::WIDTH <= end; x += Simd::WIDTH)
+				{
+					V cx = Simd::load(px + x);
+					V cy = Simd::load(py + x);
+					V cz = Simd::load(pz + x);
+
+					V dx[6];
+					V dy[6];
+					V dz[6];
+					for (int k = 0; k < 6; k++)
+					{
+						dx[k] = Simd::sub(Simd::load(px + x + offset[k]), cx);
+						dy[k] = Simd::sub(Simd::load(py + x + offset[k]), cy);
+						dz[k] = Simd::sub(Simd::load(pz + x + offset[k]), cz);
+					}
+
+					V sx = Simd::set1(0.0f);
+					V sy = Simd::set1(0.0f);
+					V sz = Simd::set1(0.0f);
+					for (int k = 0; k < 6; k++)
+					{
+						int l = (k + 1) % 6;
+						sx = Simd::add(sx, Simd::sub(Simd::mul(dy[k], dz[l]), Simd::mul(dz[k], dy[l])));
+						sy = Simd::add(sy, Simd::sub(Simd::mul(dz[k], dx[l]), Simd::mul(dx[k], dz[l])));
+						sz = Simd::add(sz, Simd::sub(Simd::mul(dx[k], dy[l]), Simd::mul(dy[k], dx[l])));
+					}
+
+					V r = Simd::rsqrt(Simd::add(Simd::add(Simd::mul(sx, sx), Simd::mul(sy, sy)), Simd::mul(sz, sz)));
+					Simd::store(nx + x, Simd::mul(sx, r));
+					Simd::store(ny + x, Simd::mul(sy, r));
+					Simd::store(nz + x, Simd::mul(sz, r));
+				}
+
+				Simd::end();
+				if (Simd::WIDTH > 1)
+				{
+					VertexNormals<typename Simd::Tail>::run(px, py, pz, stride, x, end, nx, ny, nz);
+				}
+			}
+		};
+
+		// The geomorph target of vertex (x, y) is the point on the parent
+		// patch's surface it will be merged into. The parent's vertices are
+		// step apart in our grid, and its quads are split along the
+		// diagonal from (step, 0) to (0, step). Fills in the corners of the
+		// parent triangle the vertex lies in, as offsets from (x, y), and
+		// their weights. Corners with no weight are left out, returns how
+		// many there are.
+		inline int getMorphTarget(int x, int y, int step, int * dx, int * dy, float * weight)
+		{
+			const int fx = x % step;
+			const int fy = y % step;
+
+			// Offset of each corner of the triangle and its weight, times step
+			int corners[3][3];
+			if (fx + fy <= step)
+			{
+				int lower[3][3] = {
+					{ -fx, -fy, step - fx - fy },
+					{ step - fx, -fy, fx },
+					{ -fx, step - fy, fy } };
+				std::copy(&lower[0][0], &lower[0][0] + 9, &corners[0][0]);
+			}
+			else
+			{
+				int upper[3][3] = {
+					{ step - fx, step - fy, fx + fy - step },
+					{ step - fx, -fy, step - fy },
+					{ -fx, step - fy, step - fx } };
+				std::copy(&upper[0][0], &upper[0][0] + 9, &corners[0][0]);
+			}
+
+			int n = 0;
+			for (int i = 0; i < 3; i++)
+			{
+				if (corners[i][2] > 0)
+				{
+					dx[n] = corners[i][0];
+					dy[n] = corners[i][1];
+					weight[n] = (float) corners[i][2] / step;
+					n++;
+				}
+			}
+			return n;
+		}
+
+		// Positions and geomorph target positions for elements [x, end) of a
+		// row, relative to center, when the parent's vertices are two
+		// apart. A vertex that doesn't exist in the parent patch (odd x or
+		// odd y) morphs towards the midpoint of the parent edge it lies
+		// on, see getMorphTarget().
+		template <class Simd>
+		struct MorphPositions
+		{
+			static void run(const float * const p[3],
+				int stride,
+				bool oddRow,
+				int x,
+				int end,
+				const float * center,
+				float * const pos[3],
+				float * const morph[3])
+			{
+				typedef typename Simd::V V;
+
+				const V half = Simd::set1(0.5f);
+
+				for (; x + Simd::WIDTH <= end; x += Simd::WIDTH)
+				{
+					for (int c = 0; c < 3; c++)
+					{
+						const float * row = p[c] + x;
+						V vCenter = Simd::set1(center[c]);
+						V thisVertex = Simd::load(row);
+						V even;
+						V odd;
+
+						if (oddRow)
+						{
+							even = Simd::mul(half, Simd::add(Simd::load(row + stride), Simd::load(row - stride)));
+							odd = Simd::mul(half, Simd::add(Simd::load(row + 1 - stride), Simd::load(row - 1 + stride)));
+						}
+						else
+						{
+							even = thisVertex;
+							odd = Simd::mul(half, Simd::add(Simd::load(row + 1), Simd::load(row - 1)));
+						}
+
+						Simd::store(pos[c] + x, Simd::sub(thisVertex, vCenter));
+						Simd::store(morph[c] + x, Simd::sub(Simd::selectOdd(even, odd, x), vCenter));
+					}
+				}
+
+				Simd::end();
+				if (Simd::WIDTH > 1)
+				{
+					MorphPositions<typename Simd::Tail>::run(p, stride, oddRow, x, end, center, pos, morph);
+				}
+			}
+		};
+
+		template <class Simd>
+		void displaceGrid(const float * xs, const float * ys, const float * zs,
+			const Ogre::uint16 * heights,
+			float heightOffset,
+			float heightScale,
+			int n,
+			float baseRadius,
+			float scalingFactor,
+			float * px, float * py, float * pz,
+			float * boundsMin,
+			float * boundsMax)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				boundsMin[c] = FLT_MAX;
+				boundsMax[c] = -FLT_MAX;
+			}
+
+			// The radius is a linear function of the 16 bit value
+			DisplaceGrid<Simd>::run(xs, ys, zs, heights, 0, n,
+				baseRadius + heightOffset * scalingFactor,
+				heightScale * scalingFactor,
+				px, py, pz, boundsMin, boundsMax);
+		}
+
+		template <class Simd>
+		void buildVertices(const float * px, const float * py, const float * pz,
+			int quads,
+			int padding,
+			int morphStep,
+			const float * center,
+			float texXMin,
+			float texXMax,
+			float texYMin,
+			float texYMax,
+			float * vertices)
+		{
+			assert(padding >= PatchMeshKernel::getPadding(morphStep) && quads % morphStep == 0);
+
+			const int side = quads + 2*padding + 1;
+			const int parentQuads = quads / morphStep;
+			const int parentSide = parentQuads + 3;
+			const int origin = padding - morphStep;
+			const float * p[3] = { px, py, pz };
+
+			// Every morphStep:th vertex of the grid is a vertex of the parent
+			// patch. Copy those out, with one parent vertex of padding, so
+			// the parent level normals can be computed with unit stride.
+			ScratchArena::Scope scope;
+			float * pp[3];
+			for (int c = 0; c < 3; c++)
+			{
+				pp[c] = scope.allocate<float>(parentSide * parentSide);
+				for (int y = 0; y < parentSide; y++)
+				{
+					for (int x = 0; x < parentSide; x++)
+					{
+						pp[c][parentSide * y + x] = p[c][side * (origin + morphStep*y) + origin + morphStep*x];
+					}
+				}
+			}
+
+			// Parent level normals
+			float * pn[3];
+			for (int c = 0; c < 3; c++)
+			{
+				pn[c] = scope.allocate<float>((parentQuads + 1) * (parentQuads + 1));
+			}
+			for (int y = 0; y <= parentQuads; y++)
+			{
+				int row = parentSide * (y + 1) + 1;
+				int outRow = (parentQuads + 1) * y;
+				VertexNormals<Simd>::run(pp[0] + row, pp[1] + row, pp[2] + row,
+					parentSide,
+					0, parentQuads + 1,
+					pn[0] + outRow, pn[1] + outRow, pn[2] + outRow);
+			}
+
+			// Per row scratch, for each of position, normal, morph position
+			// and morph normal
+			float * pos[3];
+			float * normal[3];
+			float * morph[3];
+			float * morphNormal[3];
+			for (int c = 0; c < 3; c++)
+			{
+				pos[c] = scope.allocate<float>(quads + 1);
+				normal[c] = scope.allocate<float>(quads + 1);
+				morph[c] = scope.allocate<float>(quads + 1);
+				morphNormal[c] = scope.allocate<float>(quads + 1);
+			}
+
+			float * out = vertices;
+
+			for (int y = 0; y <= quads; y++)
+			{
+				const int row = side * (y + padding) + padding;
+				const float * rowP[3] = { px + row, py + row, pz + row };
+				VertexNormals<Simd>::run(rowP[0], rowP[1], rowP[2],
+					side,
+					0, quads + 1,
+					normal[0], normal[1], normal[2]);
+
+				if (morphStep == 2)
+				{
+					MorphPositions<Simd>::run(rowP, side, (y % 2 != 0), 0, quads + 1, center, pos, morph);
+				}
+
+				// Morph normals, and morph positions unless done above: the
+				// parent's where the vertex exists in the parent, otherwise
+				// weighted over the corners of the parent triangle
+				for (int x = 0; x <= quads; x++)
+				{
+					int dx[3];
+					int dy[3];
+					float weight[3];
+					const int corners = getMorphTarget(x, y, morphStep, dx, dy, weight);
+
+					if (morphStep != 2)
+					{
+						for (int c = 0; c < 3; c++)
+						{
+							float m = 0.0f;
+							for (int k = 0; k < corners; k++)
+							{
+								m += weight[k] * rowP[c][x + side * dy[k] + dx[k]];
+							}
+							pos[c][x] = rowP[c][x] - center[c];
+							morph[c][x] = m - center[c];
+						}
+					}
+
+					float n[3] = { 0.0f, 0.0f, 0.0f };
+					for (int k = 0; k < corners; k++)
+					{
+						const int i = (parentQuads + 1) * ((y + dy[k]) / morphStep) + (x + dx[k]) / morphStep;
+						for (int c = 0; c < 3; c++)
+						{
+							n[c] += weight[k] * pn[c][i];
+						}
+					}
+
+					const float r = (corners == 1 ? 1.0f : reciprocalSqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]));
+					for (int c = 0; c < 3; c++)
+					{
+						morphNormal[c][x] = n[c] * r;
+					}
+				}
+
+				// Interleave into the final vertex layout
+				const float jy = ((float) y)/quads;
+				const float texY = (1 - jy) * texYMin + jy * texYMax;
+				const float edgeY = (y == 0 ? 0.0f : (y == quads ? 1.0f : 0.5f));
+
+				for (int x = 0; x <= quads; x++)
+				{
+					const float jx = ((float) x)/quads;
+
+					*out++ = pos[0][x];
+					*out++ = pos[1][x];
+					*out++ = pos[2][x];
+
+					*out++ = normal[0][x];
+					*out++ = normal[1][x];
+					*out++ = normal[2][x];
+
+					*out++ = (1 - jx) * texXMin + jx * texXMax;
+					*out++ = texY;
+					*out++ = (x == 0 ? 0.0f : (x == quads ? 1.0f : 0.5f));
+					*out++ = edgeY;
+
+					*out++ = morph[0][x];
+					*out++ = morph[1][x];
+					*out++ = morph[2][x];
+
+					*out++ = morphNormal[0][x];
+					*out++ = morphNormal[1][x];
+					*out++ = morphNormal[2][x];
+				}
+			}
+		}
+	}
+}
+
+#endif // PATCHMESHKERNEL_H
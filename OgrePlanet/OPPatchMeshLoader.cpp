@@ -22,907 +22,463 @@ THE SOFTWARE.
 
 #include "OPPatchMeshLoader.h"
 #include "OPPatch.h"
+#include "OPPatchMeshKernel.h"
+#include "OPScratchArena.h"
 #include "OPStitching.h"
+#include "OPVertexCache.h"
+
+#include <algorithm>
 
 namespace OgrePlanet
 {
-	Ogre::HardwareIndexBufferSharedPtr PatchMeshLoader::indexBuffer[16];
-
-	void PatchMeshLoader::init(int quads) {
-		int maxTriangles = 2 * quads * quads;
-
-		for (int i = 0; i < 16; i++) {
-			int triangles = maxTriangles;
-			switch(i) {
-				case STITCHING_NONE:
-					break;
-				case STITCHING_W:
-				case STITCHING_N:
-				case STITCHING_E:
-				case STITCHING_S:
-					triangles -= (quads / 2);
-					break;
-				case STITCHING_WN:
-				case STITCHING_WE:
-				case STITCHING_WS:
-				case STITCHING_NE:
-				case STITCHING_NS:
-				case STITCHING_ES:
-					triangles -= (2 * (quads / 2));
-					break;
-				case STITCHING_WNE:
-				case STITCHING_WNS:
-				case STITCHING_WES:
-				case STITCHING_NES:
-					triangles -= (3 * (quads / 2));
-					break;
-				case STITCHING_WNES:
-					triangles -= (4 * (quads / 2));
-					break;
-			}
+	std::map<int, std::vector<Ogre::HardwareIndexBufferSharedPtr> > PatchMeshLoader::msIndexBuffers;
+	std::map<int, Ogre::HardwareIndexBufferSharedPtr> PatchMeshLoader::msSkirtIndexBuffers;
+	std::map<int, Ogre::HardwareVertexBufferSharedPtr> PatchMeshLoader::msGridVertexBuffers;
+	std::map<std::pair<VertexFormat, int>, VertexBufferPool *> PatchMeshLoader::msVertexBufferPools;
+	VertexFormat PatchMeshLoader::msVertexFormat = VERTEX_FORMAT_FLOAT;
+	CrackHiding PatchMeshLoader::msCrackHiding = CRACK_HIDING_STITCHING;
+	ConstantGeometryCache PatchMeshLoader::msConstantGeometryCache;
+	const Ogre::Real PatchMeshLoader::SKIRT_MARGIN = 0.05f;
+
+	void PatchMeshLoader::cleanup()
+	{
+		msIndexBuffers.clear();
+		msSkirtIndexBuffers.clear();
+		msGridVertexBuffers.clear();
+		msConstantGeometryCache.clear();
+
+		for (std::map<std::pair<VertexFormat, int>, VertexBufferPool *>::iterator i = msVertexBufferPools.begin(); i != msVertexBufferPools.end(); ++i) {
+			delete i->second;
+		}
+		msVertexBufferPools.clear();
+	}
+
+	Ogre::HardwareIndexBufferSharedPtr PatchMeshLoader::getIndexBuffer(int quads, const int levels[4])
+	{
+		std::vector<Ogre::HardwareIndexBufferSharedPtr> & indexBuffers = msIndexBuffers[quads];
+		if (indexBuffers.empty())
+		{
+			indexBuffers.resize(StitchingIndices::KEY_COUNT);
+		}
+
+		Ogre::HardwareIndexBufferSharedPtr & indexBuffer = indexBuffers[StitchingIndices::getKey(levels)];
+
+		if (indexBuffer.isNull())
+		{
+			std::vector<Ogre::uint32> indices;
+			StitchingIndices::build(quads, levels, indices);
+
+			indexBuffer = createIndexBuffer(indices, (quads + 1) * (quads + 1),
+				Ogre::StringConverter::toString(quads) + " quads, stitching " +
+				Ogre::StringConverter::toString(levels[0]) + Ogre::StringConverter::toString(levels[1]) +
+				Ogre::StringConverter::toString(levels[2]) + Ogre::StringConverter::toString(levels[3]));
+		}
+
+		return indexBuffer;
+	}
+
+	Ogre::HardwareIndexBufferSharedPtr PatchMeshLoader::getSkirtIndexBuffer(int quads)
+	{
+		Ogre::HardwareIndexBufferSharedPtr & indexBuffer = msSkirtIndexBuffers[quads];
+
+		if (indexBuffer.isNull())
+		{
+			std::vector<Ogre::uint32> indices;
+			SkirtIndices::build(quads, indices);
+
+			indexBuffer = createIndexBuffer(indices, (quads + 1) * (quads + 1) + SkirtIndices::getVertexCount(quads),
+				Ogre::StringConverter::toString(quads) + " quads, skirts");
+		}
+
+		return indexBuffer;
+	}
+
+	Ogre::HardwareIndexBufferSharedPtr PatchMeshLoader::createIndexBuffer(std::vector<Ogre::uint32> & indices,
+		int vertexCount,
+		const Ogre::String & description)
+	{
+		// The generators emit rows of quads, reorder them so that fewer
+		// vertices are transformed twice
+		float acmr = VertexCache::getACMR(indices);
+		VertexCache::optimise(indices, vertexCount);
+		Ogre::LogManager::getSingleton().logMessage("OgrePlanet: " + description +
+			", ACMR " + Ogre::StringConverter::toString(acmr) +
+			" -> " + Ogre::StringConverter::toString(VertexCache::getACMR(indices)) + ".");
+
+		// 16 bit indices unless there are too many vertices
+		Ogre::HardwareIndexBufferSharedPtr indexBuffer;
+		if (vertexCount <= 65536)
+		{
+			indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(Ogre::HardwareIndexBuffer::IT_16BIT,
+				indices.size(),
+				Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+			std::vector<Ogre::uint16> shortIndices(indices.begin(), indices.end());
+			indexBuffer->writeData(0, indexBuffer->getSizeInBytes(), &shortIndices[0], true);
+		}
+		else
+		{
+			indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(Ogre::HardwareIndexBuffer::IT_32BIT,
+				indices.size(),
+				Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+			indexBuffer->writeData(0, indexBuffer->getSizeInBytes(), &indices[0], true);
+		}
+
+		return indexBuffer;
+	}
 
-			indexBuffer[i] = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(Ogre::HardwareIndexBuffer::IT_16BIT,
-				3 * triangles,
-				Ogre::HardwareBuffer::HBU_WRITE_ONLY);
-			unsigned short * pIndices = static_cast<unsigned short *>(indexBuffer[i]->lock(Ogre::HardwareBuffer::HBL_DISCARD));
-
-			for (int y = 0; y < quads; y++) {
-				for (int x = 0; x < quads; x++) {
-					if (
-						i == STITCHING_NONE ||	// No stitching
-							(x != 0 && x != (quads-1) && y != 0 && y != (quads-1)) || // interior quad, no stitching
-							(i == STITCHING_W && x > 0) ||
-							(i == STITCHING_N && y > 0) ||
-							(i == STITCHING_E && x < (quads-1)) ||
-							(i == STITCHING_S && y < (quads-1)) ||
-							(i == STITCHING_WN && x > 0 && y > 0) ||
-							(i == STITCHING_WE && x > 0 && x < (quads-1)) ||
-							(i == STITCHING_WS && x > 0 && y < (quads-1)) ||
-							(i == STITCHING_NE && x < (quads-1) && y > 0) ||
-							(i == STITCHING_NS && y > 0 && y < (quads-1)) ||
-							(i == STITCHING_ES && x < (quads-1) && y < (quads-1)) ||
-							(i == STITCHING_WNE && x > 0 && x < (quads-1) && y > 0) ||
-							(i == STITCHING_WNS && x > 0 && y > 0 && y < (quads-1)) ||
-							(i == STITCHING_WES && x > 0 && x < (quads-1) && y < (quads-1)) ||
-							(i == STITCHING_NES && x < (quads-1) && y > 0 && y < (quads-1)))
-					{
-						*pIndices++ = y * (quads + 1) + x;
-						*pIndices++ = (y + 1) * (quads + 1) + x;
-						*pIndices++ = y * (quads + 1) + x + 1;
-						*pIndices++ = (y + 1) * (quads + 1) + x;
-						*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-						*pIndices++ = y * (quads + 1) + x + 1;
-					}
-					else if (i == STITCHING_W)
-					{
-						// x must be 0 here
-						if (y % 2 == 0) {
-							*pIndices++ = y * (quads + 1) + x;
-							*pIndices++ = (y + 2) * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							*pIndices++ = y * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							*pIndices++ = y * (quads + 1) + x + 1;
-						} else {
-							// Only one triangle
-							*pIndices++ = (y + 1) * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							*pIndices++ = y * (quads + 1) + x + 1;
-						}
-					}
-					else if (i == STITCHING_N)
-					{
-						// y must be 0 here
-						if (x % 2 == 0) {
-							*pIndices++ = y * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							*pIndices++ = y * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							*pIndices++ = y * (quads + 1) + x + 2;
-						} else {
-							// Only one triangle
-							*pIndices++ = (y + 1) * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							*pIndices++ = y * (quads + 1) + x + 1;
-						}
-					}
-					else if (i == STITCHING_E)
-					{
-						// x must be (quads-1) here
-						if (y % 2 == 0) {
-							*pIndices++ = y * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x;
-							*pIndices++ = y * (quads + 1) + x + 1;
-							*pIndices++ = y * (quads + 1) + x + 1;
-							*pIndices++ = (y + 1) * (quads + 1) + x;
-							*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-						} else {
-							// Only one triangle
-							*pIndices++ = y * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-						}
-					}
-					else if (i == STITCHING_S)
-					{
-						// y must be (quads-1) here
-						if (x % 2 == 0) {
-							*pIndices++ = y * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x;
-							*pIndices++ = y * (quads + 1) + x + 1;
-							*pIndices++ = y * (quads + 1) + x + 1;
-							*pIndices++ = (y + 1) * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-						} else {
-							// Only one triangle
-							*pIndices++ = y * (quads + 1) + x;
-							*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							*pIndices++ = y * (quads + 1) + x + 1;
-						}
-					}
-					else if (i == STITCHING_WN) {
-						if (y == 0) {
-							if (x == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 2;
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == 0) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						}
-					}
-					else if (i == STITCHING_WE) {
-						if (x == 0) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == (quads - 1)) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							}
-						}
-					}
-					else if (i == STITCHING_WS) {
-						if (y == (quads-1)) {
-							if (x == 0) {
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == 0) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						}
-					}
-					else if (i == STITCHING_NE) {
-						if (y == 0) {
-							if (x == (quads-1)) {
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == (quads-1)) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							}
-						}
-					}
-					else if (i == STITCHING_NS) {
-						if (y == 0) {
-							if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (y == (quads-1)) {
-							if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						}
-					}
-					else if (i == STITCHING_ES) {
-						if (y == (quads-1)) {
-							if (x == (quads-1)) {
-								// Do nothing
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == (quads-1)) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							}
-						}
-					}
-					else if (i == STITCHING_WNE) {
-						if (y == 0) {
-							if (x == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 2;
-							} else if (x == (quads-1)) {
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == 0) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == (quads-1)) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							}
-						}
-					}
-					else if (i == STITCHING_WNS) {
-						if (y == 0) {
-							if (x == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 2;
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (y == (quads-1)) {
-							if (x == 0) {
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == 0) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						}
-					}
-					else if (i == STITCHING_WES) {
-						if (y == (quads-1)) {
-							if (x == 0) {
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							} else if (x == (quads-1)) {
-								// Do nothing
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == 0) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == (quads-1)) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							}
-						}
-					}
-					else if (i == STITCHING_NES) {
-						if (y == 0) {
-							if (x == (quads-1)) {
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (y == (quads-1)) {
-							if (x == (quads-1)) {
-								// Do nothing
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == (quads-1)) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							}
-						}
-					}
-					else if (i == STITCHING_WNES) {
-						if (y == 0) {
-							if (x == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 2;
-							} else if (x == (quads-1)) {
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (y == (quads-1)) {
-							if (x == 0) {
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							} else if (x == (quads-1)) {
-								// Do nothing
-							} else if (x % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 2;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == 0) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-							}
-						} else if (x == (quads-1)) {
-							if (y % 2 == 0) {
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = y * (quads + 1) + x + 1;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 2) * (quads + 1) + x + 1;
-							} else {
-								// Only one triangle
-								*pIndices++ = y * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x;
-								*pIndices++ = (y + 1) * (quads + 1) + x + 1;
-							}
-						}
-					}
-				}
+	Ogre::HardwareVertexBufferSharedPtr PatchMeshLoader::getGridVertexBuffer(int quads, bool skirts)
+	{
+		const int vertexCount = (quads + 1) * (quads + 1) + (skirts ? SkirtIndices::getVertexCount(quads) : 0);
+		Ogre::HardwareVertexBufferSharedPtr & gridVertexBuffer = msGridVertexBuffers[vertexCount];
+
+		if (gridVertexBuffer.isNull())
+		{
+			// The per patch stream is drawn from a slot of a pooled
+			// buffer, and its vertexStart offsets this stream too. Repeat
+			// the grid once per slot so every slot finds it.
+			VertexBufferPool * pool = getVertexBufferPool(VERTEX_FORMAT_HEIGHT, vertexCount, true);
+			const size_t gridVertices = pool->getSlotVertices();
+			const size_t slots = pool->getSlotsPerBuffer();
+
+			std::vector<Ogre::int16> grid(2 * gridVertices * slots);
+			PatchMeshKernel::buildGrid(quads, skirts, &grid[0]);
+			for (size_t i = 1; i < slots; i++)
+			{
+				std::copy(grid.begin(), grid.begin() + 2 * gridVertices, grid.begin() + 2 * gridVertices * i);
 			}
 
-			indexBuffer[i]->unlock();
+			gridVertexBuffer = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+				2 * sizeof(Ogre::int16),
+				gridVertices * slots,
+				Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+			gridVertexBuffer->writeData(0, gridVertexBuffer->getSizeInBytes(), &grid[0], true);
 		}
+
+		return gridVertexBuffer;
 	}
 
-	void PatchMeshLoader::cleanup()
+	size_t PatchMeshLoader::getAllocatedGpuSize()
+	{
+		size_t size = 0;
+
+		for (std::map<std::pair<VertexFormat, int>, VertexBufferPool *>::iterator i = msVertexBufferPools.begin(); i != msVertexBufferPools.end(); ++i)
+		{
+			size += i->second->getBufferCount() * i->second->getBufferSize();
+		}
+
+		for (std::map<int, Ogre::HardwareVertexBufferSharedPtr>::iterator i = msGridVertexBuffers.begin(); i != msGridVertexBuffers.end(); ++i)
+		{
+			size += i->second->getSizeInBytes();
+		}
+
+		return size;
+	}
+
+	size_t PatchMeshLoader::trimVertexBufferPools()
+	{
+		size_t freed = 0;
+
+		for (std::map<std::pair<VertexFormat, int>, VertexBufferPool *>::iterator i = msVertexBufferPools.begin(); i != msVertexBufferPools.end(); ++i)
+		{
+			freed += i->second->trim();
+		}
+
+		return freed;
+	}
+
+	VertexBufferPool * PatchMeshLoader::getVertexBufferPool(VertexFormat format, int vertexCount, bool create)
 	{
-		for (int i = 0; i < 16; i++) {
-			indexBuffer[i].setNull();
+		std::pair<VertexFormat, int> key(format, vertexCount);
+		std::map<std::pair<VertexFormat, int>, VertexBufferPool *>::iterator i = msVertexBufferPools.find(key);
+
+		if (i != msVertexBufferPools.end())
+		{
+			return i->second;
 		}
+
+		if (!create)
+		{
+			return 0;
+		}
+
+		size_t vertexSize = 0;
+		switch (format)
+		{
+		case VERTEX_FORMAT_FLOAT:
+			vertexSize = PatchMeshKernel::FLOATS_PER_VERTEX * sizeof(float);
+			break;
+		case VERTEX_FORMAT_PACKED:
+			vertexSize = PatchMeshKernel::SHORTS_PER_PACKED_VERTEX * sizeof(Ogre::int16);
+			break;
+		case VERTEX_FORMAT_HEIGHT:
+			vertexSize = PatchMeshKernel::SHORTS_PER_HEIGHT_VERTEX * sizeof(Ogre::int16);
+			break;
+		}
+
+		VertexBufferPool * pool = new VertexBufferPool(vertexSize, vertexCount);
+		msVertexBufferPools[key] = pool;
+		return pool;
+	}
+
+	void PatchMeshLoader::setVertexFormat(VertexFormat format)
+	{
+		msVertexFormat = format;
+	}
+
+	VertexFormat PatchMeshLoader::getVertexFormat()
+	{
+		return msVertexFormat;
+	}
+
+	void PatchMeshLoader::setCrackHiding(CrackHiding crackHiding)
+	{
+		msCrackHiding = crackHiding;
+	}
+
+	CrackHiding PatchMeshLoader::getCrackHiding()
+	{
+		return msCrackHiding;
 	}
 	
-	PatchMeshLoader::PatchMeshLoader(DataSource * dataSource,
+	PatchMeshLoader::PatchMeshLoader() :
+	mVertexFormat(msVertexFormat),
+		mSkirts(msCrackHiding == CRACK_HIDING_SKIRTS),
+		mBaseRadius(0.0),
+		mScalingFactor(0.0),
+		mTexXMin(0.0),
+		mTexXMax(0.0),
+		mTexYMin(0.0),
+		mTexYMax(0.0),
+		mMorphStep(2),
+		mCenter(Ogre::Vector3::ZERO),
+		mPositionScale(Ogre::Vector4::ZERO),
+		mRadiusScale(Ogre::Vector4::ZERO)
+	{
+	}
+
+	PatchMeshLoader::~PatchMeshLoader()
+	{
+		releaseSlot();
+	}
+
+	void PatchMeshLoader::reset(DataSource * dataSource,
 		int quads,
-		Ogre::Vector3 & min,
-		Ogre::Vector3 & max,
+		int morphStep,
+		const Ogre::Vector3 & min,
+		const Ogre::Vector3 & max,
 		Ogre::Real texXMin,
 		Ogre::Real texXMax,
 		Ogre::Real texYMin,
 		Ogre::Real texYMax,
 		Ogre::Real baseRadius,
 		Ogre::Real scalingFactor,
-		Ogre::AxisAlignedBox & AABB,
-		boost::shared_array<Ogre::Real> data,
-		boost::shared_array<Ogre::Real> parentData,
-		int position) :
-	HeightDataResourceLoader(dataSource, quads, min, max, 2, data, parentData, position),
-		mTexXMin(texXMin),
-		mTexXMax(texXMax),
-		mTexYMin(texYMin),
-		mTexYMax(texYMax),
-		mBaseRadius(baseRadius),
-		mScalingFactor(scalingFactor),
-		mAABB(AABB)
+		const QuantizedHeights * parentData,
+		int position)
 	{
+		clear();
+		HeightDataResourceLoader::reset(dataSource, quads, min, max, PatchMeshKernel::getPadding(morphStep), parentData, position);
+
+		// The format and crack hiding may have changed since the loader
+		// was created
+		mVertexFormat = msVertexFormat;
+		mSkirts = (msCrackHiding == CRACK_HIDING_SKIRTS);
+		mTexXMin = texXMin;
+		mTexXMax = texXMax;
+		mTexYMin = texYMin;
+		mTexYMax = texYMax;
+		mMorphStep = morphStep;
+		mBaseRadius = baseRadius;
+		mScalingFactor = scalingFactor;
+		mAABB = Ogre::AxisAlignedBox();
+		mCenter = Ogre::Vector3::ZERO;
+		mPositionScale = Ogre::Vector4::ZERO;
+		mRadiusScale = Ogre::Vector4::ZERO;
 	}
 
-	void PatchMeshLoader::prepareResource(Ogre::Resource * resource)
+	void PatchMeshLoader::clear()
 	{
-		// First make sure height data is available
-		HeightDataResourceLoader::prepareResource(resource);
+		releaseSlot();
+		clearHeightData();
+		std::vector<float>().swap(mVertices);
+		std::vector<Ogre::int16>().swap(mPackedVertices);
+		mConstantGeometry.reset();
+	}
 
-		vertexPosition = boost::shared_array<Ogre::Vector3>(new Ogre::Vector3[(mQuads + 2*mPadding + 1) * (mQuads + 2*mPadding + 1)]); // Need extra padding to calculate normals
-		vertexNormal = boost::shared_array<Ogre::Vector3>(new Ogre::Vector3[(mQuads + 1) * (mQuads + 1)]);
-		textureCoordinate = boost::shared_array<Ogre::Vector2>(new Ogre::Vector2[(mQuads + 1) * (mQuads + 1)]);
-		interpolatedVertexPosition = boost::shared_array<Ogre::Vector3>(new Ogre::Vector3[(mQuads + 1) * (mQuads + 1)]);
-		interpolatedVertexNormal = boost::shared_array<Ogre::Vector3>(new Ogre::Vector3[(mQuads + 1) * (mQuads + 1)]);
+	void PatchMeshLoader::releaseSlot()
+	{
+		if (mSlot.isNull())
+		{
+			return;
+		}
 
-		Ogre::Vector3 minBounds(MAXINT, MAXINT, MAXINT);
-		Ogre::Vector3 maxBounds(-MAXINT, -MAXINT, -MAXINT);
+		// The pools are gone if cleanup() has been called, meshes still
+		// hold on to their buffers in that case
+		VertexBufferPool * pool = getVertexBufferPool(mVertexFormat, getVertexCount(), false);
+		if (pool)
+		{
+			pool->release(mSlot);
+		}
+		else
+		{
+			mSlot = VertexBufferPool::Slot();
+		}
+	}
 
-		// Now calculate vertex positions (with padding) in planet space
-		for (int y = 0; y < (mQuads + 2*mPadding + 1); y++)
+	void PatchMeshLoader::prepareResource(Ogre::Resource * resource)
+	{
+		if (isConstant())
 		{
-			for (int x = 0; x < (mQuads + 2*mPadding + 1); x++)
+			// A patch in the same place may already have built it
+			mConstantGeometry = msConstantGeometryCache.find(getConstantGeometryKey());
+			if (mConstantGeometry)
 			{
-				int index = (mQuads + 2*mPadding + 1) * y + x;
-				vertexPosition[index] = mUnitSpherePos[index] * (mBaseRadius + mData[index] * mScalingFactor);
-
-				minBounds.x = std::min(minBounds.x, vertexPosition[index].x);
-				minBounds.y = std::min(minBounds.y, vertexPosition[index].y);
-				minBounds.z = std::min(minBounds.z, vertexPosition[index].z);
-				maxBounds.x = std::max(maxBounds.x, vertexPosition[index].x);
-				maxBounds.y = std::max(maxBounds.y, vertexPosition[index].y);
-				maxBounds.z = std::max(maxBounds.z, vertexPosition[index].z);
+				mCenter = mConstantGeometry->center;
+				mAABB = mConstantGeometry->aabb;
+				mPositionScale = mConstantGeometry->positionScale;
+				mRadiusScale = mConstantGeometry->radiusScale;
+				return;
 			}
 		}
 
-		// Transform vertex positions to object space (i.e. centered around origin)
+		HeightDataResourceLoader::prepareResource(resource);
+	}
+
+	void PatchMeshLoader::prepareGeometry(Ogre::Resource * resource,
+		const float * xs,
+		const float * ys,
+		const float * zs)
+	{
+		ScratchArena::Scope scope;
+
+		// Vertex positions (with padding, needed to calculate normals) in
+		// planet space, as separate x, y and z arrays
+		const int side = mQuads + 2*mPadding + 1;
+
+		// A constant source isn't sampled, every height is the same
+		QuantizedHeights constantHeights;
+		const QuantizedHeights * heights = &mHeights;
+		if (isConstant())
+		{
+			constantHeights.assign(mConstantHeight, side * side);
+			heights = &constantHeights;
+		}
 
+		float * px = scope.allocate<float>(side * side);
+		float * py = scope.allocate<float>(side * side);
+		float * pz = scope.allocate<float>(side * side);
+
+		Ogre::Vector3 minBounds;
+		Ogre::Vector3 maxBounds;
+
+		PatchMeshKernel::displaceGrid(xs, ys, zs,
+			&heights->values[0],
+			heights->offset,
+			heights->scale,
+			side * side,
+			mBaseRadius,
+			mScalingFactor,
+			px, py, pz,
+			&minBounds.x,
+			&maxBounds.x);
+
+		// Vertices are stored in object space (i.e. centered around origin)
 		mAABB.setExtents(minBounds, maxBounds);
 		mCenter = mAABB.getCenter();
-		minBounds -= mCenter;
-		maxBounds -= mCenter;
+		mAABB.setExtents(minBounds - mCenter, maxBounds - mCenter);
 
-		for (int y = 0; y < (mQuads + 2*mPadding + 1); y++)
+		// Build the final vertex data here, on the worker thread, so that
+		// loadResource() only has to copy it into the vertex buffer
+		const int vertexCount = getVertexCount();
+		float * vertices;
+		if (mVertexFormat == VERTEX_FORMAT_FLOAT)
 		{
-			for (int x = 0; x < (mQuads + 2*mPadding + 1); x++)
-			{
-				int index = (mQuads + 2*mPadding + 1) * y + x;
-				vertexPosition[index] -= mCenter;
-			}
+			mVertices.resize(PatchMeshKernel::FLOATS_PER_VERTEX * vertexCount);
+			vertices = &mVertices[0];
+		}
+		else
+		{
+			// The float vertices are only an intermediate step
+			vertices = scope.allocate<float>(PatchMeshKernel::FLOATS_PER_VERTEX * vertexCount);
 		}
 
-		mAABB.setExtents(minBounds, maxBounds);
+		if (isConstant())
+		{
+			// The normals are those of the sphere
+			PatchMeshKernel::buildConstantVertices(px, py, pz,
+				xs, ys, zs,
+				mQuads,
+				mPadding,
+				mMorphStep,
+				&mCenter.x,
+				mTexXMin,
+				mTexXMax,
+				mTexYMin,
+				mTexYMax,
+				vertices);
+		}
+		else
+		{
+			PatchMeshKernel::buildVertices(px, py, pz,
+				mQuads,
+				mPadding,
+				mMorphStep,
+				&mCenter.x,
+				mTexXMin,
+				mTexXMax,
+				mTexYMin,
+				mTexYMax,
+				vertices);
+		}
 
-		// Calculate vertex normals, texture coordinates and interpolated positions
-		for (int y = 0; y < (mQuads + 1); y++)
+		float skirtDepth = 0.0f;
+		if (mSkirts)
 		{
-			for (int x = 0; x < (mQuads + 1); x++)
+			skirtDepth = PatchMeshKernel::buildSkirts(mQuads, &mCenter.x, SKIRT_MARGIN, vertices);
+
+			// The skirts reach below the surface the bounds were taken from
+			for (int i = (mQuads + 1) * (mQuads + 1); i < vertexCount; i++)
 			{
-				int index = (mQuads + 1) * y + x;
-
-				// 6-connected, with triangle-area correction
-				int pIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding);
-				int pNextXIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding + 1);
-				int pNextYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding + 1) + (x + mPadding);
-				int pPrevXIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding - 1);
-				int pPrevYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding - 1) + (x + mPadding);
-				int pNextXPrevYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding - 1) + (x + mPadding + 1);
-				int pPrevXNextYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding + 1) + (x + mPadding - 1);
-
-				Ogre::Vector3 thisVertex = vertexPosition[pIndex];
-				Ogre::Vector3 nextXVertex = vertexPosition[pNextXIndex];
-				Ogre::Vector3 nextYVertex = vertexPosition[pNextYIndex];
-				Ogre::Vector3 prevXVertex = vertexPosition[pPrevXIndex];
-				Ogre::Vector3 prevYVertex = vertexPosition[pPrevYIndex];
-				Ogre::Vector3 nextXPrevYVertex = vertexPosition[pNextXPrevYIndex];
-				Ogre::Vector3 prevXNextYVertex = vertexPosition[pPrevXNextYIndex];
-
-				Ogre::Vector3 n1 = (nextXVertex - thisVertex).crossProduct(nextXPrevYVertex - thisVertex);
-				Ogre::Vector3 n2 = (nextXPrevYVertex - thisVertex).crossProduct(prevYVertex - thisVertex);
-				Ogre::Vector3 n3 = (prevYVertex - thisVertex).crossProduct(prevXVertex - thisVertex);
-				Ogre::Vector3 n4 = (prevXVertex - thisVertex).crossProduct(prevXNextYVertex - thisVertex);
-				Ogre::Vector3 n5 = (prevXNextYVertex - thisVertex).crossProduct(nextYVertex - thisVertex);
-				Ogre::Vector3 n6 = (nextYVertex - thisVertex).crossProduct(nextXVertex - thisVertex);
-
-				vertexNormal[index] = (n1 + n2 + n3 + n4 + n5 + n6).normalisedCopy();
-
-				//// 4-connected, no triangle-area correction
-				//int pIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding);
-				//int pNextXIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding + 1);
-				//int pNextYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding + 1) + (x + mPadding);
-				//int pPrevXIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding - 1);
-				//int pPrevYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding - 1) + (x + mPadding);
-				//int pNextXPrevYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding - 1) + (x + mPadding + 1);
-				//int pPrevXNextYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding + 1) + (x + mPadding - 1);
-
-				//Ogre::Vector3 thisVertex = vertexPosition[pIndex];
-				//Ogre::Vector3 nextXVertex = vertexPosition[pNextXIndex];
-				//Ogre::Vector3 nextYVertex = vertexPosition[pNextYIndex];
-				//Ogre::Vector3 prevXVertex = vertexPosition[pPrevXIndex];
-				//Ogre::Vector3 prevYVertex = vertexPosition[pPrevYIndex];
-				//Ogre::Vector3 nextXPrevYVertex = vertexPosition[pNextXPrevYIndex];
-				//Ogre::Vector3 prevXNextYVertex = vertexPosition[pPrevXNextYIndex];
-
-				//Ogre::Vector3 n1 = (nextXVertex - thisVertex).crossProduct(prevYVertex - thisVertex).normalisedCopy();
-				//Ogre::Vector3 n2 = (prevYVertex - thisVertex).crossProduct(prevXVertex - thisVertex).normalisedCopy();
-				//Ogre::Vector3 n3 = (prevXVertex - thisVertex).crossProduct(nextYVertex - thisVertex).normalisedCopy();
-				//Ogre::Vector3 n4 = (nextYVertex - thisVertex).crossProduct(nextXVertex - thisVertex).normalisedCopy();
-
-				//vertexNormal[index] = (n1 + n2 + n3 + n4).normalisedCopy();
-
-				// Texture coordinates (this is global planet texture coordinates)
-				Ogre::Real jx = ((Ogre::Real) x)/mQuads;
-				Ogre::Real jy = ((Ogre::Real) y)/mQuads;
-
-				textureCoordinate[index].x = (1 - jx) * mTexXMin + jx * mTexXMax;
-				textureCoordinate[index].y = (1 - jy) * mTexYMin + jy * mTexYMax;
-
-				// Interpolated position
-				if ((x % 2 != 0) && (y % 2 != 0))
-				{
-					// Odd x and y coordinate, this vertex doesn't exist in parent
-					// and must be geomorphed.
-
-					interpolatedVertexPosition[index] = 0.5 * nextXPrevYVertex + 0.5 * prevXNextYVertex;
-				}
-				else if (x % 2 != 0)
-				{
-					// Odd x coordinate, this vertex doesn't exist in parent
-					// and must be geomorphed
-					interpolatedVertexPosition[index] = 0.5 * nextXVertex + 0.5 * prevXVertex;
-				}
-				else if (y % 2 != 0)
-				{
-					// Odd y coordinate, this vertex doesn't exist in parent
-					// and must be geomorphed
-					interpolatedVertexPosition[index] = 0.5 * nextYVertex + 0.5 * prevYVertex;
-				}
-				else
-				{
-					// This vertex exists in parent, no morphing required
-					interpolatedVertexPosition[index] = thisVertex;
-				}
+				const float * v = vertices + PatchMeshKernel::FLOATS_PER_VERTEX * i;
+				mAABB.merge(Ogre::Vector3(v[0], v[1], v[2]));
 			}
 		}
 
-		// Calculate interpolated normals
-		// First we calculate normals for those vertices that also exist in
-		// parent LOD. We do this because these are then needed to calculate
-		// the interpolated normals for those vertices that do not exist
-		// in parent LOD level.
-		for (int y = 0; y < (mQuads + 1); y++)
+		if (mVertexFormat == VERTEX_FORMAT_PACKED)
 		{
-			for (int x = 0; x < (mQuads + 1); x++)
-			{
-				if ((x % 2 == 0) && (y % 2 == 0))
-				{
-					int index = (mQuads + 1) * y + x;
-
-					// 6-connected, with triangle-area correction
-					int pIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding);
-					int pNextXIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding + 2);
-					int pNextYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding + 2) + (x + mPadding);
-					int pPrevXIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding - 2);
-					int pPrevYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding - 2) + (x + mPadding);
-					int pNextXPrevYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding - 2) + (x + mPadding + 2);
-					int pPrevXNextYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding + 2) + (x + mPadding - 2);
-
-					Ogre::Vector3 thisVertex = vertexPosition[pIndex];
-					Ogre::Vector3 nextXVertex = vertexPosition[pNextXIndex];
-					Ogre::Vector3 nextYVertex = vertexPosition[pNextYIndex];
-					Ogre::Vector3 prevXVertex = vertexPosition[pPrevXIndex];
-					Ogre::Vector3 prevYVertex = vertexPosition[pPrevYIndex];
-					Ogre::Vector3 nextXPrevYVertex = vertexPosition[pNextXPrevYIndex];
-					Ogre::Vector3 prevXNextYVertex = vertexPosition[pPrevXNextYIndex];
-
-					Ogre::Vector3 n1 = (nextXVertex - thisVertex).crossProduct(nextXPrevYVertex - thisVertex);
-					Ogre::Vector3 n2 = (nextXPrevYVertex - thisVertex).crossProduct(prevYVertex - thisVertex);
-					Ogre::Vector3 n3 = (prevYVertex - thisVertex).crossProduct(prevXVertex - thisVertex);
-					Ogre::Vector3 n4 = (prevXVertex - thisVertex).crossProduct(prevXNextYVertex - thisVertex);
-					Ogre::Vector3 n5 = (prevXNextYVertex - thisVertex).crossProduct(nextYVertex - thisVertex);
-					Ogre::Vector3 n6 = (nextYVertex - thisVertex).crossProduct(nextXVertex - thisVertex);
-
-					interpolatedVertexNormal[index] = (n1 + n2 + n3 + n4 + n5 + n6).normalisedCopy();
-
-					//// 4-connected, no triangle-area correction
-					//int pIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding);
-					//int pNextXIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding + 2);
-					//int pNextYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding + 2) + (x + mPadding);
-					//int pPrevXIndex = (mQuads + 2*mPadding + 1) * (y + mPadding) + (x + mPadding - 2);
-					//int pPrevYIndex = (mQuads + 2*mPadding + 1) * (y + mPadding - 2) + (x + mPadding);
-
-					//Ogre::Vector3 thisVertex = vertexPosition[pIndex];
-					//Ogre::Vector3 nextXVertex = vertexPosition[pNextXIndex];
-					//Ogre::Vector3 nextYVertex = vertexPosition[pNextYIndex];
-					//Ogre::Vector3 prevXVertex = vertexPosition[pPrevXIndex];
-					//Ogre::Vector3 prevYVertex = vertexPosition[pPrevYIndex];
-
-					//Ogre::Vector3 n1 = (nextXVertex - thisVertex).crossProduct(prevYVertex - thisVertex).normalisedCopy();
-					//Ogre::Vector3 n2 = (prevYVertex - thisVertex).crossProduct(prevXVertex - thisVertex).normalisedCopy();
-					//Ogre::Vector3 n3 = (prevXVertex - thisVertex).crossProduct(nextYVertex - thisVertex).normalisedCopy();
-					//Ogre::Vector3 n4 = (nextYVertex - thisVertex).crossProduct(nextXVertex - thisVertex).normalisedCopy();
-
-					//interpolatedVertexNormal[index] = (n1 + n2 + n3 + n4).normalisedCopy();
-				}
-			}
+			mPackedVertices.resize(PatchMeshKernel::SHORTS_PER_PACKED_VERTEX * vertexCount);
+			PatchMeshKernel::packVertices(vertices, mQuads, mSkirts, &mPositionScale.x, &mPackedVertices[0]);
+		}
+		else if (mVertexFormat == VERTEX_FORMAT_HEIGHT)
+		{
+			mPackedVertices.resize(PatchMeshKernel::SHORTS_PER_HEIGHT_VERTEX * vertexCount);
+			PatchMeshKernel::packHeights(vertices,
+				&heights->values[0],
+				heights->offset,
+				heights->scale,
+				mQuads,
+				mPadding,
+				mMorphStep,
+				mSkirts,
+				skirtDepth,
+				mBaseRadius,
+				mScalingFactor,
+				&mRadiusScale.x,
+				&mPackedVertices[0]);
 		}
 
-		// Now we can calculate the interpolated normals for those
-		// vertices that do not exist in parent LOD level.
-		for (int y = 0; y < (mQuads + 1); y++)
+		if (isConstant())
 		{
-			for (int x = 0; x < (mQuads + 1); x++)
-			{
-				int index = (mQuads + 1) * y + x;
-
-				if ((x % 2 != 0) && (y % 2 != 0))
-				{
-					int prevXNextYIndex = (mQuads + 1) * (y + 1) + (x - 1);
-					int nextXPrevYIndex = (mQuads + 1) * (y - 1) + (x + 1);
-					interpolatedVertexNormal[index] = (0.5 * interpolatedVertexNormal[prevXNextYIndex] + 0.5 * (interpolatedVertexNormal[nextXPrevYIndex])).normalisedCopy();
-				}
-				else if (x % 2 != 0)
-				{
-					int prevXIndex = (mQuads + 1) * y + (x - 1);
-					int nextXIndex = (mQuads + 1) * y + (x + 1);
-					interpolatedVertexNormal[index] = (0.5 * interpolatedVertexNormal[prevXIndex] + 0.5 * (interpolatedVertexNormal[nextXIndex])).normalisedCopy();
-				}
-				else if (y % 2 != 0)
-				{
-					int prevYIndex = (mQuads + 1) * (y - 1) + x;
-					int nextYIndex = (mQuads + 1) * (y + 1) + x;
-					interpolatedVertexNormal[index] = (0.5 * interpolatedVertexNormal[prevYIndex] + 0.5 * (interpolatedVertexNormal[nextYIndex])).normalisedCopy();
-				}
-			}
+			// Keep it for the next patch in the same place
+			boost::shared_ptr<ConstantGeometry> geometry(new ConstantGeometry());
+			geometry->vertices.swap(mVertices);
+			geometry->packedVertices.swap(mPackedVertices);
+			geometry->center = mCenter;
+			geometry->aabb = mAABB;
+			geometry->positionScale = mPositionScale;
+			geometry->radiusScale = mRadiusScale;
+
+			mConstantGeometry = geometry;
+			msConstantGeometryCache.insert(getConstantGeometryKey(), mConstantGeometry);
 		}
 	}
 
@@ -935,105 +491,97 @@ namespace OgrePlanet
 		Ogre::VertexData * vertexData = meshPtr->sharedVertexData;
 
 		Ogre::VertexDeclaration * vertexDecl = vertexData->vertexDeclaration;
+		Ogre::VertexBufferBinding * binding = vertexData->vertexBufferBinding;
 		size_t currOffset = 0;
-		vertexDecl->addElement(0, currOffset, Ogre::VET_FLOAT3, Ogre::VES_POSITION);
-		currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+		// The stream holding this patch's vertex data
+		unsigned short source = 0;
+		const void * vertices;
 
-		vertexDecl->addElement(0, currOffset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL);
-		currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+		// Constant geometry is shared with the cache
+		const std::vector<float> & floatVertices = mConstantGeometry ? mConstantGeometry->vertices : mVertices;
+		const std::vector<Ogre::int16> & packedVertices = mConstantGeometry ? mConstantGeometry->packedVertices : mPackedVertices;
 
-		vertexDecl->addElement(0, currOffset, Ogre::VET_FLOAT4, Ogre::VES_TEXTURE_COORDINATES, 0);
-		currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT4);
+		if (mVertexFormat == VERTEX_FORMAT_HEIGHT)
+		{
+			// Grid x and y, shared by all patches
+			vertexDecl->addElement(0, 0, Ogre::VET_SHORT2, Ogre::VES_POSITION);
+			binding->setBinding(0, getGridVertexBuffer(mQuads, mSkirts));
 
-		// Interpolated vertex position used by geomorphing
-		vertexDecl->addElement(0, currOffset, Ogre::VET_FLOAT3, Ogre::VES_TEXTURE_COORDINATES, 1);
-		currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+			// Radius, geomorph radius delta and octahedral normal
+			source = 1;
+			vertexDecl->addElement(source, currOffset, Ogre::VET_SHORT4, Ogre::VES_TEXTURE_COORDINATES, 0);
+			currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_SHORT4);
 
-		// Interpolated normal used by geomorphing
-		vertexDecl->addElement(0, currOffset, Ogre::VET_FLOAT3, Ogre::VES_TEXTURE_COORDINATES, 2);
-		currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+			assert(vertexDecl->getVertexSize(source) == PatchMeshKernel::SHORTS_PER_HEIGHT_VERTEX * sizeof(Ogre::int16));
+			vertices = &packedVertices[0];
+		}
+		else if (mVertexFormat == VERTEX_FORMAT_PACKED)
+		{
+			// Position and grid x
+			vertexDecl->addElement(0, currOffset, Ogre::VET_SHORT4, Ogre::VES_POSITION);
+			currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_SHORT4);
 
-		vertexData->vertexCount = (mQuads + 1) * (mQuads + 1);
-		Ogre::HardwareVertexBufferSharedPtr vBuf =
-			Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
-			vertexDecl->getVertexSize(0),
-			vertexData->vertexCount,
-			Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
-		Ogre::VertexBufferBinding * binding = vertexData->vertexBufferBinding;
-		binding->setBinding(0, vBuf);
-		float * pVertex = static_cast<float *>(vBuf->lock(Ogre::HardwareBuffer::HBL_DISCARD));
-
-		subMeshPtr->indexData->indexCount = indexBuffer[0]->getNumIndexes();
-		subMeshPtr->indexData->indexBuffer = indexBuffer[0];
-
-		/*
-		subMeshPtr->indexData->indexCount = 6 * mQuads * mQuads;
-		subMeshPtr->indexData->indexBuffer =
-			Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(
-			Ogre::HardwareIndexBuffer::IT_16BIT,
-			subMeshPtr->indexData->indexCount,
-			Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
-		Ogre::HardwareIndexBufferSharedPtr iBuf = subMeshPtr->indexData->indexBuffer;
-		unsigned short * pIndices = static_cast<unsigned short *>(iBuf->lock(Ogre::HardwareBuffer::HBL_DISCARD));
-		*/
-
-		for (int y = 0; y < (mQuads + 1); y++)
+			// Octahedral normal and geomorph normal
+			vertexDecl->addElement(0, currOffset, Ogre::VET_SHORT4, Ogre::VES_NORMAL);
+			currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_SHORT4);
+
+			// Geomorph position delta and grid y
+			vertexDecl->addElement(0, currOffset, Ogre::VET_SHORT4, Ogre::VES_TEXTURE_COORDINATES, 1);
+			currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_SHORT4);
+
+			assert(vertexDecl->getVertexSize(0) == PatchMeshKernel::SHORTS_PER_PACKED_VERTEX * sizeof(Ogre::int16));
+			vertices = &packedVertices[0];
+		}
+		else
 		{
-			for (int x = 0; x < (mQuads + 1); x++)
-			{
-				int index1 = (mQuads + 2 * mPadding + 1) * (y + mPadding) + (x + mPadding);
-				int index2 = (mQuads + 1) * y + x;
-
-				// Vertex pos
-				*pVertex++ = vertexPosition[index1].x;
-				*pVertex++ = vertexPosition[index1].y;
-				*pVertex++ = vertexPosition[index1].z;
-
-				// Vertex normal
-				*pVertex++ = vertexNormal[index2].x;
-				*pVertex++ = vertexNormal[index2].y;
-				*pVertex++ = vertexNormal[index2].z;
-
-				// Texture coordinates (this is global planet texture coordinates)
-				*pVertex++ = textureCoordinate[index2].x;
-				*pVertex++ = textureCoordinate[index2].y;
-				*pVertex++ = (x == 0 ? 0.0 : (x == mQuads ? 1.0 : 0.5));
-				*pVertex++ = (y == 0 ? 0.0 : (y == mQuads ? 1.0 : 0.5));
-
-				// Interpolated position
-				*pVertex++ = interpolatedVertexPosition[index2].x;
-				*pVertex++ = interpolatedVertexPosition[index2].y;
-				*pVertex++ = interpolatedVertexPosition[index2].z;
-
-				// Interpolated normal
-				*pVertex++ = interpolatedVertexNormal[index2].x;
-				*pVertex++ = interpolatedVertexNormal[index2].y;
-				*pVertex++ = interpolatedVertexNormal[index2].z;
-
-				/*
-				if (x < mQuads && y < mQuads)
-				{
-					*pIndices++ = y * (mQuads + 1) + x;
-					*pIndices++ = (y + 1) * (mQuads + 1) + x;
-					*pIndices++ = y * (mQuads + 1) + x + 1;
-					*pIndices++ = (y + 1) * (mQuads + 1) + x;
-					*pIndices++ = (y + 1) * (mQuads + 1) + x + 1;
-					*pIndices++ = y * (mQuads + 1) + x + 1;
-				}
-				*/
-			}
+			vertexDecl->addElement(0, currOffset, Ogre::VET_FLOAT3, Ogre::VES_POSITION);
+			currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+
+			vertexDecl->addElement(0, currOffset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL);
+			currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+
+			vertexDecl->addElement(0, currOffset, Ogre::VET_FLOAT4, Ogre::VES_TEXTURE_COORDINATES, 0);
+			currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT4);
+
+			// Interpolated vertex position used by geomorphing
+			vertexDecl->addElement(0, currOffset, Ogre::VET_FLOAT3, Ogre::VES_TEXTURE_COORDINATES, 1);
+			currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+
+			// Interpolated normal used by geomorphing
+			vertexDecl->addElement(0, currOffset, Ogre::VET_FLOAT3, Ogre::VES_TEXTURE_COORDINATES, 2);
+			currOffset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+
+			assert(vertexDecl->getVertexSize(0) == PatchMeshKernel::FLOATS_PER_VERTEX * sizeof(float));
+			vertices = &floatVertices[0];
 		}
 
-		// Done with the data arrays, release them to conserve memory
-		mUnitSpherePos = boost::shared_array<Ogre::Vector3>(0);
-		vertexPosition = boost::shared_array<Ogre::Vector3>(0);
-		vertexNormal = boost::shared_array<Ogre::Vector3>(0);
-		textureCoordinate = boost::shared_array<Ogre::Vector2>(0);
-		interpolatedVertexPosition = boost::shared_array<Ogre::Vector3>(0);
-		interpolatedVertexNormal = boost::shared_array<Ogre::Vector3>(0);
+		// The vertices go into a slot of one of the pooled buffers, draws
+		// start at the slot's first vertex
+		VertexBufferPool * pool = getVertexBufferPool(mVertexFormat, getVertexCount(), true);
+		assert(pool->getVertexSize() == vertexDecl->getVertexSize(source));
+		if (mSlot.isNull())
+		{
+			mSlot = pool->allocate();
+		}
+
+		vertexData->vertexStart = mSlot.vertexStart;
+		vertexData->vertexCount = getVertexCount();
+		binding->setBinding(source, mSlot.buffer);
+
+		// Vertex data was built in prepareResource()
+		pool->write(mSlot, vertices);
 
-		vBuf->unlock();
-		//iBuf->unlock();
+		// Done with the vertex data, release it to conserve memory
+		std::vector<float>().swap(mVertices);
+		std::vector<Ogre::int16>().swap(mPackedVertices);
+		mConstantGeometry.reset();
+
+		// With stitching, Patch::updateStitching() picks the stitched
+		// index buffer once the neighbours are known
+		static const int levels[4] = { 0, 0, 0, 0 };
+		Ogre::HardwareIndexBufferSharedPtr indexBuffer = mSkirts ? getSkirtIndexBuffer(mQuads) : getIndexBuffer(mQuads, levels);
+		subMeshPtr->indexData->indexCount = indexBuffer->getNumIndexes();
+		subMeshPtr->indexData->indexBuffer = indexBuffer;
 		subMeshPtr->useSharedVertices = true;
 
 		meshPtr->_setBounds(mAABB);
@@ -1044,4 +592,43 @@ namespace OgrePlanet
 	{
 		return mBaseRadius;
 	}
+
+	ConstantGeometryCache::Key PatchMeshLoader::getConstantGeometryKey()
+	{
+		return ConstantGeometryCache::Key(mVertexFormat,
+			mSkirts,
+			CubeSphere::getMapping(),
+			mQuads,
+			mMorphStep,
+			mBaseRadius + mConstantHeight * mScalingFactor,
+			getMin(),
+			getMax(),
+			mTexXMin,
+			mTexXMax,
+			mTexYMin,
+			mTexYMax);
+	}
+
+	size_t PatchMeshLoader::getCpuSize()
+	{
+		return getHeightDataSize() +
+			mVertices.size() * sizeof(float) +
+			mPackedVertices.size() * sizeof(Ogre::int16);
+	}
+
+	size_t PatchMeshLoader::getGpuSize()
+	{
+		if (mSlot.isNull())
+		{
+			return 0;
+		}
+
+		VertexBufferPool * pool = getVertexBufferPool(mVertexFormat, getVertexCount(), false);
+		return pool->getSlotVertices() * pool->getVertexSize();
+	}
+
+	int PatchMeshLoader::getVertexCount() const
+	{
+		return (mQuads + 1) * (mQuads + 1) + (mSkirts ? SkirtIndices::getVertexCount(mQuads) : 0);
+	}
 }
\ No newline at end of file
@@ -23,9 +23,13 @@ THE SOFTWARE.
 #ifndef PATCHMESHLOADER_H
 #define PATCHMESHLOADER_H
 
+#include "OPConstantGeometryCache.h"
 #include "OPDataSource.h"
 #include "OPPatchMeshLoaderDestroyer.h"
 #include "OPHeightDataResourceLoader.h"
+#include "OPPatchMeshKernel.h"
+#include "OPStitching.h"
+#include "OPVertexBufferPool.h"
 
 namespace OgrePlanet
 {
@@ -34,46 +38,153 @@ namespace OgrePlanet
 	class PatchMeshLoader : public HeightDataResourceLoader
 	{
 	public:
-		static Ogre::HardwareIndexBufferSharedPtr indexBuffer[16];
-
-		static void init(int quads);
+		// Releases the shared buffers below
 		static void cleanup();
 
-		PatchMeshLoader(DataSource * dataSource,
+		// Triangles of a patch of quads x quads quads whose neighbours
+		// are levels[side] levels coarser, see StitchingIndices. The
+		// shared buffers are built on first use for each number of quads,
+		// only call these from the main thread.
+		static Ogre::HardwareIndexBufferSharedPtr getIndexBuffer(int quads, const int levels[4]);
+		// Triangles of a patch with skirts, see SkirtIndices
+		static Ogre::HardwareIndexBufferSharedPtr getSkirtIndexBuffer(int quads);
+		// Grid coordinates of the vertices, the stream shared by all
+		// patches using VERTEX_FORMAT_HEIGHT. Holds one grid per slot of
+		// a pooled vertex buffer.
+		static Ogre::HardwareVertexBufferSharedPtr getGridVertexBuffer(int quads, bool skirts);
+
+		// Bytes of vertex buffers allocated for all patches: the pooled
+		// buffers, whether their slots are in use or not, and the grids
+		static size_t getAllocatedGpuSize();
+		// Destroys the pooled buffers with no slots in use, returns how
+		// many bytes that freed
+		static size_t trimVertexBufferPools();
+
+		// Vertex layout used by loaders created after the call. Patches
+		// using VERTEX_FORMAT_PACKED or VERTEX_FORMAT_HEIGHT need a
+		// material whose vertex program unpacks them, see
+		// OPPackedVertex.hlsl.
+		static void setVertexFormat(VertexFormat format);
+		static VertexFormat getVertexFormat();
+
+		// How loaders created after the call hide cracks. With
+		// CRACK_HIDING_SKIRTS the meshes have skirts and keep the index
+		// buffer they are loaded with.
+		static void setCrackHiding(CrackHiding crackHiding);
+		static CrackHiding getCrackHiding();
+
+		// The loader has to be reset() before its mesh is prepared.
+		// Loaders are recycled along with their meshes, see
+		// PatchMeshLoaderQueue::acquireMesh().
+		PatchMeshLoader();
+		~PatchMeshLoader();
+		// Reinitialises the loader for a new patch, its mesh must be
+		// unloaded. The parent patch's vertices are morphStep of ours
+		// apart, see PatchMeshKernel::buildVertices.
+		void reset(DataSource * dataSource,
 			int quads,
-			Ogre::Vector3 & min,
-			Ogre::Vector3 & max,
+			int morphStep,
+			const Ogre::Vector3 & min,
+			const Ogre::Vector3 & max,
 			Ogre::Real texXMin,
 			Ogre::Real texXMax,
 			Ogre::Real texYMin,
 			Ogre::Real texYMax,
 			Ogre::Real baseRadius,
 			Ogre::Real scalingFactor,
-			Ogre::AxisAlignedBox & AABB,
-			boost::shared_array<Ogre::Real> data,
-			boost::shared_array<Ogre::Real> parentData = boost::shared_array<Ogre::Real>(),
+			const QuantizedHeights * parentData = 0,
 			int position = 0);
+		// Takes the geometry of a constant data source from the cache
+		// if it's there
 		void prepareResource(Ogre::Resource * resource);
 		void loadResource(Ogre::Resource * resource);
 		Ogre::Real getBaseRadius();
 		const Ogre::Vector3 & getCenter() { return mCenter; }
+		// Bounds of the mesh relative to getCenter(), once prepared
+		const Ogre::AxisAlignedBox & getAABB() { return mAABB; }
+		bool isPacked() { return mVertexFormat == VERTEX_FORMAT_PACKED; }
+		bool isHeightOnly() { return mVertexFormat == VERTEX_FORMAT_HEIGHT; }
+		bool hasSkirts() { return mSkirts; }
+		// Position scale (xyz) and geomorph delta scale (w) of a packed
+		// mesh, see PatchMeshKernel::packVertices
+		const Ogre::Vector4 & getPositionScale() { return mPositionScale; }
+		// Radius offset (x), radius scale (y) and geomorph delta scale
+		// (z) of a height only mesh, see PatchMeshKernel::packHeights
+		const Ogre::Vector4 & getRadiusScale() { return mRadiusScale; }
+
+		// Bytes of height and vertex data held on the CPU. Don't call it
+		// while the resource is being prepared.
+		size_t getCpuSize();
+		// Bytes of the vertex buffer slot, while the mesh is loaded. The
+		// buffer itself is only freed once all of its slots are, see
+		// getAllocatedGpuSize().
+		size_t getGpuSize();
+		// Returns the vertex buffer slot to its pool. The destructor
+		// does it too, but a loader that is deleted on another thread
+		// must have it released on the main thread first.
+		void releaseSlot();
+		// Releases the slot and frees the height and vertex data, for a
+		// loader waiting to be reset()
+		void clear();
 
 	protected:
-		boost::shared_array<Ogre::Vector3> vertexPosition;
-		boost::shared_array<Ogre::Vector3> vertexNormal;
-		boost::shared_array<Ogre::Vector2> textureCoordinate;
-		boost::shared_array<Ogre::Vector3> interpolatedVertexPosition;
-		boost::shared_array<Ogre::Vector3> interpolatedVertexNormal;
+		void prepareGeometry(Ogre::Resource * resource,
+			const float * xs,
+			const float * ys,
+			const float * zs);
 
 	private:
-		const Ogre::Real mBaseRadius;
-		const Ogre::Real mScalingFactor;
-		Ogre::AxisAlignedBox & mAABB;
+		// How far skirts reach below the lowest edge vertex, relative to
+		// the length of an edge
+		static const Ogre::Real SKIRT_MARGIN;
+
+		// Vertex buffer slots for a format and number of vertices
+		static VertexBufferPool * getVertexBufferPool(VertexFormat format, int vertexCount, bool create);
+		// Reorders the indices for the vertex cache and uploads them
+		static Ogre::HardwareIndexBufferSharedPtr createIndexBuffer(std::vector<Ogre::uint32> & indices,
+			int vertexCount,
+			const Ogre::String & description);
+
+		// Vertices of this loader's meshes, including any skirts
+		int getVertexCount() const;
+		// Where the geometry of a constant data source is cached
+		ConstantGeometryCache::Key getConstantGeometryKey();
+
+		// By quads, then StitchingIndices::getKey()
+		static std::map<int, std::vector<Ogre::HardwareIndexBufferSharedPtr> > msIndexBuffers;
+		// By quads
+		static std::map<int, Ogre::HardwareIndexBufferSharedPtr> msSkirtIndexBuffers;
+		// By vertex count
+		static std::map<int, Ogre::HardwareVertexBufferSharedPtr> msGridVertexBuffers;
+		static std::map<std::pair<VertexFormat, int>, VertexBufferPool *> msVertexBufferPools;
+		static VertexFormat msVertexFormat;
+		static CrackHiding msCrackHiding;
+		// Geometry of patches with a constant data source
+		static ConstantGeometryCache msConstantGeometryCache;
+
+		VertexFormat mVertexFormat;
+		bool mSkirts;
+		Ogre::Real mBaseRadius;
+		Ogre::Real mScalingFactor;
+		Ogre::AxisAlignedBox mAABB;
 		Ogre::Real mTexXMin;
 		Ogre::Real mTexXMax;
 		Ogre::Real mTexYMin;
 		Ogre::Real mTexYMax;
+		int mMorphStep;
 		Ogre::Vector3 mCenter;
+		Ogre::Vector4 mPositionScale;
+		Ogre::Vector4 mRadiusScale;
+		// Vertex data, floats or shorts depending on the format, from
+		// prepareResource() until loadResource() has copied it into the
+		// vertex buffer
+		std::vector<float> mVertices;
+		std::vector<Ogre::int16> mPackedVertices;
+		// Used instead of the vectors above when the data source is
+		// constant, until loadResource()
+		ConstantGeometryPtr mConstantGeometry;
+		// Where the vertices live once loaded
+		VertexBufferPool::Slot mSlot;
 	};
 }
 
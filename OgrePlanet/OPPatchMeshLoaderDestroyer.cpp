@@ -26,6 +26,39 @@ THE SOFTWARE.
 
 namespace OgrePlanet
 {
+	PatchMeshLoaderDestroyer::PatchMeshLoaderDestroyer() :
+	mEnabled(false),
+		mChannel(Ogre::Root::getSingleton().getWorkQueue()->getChannel(getChannelName()))
+	{
+	}
+
+	void PatchMeshLoaderDestroyer::setEnabled(bool enabled)
+	{
+		mEnabled = enabled;
+	}
+
+	bool PatchMeshLoaderDestroyer::isEnabled()
+	{
+		return mEnabled;
+	}
+
+	void PatchMeshLoaderDestroyer::destroy(const LoaderList & loaders)
+	{
+		if (loaders.empty())
+		{
+			return;
+		}
+
+		if (mEnabled)
+		{
+			Ogre::Root::getSingleton().getWorkQueue()->addRequest(mChannel, 0, Ogre::Any(loaders));
+		}
+		else
+		{
+			deleteLoaders(loaders);
+		}
+	}
+
 	bool PatchMeshLoaderDestroyer::canHandleRequest(const Ogre::WorkQueue::Request * req, const Ogre::WorkQueue * srcQ)
 	{
 		return true;
@@ -33,7 +66,7 @@ namespace OgrePlanet
 
 	Ogre::WorkQueue::Response * PatchMeshLoaderDestroyer::handleRequest(const Ogre::WorkQueue::Request * req, const Ogre::WorkQueue * srcQ)
 	{
-		delete Ogre::any_cast<PatchMeshLoader *>(req->getData());
+		deleteLoaders(Ogre::any_cast<LoaderList>(req->getData()));
 		return 0;
 	}
 
@@ -45,4 +78,17 @@ namespace OgrePlanet
 	void PatchMeshLoaderDestroyer::handleResponse(const Ogre::WorkQueue::Response * res, const Ogre::WorkQueue * srcQ)
 	{
 	}
+
+	Ogre::String PatchMeshLoaderDestroyer::getChannelName()
+	{
+		return "PatchMeshLoaderDestroyerChannel";
+	}
+
+	void PatchMeshLoaderDestroyer::deleteLoaders(const LoaderList & loaders)
+	{
+		for (LoaderList::const_iterator i = loaders.begin(); i != loaders.end(); ++i)
+		{
+			delete *i;
+		}
+	}
 }
\ No newline at end of file
@@ -25,17 +25,46 @@ THE SOFTWARE.
 
 #include <Ogre.h>
 
+#include <vector>
+
 namespace OgrePlanet
 {
+	class PatchMeshLoader;
+
+	// Deletes loaders that PatchMeshLoaderQueue has found no worker can
+	// still be using, in bulk on one of the WorkQueue's worker threads,
+	// so freeing their height and vertex data doesn't cost the frame.
 	class PatchMeshLoaderDestroyer :
 		public Ogre::WorkQueue::RequestHandler,
 		public Ogre::WorkQueue::ResponseHandler
 	{
 	public:
+		typedef std::vector<PatchMeshLoader *> LoaderList;
+
+		PatchMeshLoaderDestroyer();
+
+		// Must be called after the handlers have been registered with the
+		// WorkQueue. Only enable it if the WorkQueue has a worker thread
+		// to spare (PatchMeshLoaderQueue occupies one permanently),
+		// otherwise loaders are deleted on the calling thread.
+		void setEnabled(bool enabled);
+		bool isEnabled();
+
+		// Their vertex buffer slots must have been released already,
+		// see PatchMeshLoader::releaseSlot()
+		void destroy(const LoaderList & loaders);
+
 		bool canHandleRequest(const Ogre::WorkQueue::Request * req, const Ogre::WorkQueue * srcQ);
 		Ogre::WorkQueue::Response * handleRequest(const Ogre::WorkQueue::Request * req, const Ogre::WorkQueue * srcQ);
 		bool canHandleResponse(const Ogre::WorkQueue::Response * res, const Ogre::WorkQueue * srcQ);
 		void handleResponse(const Ogre::WorkQueue::Response * res, const Ogre::WorkQueue * srcQ);
+		Ogre::String getChannelName();
+
+	private:
+		static void deleteLoaders(const LoaderList & loaders);
+
+		bool mEnabled;
+		Ogre::uint16 mChannel;
  	};
 }
 
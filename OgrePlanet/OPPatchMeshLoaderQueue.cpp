@@ -21,6 +21,9 @@ THE SOFTWARE.
 */
 
 #include "OPPatchMeshLoaderQueue.h"
+#include "OPCubeSphereKernel.h"
+
+#include <boost/bind.hpp>
 
 template<> OgrePlanet::PatchMeshLoaderQueue* Ogre::Singleton<OgrePlanet::PatchMeshLoaderQueue>::ms_Singleton = 0;
 
@@ -38,9 +41,20 @@ namespace OgrePlanet
 
 	PatchMeshLoaderQueue::PatchMeshLoaderQueue() :
 		mMaxDepth(-1),
-		mAbort(false)
+		mAbort(false),
+		mMaxIORequests(4),
+		mIORequests(0),
+		mEpoch(0),
+		mDestroyer(0),
+		mMeshPoolSize(1024)
 	{}
 
+	void PatchMeshLoaderQueue::setMaxIORequests(int maxIORequests)
+	{
+		OGRE_LOCK_MUTEX(ioMutex)
+		mMaxIORequests = maxIORequests;
+	}
+
 	void PatchMeshLoaderQueue::setCameraPosition(const Ogre::Vector3 & pos)
 	{
 		OGRE_LOCK_MUTEX(cameraPosMutex)
@@ -50,8 +64,8 @@ namespace OgrePlanet
 	void PatchMeshLoaderQueue::prepareMesh(Ogre::MeshPtr mesh, PatchMeshLoader * patchMeshLoader)
 	{
 		Ogre::Real baseRadius = patchMeshLoader->getBaseRadius();
-		Ogre::Vector3 min = baseRadius * patchMeshLoader->getMin().normalisedCopy();
-		Ogre::Vector3 max = baseRadius * patchMeshLoader->getMax().normalisedCopy();
+		Ogre::Vector3 min = baseRadius * CubeSphere::project(patchMeshLoader->getMin());
+		Ogre::Vector3 max = baseRadius * CubeSphere::project(patchMeshLoader->getMax());
 		AxisAlignedBoxPtr aabbPtr = AxisAlignedBoxPtr(new Ogre::AxisAlignedBox(
 			std::min(min.x, max.x),
 			std::min(min.y, max.y),
@@ -110,29 +124,61 @@ namespace OgrePlanet
 
 			updatePrepMeshSet();
 
-			OGRE_LOCK_MUTEX(queueMutex)
-
-			// Resort every second
-			if (timer.getMilliseconds() > 1000)
+			while (true)
 			{
-				Ogre::Vector3 camPos;
+				MeshPairPtr meshPairPtr;
+				unsigned long jobEpoch;
+
 				{
-					OGRE_LOCK_MUTEX(cameraPosMutex)
-					camPos = mCameraPos;
-				}
-				mMeshQueue.sort(Sorter(this, camPos));
-				timer.reset();
-			}
+					// Only held while taking a mesh, so retireMesh() doesn't
+					// have to wait for the mesh being prepared
+					OGRE_LOCK_MUTEX(queueMutex)
 
-			while (mMeshQueue.size() > 0)
-			{
+					// Resort every second
+					if (timer.getMilliseconds() > 1000)
+					{
+						Ogre::Vector3 camPos;
+						{
+							OGRE_LOCK_MUTEX(cameraPosMutex)
+							camPos = mCameraPos;
+						}
+						mMeshQueue.sort(Sorter(this, camPos));
+						timer.reset();
+					}
+
+					if (mMeshQueue.empty())
+					{
+						break;
+					}
+
+					meshPairPtr = mMeshQueue.front();
+					mMeshQueue.pop_front();
+
+					// Before letting go of the queue, so the mesh can't be
+					// retired and freed in between
+					jobEpoch = beginJob();
+				}
 
-				MeshPairPtr meshPairPtr = mMeshQueue.front();
-				mMeshQueue.pop_front();
 				Ogre::MeshPtr mesh = meshPairPtr->first;
 				PatchMeshLoader * meshLoader = meshPairPtr->second->first;
 
-				mesh->prepare(true);
+				if (meshLoader->needsHeightDataRequest())
+				{
+					// The height data has to be read from disk. Start reading
+					// it and carry on with other patches in the meantime. The
+					// patch is put back in the queue once its data is available.
+					requestHeightData(meshPairPtr, jobEpoch);
+				}
+				else
+				{
+					mesh->prepare(true);
+				}
+
+				// Our references have to go before the job ends, the mesh
+				// is only unloaded by reclaim()
+				mesh.setNull();
+				meshPairPtr.reset();
+				endJob(jobEpoch);
 
 				OGRE_LOCK_MUTEX(abortMutex)
 				if (mAbort)
@@ -145,6 +191,263 @@ namespace OgrePlanet
 		return 0;
 	}
 
+	void PatchMeshLoaderQueue::requestHeightData(MeshPairPtr meshPairPtr, unsigned long jobEpoch)
+	{
+		{
+			OGRE_LOCK_MUTEX(ioMutex)
+			if (mIORequests >= mMaxIORequests)
+			{
+				// Too many reads in flight already, wait for one to finish
+				mIOWaitQueue.push_back(meshPairPtr);
+				return;
+			}
+
+			mIORequests++;
+		}
+
+		// The loader's height data is written until the read completes,
+		// so the read carries on the job it was started by. A new epoch
+		// would let reclaim() free what was retired since then.
+		continueJob(jobEpoch);
+		PatchMeshLoader * meshLoader = meshPairPtr->second->first;
+		meshLoader->requestHeightData(boost::bind(&PatchMeshLoaderQueue::heightDataReady, this, meshPairPtr, jobEpoch));
+	}
+
+	void PatchMeshLoaderQueue::heightDataReady(MeshPairPtr meshPairPtr, unsigned long jobEpoch)
+	{
+		{
+			// Both locks at once, so retireMesh() sees the next waiting
+			// patch either in the wait queue or in the buffer
+			OGRE_LOCK_MUTEX_NAMED(ioMutex, ioMutexLock)
+			OGRE_LOCK_MUTEX_NAMED(meshBufferMutex, meshBufferMutexLock)
+			mIORequests--;
+
+			bool retired;
+			{
+				OGRE_LOCK_MUTEX(epochMutex)
+				retired = mRetiredLoaders.count(meshPairPtr->second->first) > 0;
+			}
+
+			if (!retired)
+			{
+				mMeshBuffer.push_back(meshPairPtr);
+			}
+
+			if (!mIOWaitQueue.empty())
+			{
+				// Let the next waiting patch start reading
+				mMeshBuffer.push_back(mIOWaitQueue.front());
+				mIOWaitQueue.pop_front();
+			}
+
+			OGRE_THREAD_NOTIFY_ALL(meshBufferSync)
+		}
+
+		meshPairPtr.reset();
+		endJob(jobEpoch);
+	}
+
+	unsigned long PatchMeshLoaderQueue::beginJob()
+	{
+		OGRE_LOCK_MUTEX(epochMutex)
+		mJobEpochs.insert(mEpoch);
+		return mEpoch;
+	}
+
+	void PatchMeshLoaderQueue::continueJob(unsigned long jobEpoch)
+	{
+		OGRE_LOCK_MUTEX(epochMutex)
+		mJobEpochs.insert(jobEpoch);
+	}
+
+	void PatchMeshLoaderQueue::endJob(unsigned long jobEpoch)
+	{
+		OGRE_LOCK_MUTEX(epochMutex)
+		mJobEpochs.erase(mJobEpochs.find(jobEpoch));
+		OGRE_THREAD_NOTIFY_ALL(jobSync)
+	}
+
+	void PatchMeshLoaderQueue::setDestroyer(PatchMeshLoaderDestroyer * destroyer)
+	{
+		mDestroyer = destroyer;
+	}
+
+	void PatchMeshLoaderQueue::setMeshPoolSize(size_t size)
+	{
+		mMeshPoolSize = size;
+	}
+
+	void PatchMeshLoaderQueue::acquireMesh(Ogre::MeshPtr & mesh, PatchMeshLoader *& patchMeshLoader)
+	{
+		if (!mMeshPool.empty())
+		{
+			mesh = mMeshPool.back().first;
+			patchMeshLoader = mMeshPool.back().second;
+			mMeshPool.pop_back();
+			return;
+		}
+
+		// A mesh keeps the loader it is created with, so they are
+		// recycled together
+		patchMeshLoader = new PatchMeshLoader();
+		mesh = Ogre::MeshPtr(OGRE_NEW Ogre::Mesh(Ogre::MeshManager::getSingletonPtr(),
+			"OgrePlanet/PatchMesh",
+			0,
+			Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
+			true,
+			patchMeshLoader));
+	}
+
+	void PatchMeshLoaderQueue::retireMesh(Ogre::MeshPtr mesh, PatchMeshLoader * patchMeshLoader)
+	{
+		OGRE_LOCK_MUTEX_NAMED(ioMutex, ioMutexLock)
+		OGRE_LOCK_MUTEX_NAMED(meshBufferMutex, meshBufferMutexLock)
+		OGRE_LOCK_MUTEX_NAMED(queueMutex, queueMutexLock)
+
+		// No job can pick it up after this
+		removeQueued(patchMeshLoader);
+
+		OGRE_LOCK_MUTEX(epochMutex)
+		RetiredMesh retired;
+		retired.mesh = mesh;
+		retired.loader = patchMeshLoader;
+		retired.epoch = mEpoch;
+		mRetiredMeshes.push_back(retired);
+		mRetiredLoaders.insert(patchMeshLoader);
+	}
+
+	void PatchMeshLoaderQueue::removeQueued(PatchMeshLoader * patchMeshLoader)
+	{
+		MeshQueue * queues[3] = { &mIOWaitQueue, &mMeshBuffer, &mMeshQueue };
+		for (int i = 0; i < 3; i++)
+		{
+			MeshQueue::iterator iter = queues[i]->begin();
+			while (iter != queues[i]->end())
+			{
+				if ((*iter)->second->first == patchMeshLoader)
+				{
+					queues[i]->erase(iter++);
+				}
+				else
+				{
+					iter++;
+				}
+			}
+		}
+	}
+
+	void PatchMeshLoaderQueue::reclaim()
+	{
+		std::vector<RetiredMesh> unused;
+
+		{
+			OGRE_LOCK_MUTEX(epochMutex)
+
+			// Anything retired before the oldest running job started can't
+			// be used by any job
+			unsigned long oldestJob = mJobEpochs.empty() ? mEpoch + 1 : *mJobEpochs.begin();
+
+			std::vector<RetiredMesh>::iterator kept = mRetiredMeshes.begin();
+			for (std::vector<RetiredMesh>::iterator i = mRetiredMeshes.begin(); i != mRetiredMeshes.end(); ++i)
+			{
+				if (i->epoch < oldestJob)
+				{
+					unused.push_back(*i);
+					mRetiredLoaders.erase(i->loader);
+				}
+				else
+				{
+					*kept++ = *i;
+				}
+			}
+			mRetiredMeshes.erase(kept, mRetiredMeshes.end());
+
+			mEpoch++;
+		}
+
+		freeRetired(unused);
+	}
+
+	void PatchMeshLoaderQueue::reclaimAll()
+	{
+		std::vector<RetiredMesh> unused;
+
+		{
+			OGRE_LOCK_MUTEX_NAMED(epochMutex, epochMutexLock)
+			while (!mJobEpochs.empty())
+			{
+				OGRE_THREAD_WAIT(jobSync, epochMutex, epochMutexLock)
+			}
+
+			unused.swap(mRetiredMeshes);
+			mRetiredLoaders.clear();
+		}
+
+		size_t poolSize = mMeshPoolSize;
+		mMeshPoolSize = 0;
+		freeRetired(unused);
+		mMeshPoolSize = poolSize;
+
+		// Unloaded already
+		PatchMeshLoaderDestroyer::LoaderList loaders;
+		for (size_t i = 0; i < mMeshPool.size(); i++)
+		{
+			loaders.push_back(mMeshPool[i].second);
+		}
+		mMeshPool.clear();
+		destroyLoaders(loaders);
+	}
+
+	void PatchMeshLoaderQueue::freeRetired(std::vector<RetiredMesh> & retired)
+	{
+		if (retired.empty())
+		{
+			return;
+		}
+
+		// Hardware buffers are only touched on this thread, the
+		// loaders' height and vertex data can go anywhere
+		PatchMeshLoaderDestroyer::LoaderList loaders;
+		for (std::vector<RetiredMesh>::iterator i = retired.begin(); i != retired.end(); ++i)
+		{
+			i->mesh->unload();
+
+			if (mMeshPool.size() < mMeshPoolSize)
+			{
+				i->loader->clear();
+				mMeshPool.push_back(std::make_pair(i->mesh, i->loader));
+			}
+			else
+			{
+				i->loader->releaseSlot();
+				loaders.push_back(i->loader);
+			}
+			i->mesh.setNull();
+		}
+
+		destroyLoaders(loaders);
+	}
+
+	void PatchMeshLoaderQueue::destroyLoaders(PatchMeshLoaderDestroyer::LoaderList & loaders)
+	{
+		if (loaders.empty())
+		{
+			return;
+		}
+
+		if (mDestroyer)
+		{
+			mDestroyer->destroy(loaders);
+		}
+		else
+		{
+			for (PatchMeshLoaderDestroyer::LoaderList::iterator i = loaders.begin(); i != loaders.end(); ++i)
+			{
+				delete *i;
+			}
+		}
+	}
+
 	void PatchMeshLoaderQueue::handleResponse(const Ogre::WorkQueue::Response * res, const Ogre::WorkQueue * srcQ)
 	{
 	}
@@ -179,6 +482,22 @@ namespace OgrePlanet
 			}
 		}
 
+		// Maybe it's waiting for its turn to read height data
+		{
+			OGRE_LOCK_MUTEX(ioMutex)
+			MeshQueue::iterator ioWaitIter = mIOWaitQueue.begin();
+			while (ioWaitIter != mIOWaitQueue.end())
+			{
+				if ((*ioWaitIter)->first == mesh)
+				{
+					mIOWaitQueue.erase(ioWaitIter);
+					return;
+				}
+
+				ioWaitIter++;
+			}
+		}
+
 		// Not in the queue, tell resourceQueue to abort it
 		OGRE_LOCK_MUTEX(prepMeshMutex)
 		PrepMeshSet::iterator prepMeshIter = mPrepMeshSet.begin();
@@ -24,6 +24,7 @@ THE SOFTWARE.
 #define PATCHMESHLOADERQUEUE_H
 
 #include "OPPatchMeshLoader.h"
+#include "OPPatchMeshLoaderDestroyer.h"
 
 #include "OPUtil.h"
 
@@ -31,6 +32,9 @@ THE SOFTWARE.
 
 #include <boost/shared_ptr.hpp>
 
+#include <set>
+#include <vector>
+
 namespace OgrePlanet
 {
 	typedef boost::shared_ptr<Ogre::AxisAlignedBox> AxisAlignedBoxPtr;
@@ -63,6 +67,33 @@ namespace OgrePlanet
 		Ogre::String getChannelName();
 		void abortPrepareMesh(Ogre::MeshPtr mesh);
 		void setAbort();
+		void setMaxIORequests(int maxIORequests);
+
+		// A mesh for a new patch and its loader, which has to be reset()
+		// before the mesh is prepared. Reclaimed meshes are reused if
+		// there are any. The meshes aren't registered with the
+		// MeshManager, there is no name to look them up by. Main thread
+		// only.
+		void acquireMesh(Ogre::MeshPtr & mesh, PatchMeshLoader *& patchMeshLoader);
+		// Takes over a mesh and its loader from a patch that is going
+		// away. They are freed by reclaim() once no job that may be
+		// using them (preparing the mesh or reading its height data) is
+		// still running. Main thread only, never waits for a worker.
+		void retireMesh(Ogre::MeshPtr mesh, PatchMeshLoader * patchMeshLoader);
+		// Frees what was retired before the oldest running job started,
+		// and starts a new epoch. The meshes are unloaded here and kept
+		// for acquireMesh(), up to the pool size. The loaders of the rest
+		// are handed to the destroyer. Call it once a frame from the
+		// main thread.
+		void reclaim();
+		// Waits for every job to finish and frees everything retired
+		// and pooled, for shutting down after setAbort()
+		void reclaimAll();
+		// How many reclaimed meshes are kept for reuse
+		void setMeshPoolSize(size_t size);
+		// Where reclaim() sends the loaders, they are deleted on the
+		// main thread without one
+		void setDestroyer(PatchMeshLoaderDestroyer * destroyer);
 
 	private:
 		friend class Sorter;
@@ -70,20 +101,63 @@ namespace OgrePlanet
 		int mMaxDepth;
 		bool mAbort;
 		Ogre::Vector3 mCameraPos;
+		int mMaxIORequests;
+		int mIORequests;
+
+		// A mesh and loader waiting to be freed, and the epoch they were
+		// retired in
+		struct RetiredMesh
+		{
+			Ogre::MeshPtr mesh;
+			PatchMeshLoader * loader;
+			unsigned long epoch;
+		};
+
+		// Incremented by reclaim()
+		unsigned long mEpoch;
+		// The epochs the running jobs started in, each job keeps what
+		// was retired in or after its epoch from being freed
+		std::multiset<unsigned long> mJobEpochs;
+		std::vector<RetiredMesh> mRetiredMeshes;
+		// The loaders of mRetiredMeshes, so height data that arrives for
+		// one isn't queued again
+		std::set<PatchMeshLoader *> mRetiredLoaders;
+		PatchMeshLoaderDestroyer * mDestroyer;
+		// Unloaded meshes and their loaders, see acquireMesh()
+		std::vector<std::pair<Ogre::MeshPtr, PatchMeshLoader *> > mMeshPool;
+		size_t mMeshPoolSize;
 
 		OGRE_MUTEX(abortMutex)
 		OGRE_MUTEX(prepMeshMutex)
 		OGRE_MUTEX(queueMutex)
 		OGRE_MUTEX(cameraPosMutex)
 		OGRE_MUTEX(meshBufferMutex)
+		OGRE_MUTEX(ioMutex)
+		OGRE_MUTEX(epochMutex)
 
 		OGRE_THREAD_SYNCHRONISER(meshBufferSync)
+		OGRE_THREAD_SYNCHRONISER(jobSync)
 
 		MeshQueue mMeshQueue;
 		MeshQueue mMeshBuffer;
 		PrepMeshSet mPrepMeshSet;
+		MeshQueue mIOWaitQueue;
 
 		void updatePrepMeshSet();
+		void requestHeightData(MeshPairPtr meshPairPtr, unsigned long jobEpoch);
+		void heightDataReady(MeshPairPtr meshPairPtr, unsigned long jobEpoch);
+		// Returns the epoch to pass to endJob()
+		unsigned long beginJob();
+		// For work that outlives the job that started it, and has to be
+		// ended with endJob() as well
+		void continueJob(unsigned long jobEpoch);
+		void endJob(unsigned long jobEpoch);
+		// Removes a patch's mesh from the queues, the caller holds
+		// ioMutex, meshBufferMutex and queueMutex (in that order)
+		void removeQueued(PatchMeshLoader * patchMeshLoader);
+		void freeRetired(std::vector<RetiredMesh> & retired);
+		// Through the destroyer if there is one
+		void destroyLoaders(PatchMeshLoaderDestroyer::LoaderList & loaders);
 
 		class Sorter
 		{
@@ -0,0 +1,73 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPPatchResolution.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace OgrePlanet
+{
+	PatchResolution::PatchResolution(int quads)
+	{
+		setQuads(0, quads);
+	}
+
+	void PatchResolution::setQuads(int depth, int quads)
+	{
+		assert(quads >= MIN_QUADS && quads <= MAX_QUADS && (quads & (quads - 1)) == 0);
+		assert(depth == 0 || 2 * quads >= getQuads(depth - 1));
+
+		if (mQuads.size() < (size_t) depth)
+		{
+			mQuads.resize(depth, mQuads.back());
+		}
+
+		mQuads.resize(depth + 1);
+		mQuads[depth] = quads;
+	}
+
+	int PatchResolution::getQuads(int depth) const
+	{
+		return mQuads[std::min((size_t) depth, mQuads.size() - 1)];
+	}
+
+	int PatchResolution::getLevelDifference(int depth, int coarserDepth) const
+	{
+		return depth - coarserDepth + log2(getQuads(depth)) - log2(getQuads(coarserDepth));
+	}
+
+	int PatchResolution::getMorphStep(int depth) const
+	{
+		return (depth == 0 ? 2 : 1 << getLevelDifference(depth, depth - 1));
+	}
+
+	int PatchResolution::log2(int quads)
+	{
+		int level = 0;
+		while (quads > 1) {
+			quads >>= 1;
+			level++;
+		}
+		return level;
+	}
+}
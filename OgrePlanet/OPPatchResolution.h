@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef PATCHRESOLUTION_H
+#define PATCHRESOLUTION_H
+
+#include <vector>
+
+namespace OgrePlanet
+{
+	// Quads along the side of a patch, by depth, for one layer of a
+	// planet. More quads mean fewer, larger patches and so fewer draw
+	// calls, at a higher cost per patch.
+	//
+	// Quads are powers of two from MIN_QUADS to MAX_QUADS. Going one
+	// level deeper the quads may at most halve, so a patch's vertices are
+	// never further apart than its parent's; that keeps the level
+	// differences stitching deals with positive. The geomorph targets
+	// are built with the parent's real vertex spacing, see
+	// getMorphStep().
+	class PatchResolution
+	{
+	public:
+		static const int MIN_QUADS = 16;
+		static const int MAX_QUADS = 256;
+
+		explicit PatchResolution(int quads = 32);
+
+		// Use quads for depth and everything deeper
+		void setQuads(int depth, int quads);
+		int getQuads(int depth) const;
+
+		// How many times further apart the vertices of a patch at
+		// coarserDepth are than those of one at depth, as a power of two
+		int getLevelDifference(int depth, int coarserDepth) const;
+		// How many vertices apart the parent's vertices are in a patch at
+		// depth. Root patches morph as if their parent had the same
+		// quads.
+		int getMorphStep(int depth) const;
+
+	private:
+		static int log2(int quads);
+
+		// By depth, the last entry is used for everything deeper
+		std::vector<int> mQuads;
+	};
+}
+
+#endif // PATCHRESOLUTION_H
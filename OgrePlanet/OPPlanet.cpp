@@ -22,10 +22,13 @@ THE SOFTWARE.
 
 #include "OPPlanet.h"
 #include "OPIdentityDataSource.h"
+#include "OPPatchMeshLoaderQueue.h"
 #include "OPUtil.h"
 
 #include "boost/lexical_cast.hpp"
 
+#include <algorithm>
+
 namespace OgrePlanet
 {
 	Planet::Planet(
@@ -33,18 +36,43 @@ namespace OgrePlanet
 		Ogre::SceneNode * sceneNode,
 		const Ogre::Real baseRadius,
 		const Ogre::Real scalingFactor,
-		DataSource * dataSource) :
+		DataSource * dataSource,
+		const PatchResolution & surfaceResolution,
+		const PatchResolution & oceanResolution,
+		const PatchResolution & skyResolution) :
 	mMgr(mgr),
 		mSceneNode(sceneNode),
 		mBaseRadius(baseRadius),
 		mScalingFactor(scalingFactor),
+		mSubmergedMargin(0.05 * scalingFactor),
 		mDataSource(dataSource),
 		mIdentityDataSource(new IdentityDataSource()),
 		mResolution(1),
 		mRepetition(0),
-		mStaticGeometry(0)
+		mSurfaceResolution(surfaceResolution),
+		mOceanResolution(oceanResolution),
+		mSkyResolution(skyResolution)
 	{
-		Ogre::MaterialPtr baseMaterial = Ogre::MaterialManager::getSingleton().getByName("OgrePlanet/TerrainPhong");
+		// Draws all shown patches, see OPPlanetRenderable.h
+		mPlanetRenderable = new PlanetRenderable("PlanetRenderable");
+		mSceneNode->attachObject(mPlanetRenderable);
+
+		// Packed and height only patch vertices need the materials that
+		// unpack them
+		Ogre::String materialSuffix;
+		switch (PatchMeshLoader::getVertexFormat())
+		{
+		case VERTEX_FORMAT_PACKED:
+			materialSuffix = "Packed";
+			break;
+		case VERTEX_FORMAT_HEIGHT:
+			materialSuffix = "Height";
+			break;
+		default:
+			break;
+		}
+
+		Ogre::MaterialPtr baseMaterial = Ogre::MaterialManager::getSingleton().getByName("OgrePlanet/TerrainPhong" + materialSuffix);
 		//Ogre::MaterialPtr baseMaterial = Ogre::MaterialManager::getSingleton().getByName("OgrePlanet/Sun");
 
 		mRightMin = Ogre::Vector3(1.0, 1.0, 1.0);
@@ -54,8 +82,7 @@ namespace OgrePlanet
 		mSurfaceSide[0] = new Patch(
 			"SurfaceRight",
 			mSurfaceMaterial[0]->getName(),
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mRightMin,
 			mRightMax,
 			0,
@@ -65,7 +92,7 @@ namespace OgrePlanet
 			baseRadius,
 			scalingFactor,
 			dataSource,
-			32,
+			mSurfaceResolution,
 			Ogre::RENDER_QUEUE_MAIN,
 			false,
 			0,
@@ -79,8 +106,7 @@ namespace OgrePlanet
 		mSurfaceSide[1] = new Patch(
 			"SurfaceLeft",
 			mSurfaceMaterial[1]->getName(),
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mLeftMin,
 			mLeftMax,
 			0,
@@ -90,7 +116,7 @@ namespace OgrePlanet
 			baseRadius,
 			scalingFactor,
 			dataSource,
-			32,
+			mSurfaceResolution,
 			Ogre::RENDER_QUEUE_MAIN,
 			false,
 			0,
@@ -104,8 +130,7 @@ namespace OgrePlanet
 		mSurfaceSide[2] = new Patch(
 			"SurfaceTop",
 			mSurfaceMaterial[2]->getName(),
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mTopMin,
 			mTopMax,
 			0,
@@ -115,7 +140,7 @@ namespace OgrePlanet
 			baseRadius,
 			scalingFactor,
 			dataSource,
-			32,
+			mSurfaceResolution,
 			Ogre::RENDER_QUEUE_MAIN,
 			false,
 			0,
@@ -129,8 +154,7 @@ namespace OgrePlanet
 		mSurfaceSide[3] = new Patch(
 			"SurfaceBottom",
 			mSurfaceMaterial[3]->getName(),
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mBottomMin,
 			mBottomMax,
 			0,
@@ -140,7 +164,7 @@ namespace OgrePlanet
 			baseRadius,
 			scalingFactor,
 			dataSource,
-			32,
+			mSurfaceResolution,
 			Ogre::RENDER_QUEUE_MAIN,
 			false,
 			0,
@@ -154,8 +178,7 @@ namespace OgrePlanet
 		mSurfaceSide[4] = new Patch(
 			"SurfaceFront",
 			mSurfaceMaterial[4]->getName(),
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mFrontMin,
 			mFrontMax,
 			0,
@@ -165,7 +188,7 @@ namespace OgrePlanet
 			baseRadius,
 			scalingFactor,
 			dataSource,
-			32,
+			mSurfaceResolution,
 			Ogre::RENDER_QUEUE_MAIN,
 			false,
 			0,
@@ -179,8 +202,7 @@ namespace OgrePlanet
 		mSurfaceSide[5] = new Patch(
 			"SurfaceBack",
 			mSurfaceMaterial[5]->getName(),
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mBackMin,
 			mBackMax,
 			0,
@@ -190,21 +212,20 @@ namespace OgrePlanet
 			baseRadius,
 			scalingFactor,
 			dataSource,
-			32,
+			mSurfaceResolution,
 			Ogre::RENDER_QUEUE_MAIN,
 			false,
 			0,
 			4,
 			15);
 
-		Ogre::String oceanMaterialName = "OgrePlanet/Ocean";
+		Ogre::String oceanMaterialName = "OgrePlanet/Ocean" + materialSuffix;
 		//Ogre::String oceanMaterialName = "OgrePlanet/TerrainGouraud";
 
 		mOceanSide[0] = new Patch(
 			"OceanRight",
 			oceanMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mRightMin,
 			mRightMax,
 			0.0,
@@ -214,7 +235,7 @@ namespace OgrePlanet
 			baseRadius,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mOceanResolution,
 			Ogre::RENDER_QUEUE_4,
 			false,
 			0,
@@ -224,8 +245,7 @@ namespace OgrePlanet
 		mOceanSide[1] = new Patch(
 			"OceanLeft",
 			oceanMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mLeftMin,
 			mLeftMax,
 			0.0,
@@ -235,7 +255,7 @@ namespace OgrePlanet
 			baseRadius,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mOceanResolution,
 			Ogre::RENDER_QUEUE_4,
 			false,
 			0,
@@ -245,8 +265,7 @@ namespace OgrePlanet
 		mOceanSide[2] = new Patch(
 			"OceanTop",
 			oceanMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mTopMin,
 			mTopMax,
 			0.0,
@@ -256,7 +275,7 @@ namespace OgrePlanet
 			baseRadius,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mOceanResolution,
 			Ogre::RENDER_QUEUE_4,
 			false,
 			0,
@@ -266,8 +285,7 @@ namespace OgrePlanet
 		mOceanSide[3] = new Patch(
 			"OceanBottom",
 			oceanMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mBottomMin,
 			mBottomMax,
 			0.0,
@@ -277,7 +295,7 @@ namespace OgrePlanet
 			baseRadius,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mOceanResolution,
 			Ogre::RENDER_QUEUE_4,
 			false,
 			0,
@@ -287,8 +305,7 @@ namespace OgrePlanet
 		mOceanSide[4] = new Patch(
 			"OceanFront",
 			oceanMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mFrontMin,
 			mFrontMax,
 			0.0,
@@ -298,7 +315,7 @@ namespace OgrePlanet
 			baseRadius,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mOceanResolution,
 			Ogre::RENDER_QUEUE_4,
 			false,
 			0,
@@ -308,8 +325,7 @@ namespace OgrePlanet
 		mOceanSide[5] = new Patch(
 			"OceanBack",
 			oceanMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mBackMin,
 			mBackMax,
 			0.0,
@@ -319,21 +335,20 @@ namespace OgrePlanet
 			baseRadius,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mOceanResolution,
 			Ogre::RENDER_QUEUE_4,
 			false,
 			0,
 			4,
 			15);
 
-		Ogre::String skyMaterialName = "OgrePlanet/Sky";
+		Ogre::String skyMaterialName = "OgrePlanet/Sky" + materialSuffix;
 		//Ogre::String skyMaterialName = "OgrePlanet/TerrainGouraud";
 
 		mSkySide[0] = new Patch(
 			"SkyRight",
 			skyMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mRightMin,
 			mRightMax,
 			0.0,
@@ -343,7 +358,7 @@ namespace OgrePlanet
 			baseRadius + 20,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mSkyResolution,
 			Ogre::RENDER_QUEUE_6,
 			false,
 			0,
@@ -353,8 +368,7 @@ namespace OgrePlanet
 		mSkySide[1] = new Patch(
 			"SkyLeft",
 			skyMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mLeftMin,
 			mLeftMax,
 			0.0,
@@ -364,7 +378,7 @@ namespace OgrePlanet
 			baseRadius + 20,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mSkyResolution,
 			Ogre::RENDER_QUEUE_6,
 			false,
 			0,
@@ -374,8 +388,7 @@ namespace OgrePlanet
 		mSkySide[2] = new Patch(
 			"SkyTop",
 			skyMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mTopMin,
 			mTopMax,
 			0.0,
@@ -385,7 +398,7 @@ namespace OgrePlanet
 			baseRadius + 20,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mSkyResolution,
 			Ogre::RENDER_QUEUE_6,
 			false,
 			0,
@@ -395,8 +408,7 @@ namespace OgrePlanet
 		mSkySide[3] = new Patch(
 			"SkyBottom",
 			skyMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mBottomMin,
 			mBottomMax,
 			0.0,
@@ -406,7 +418,7 @@ namespace OgrePlanet
 			baseRadius + 20,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mSkyResolution,
 			Ogre::RENDER_QUEUE_6,
 			false,
 			0,
@@ -416,8 +428,7 @@ namespace OgrePlanet
 		mSkySide[4] = new Patch(
 			"SkyFront",
 			skyMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mFrontMin,
 			mFrontMax,
 			0.0,
@@ -427,7 +438,7 @@ namespace OgrePlanet
 			baseRadius + 20,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mSkyResolution,
 			Ogre::RENDER_QUEUE_6,
 			false,
 			0,
@@ -437,8 +448,7 @@ namespace OgrePlanet
 		mSkySide[5] = new Patch(
 			"SkyBack",
 			skyMaterialName,
-			mgr,
-			sceneNode,
+			mPlanetRenderable,
 			mBackMin,
 			mBackMax,
 			0.0,
@@ -448,12 +458,27 @@ namespace OgrePlanet
 			baseRadius + 20,
 			0.0,
 			mIdentityDataSource,
-			32,
+			mSkyResolution,
 			Ogre::RENDER_QUEUE_6,
 			false,
 			0,
 			0,
 			7);
+
+		for (int i = 0; i < 6; i++)
+		{
+			mSurfaceSide[i]->attach(mOceanSide[i]);
+			mSurfaceSide[i]->attach(mSkySide[i]);
+		}
+
+		// The ocean is at the base radius
+		setSubmergedMargin(mSubmergedMargin);
+
+		// The ocean and sky are accounted for along with the surface
+		for (int i = 0; i < 6; i++)
+		{
+			mSurfaceSide[i]->setBudget(&mBudget);
+		}
 	}
 
 	Planet::~Planet()
@@ -466,74 +491,94 @@ namespace OgrePlanet
 			delete mOceanSide[i];
 			delete mSkySide[i];
 		}
+
+		// Nothing else will be prepared, free the patches' meshes now
+		PatchMeshLoaderQueue::getSingleton().reclaimAll();
+		Patch::freePool();
+
+		mSceneNode->detachObject(mPlanetRenderable);
+		delete mPlanetRenderable;
 	}
 
 	void Planet::setCameraPosition(const Ogre::Vector3 & position)
 	{
+		// The ocean and sky are attached to the surface, one traversal
+		// updates all three layers
+		const unsigned long now = Ogre::Root::getSingleton().getTimer()->getMilliseconds();
+		mBudget.beginTraversal();
 		for (int i = 0; i < 6; i++)
 		{
-			mSurfaceSide[i]->setCameraPosition(position);
-			mOceanSide[i]->setCameraPosition(position);
-			mSkySide[i]->setCameraPosition(position);
+			mSurfaceSide[i]->setCameraPosition(position, now);
 		}
+		mBudget.endTraversal();
+		mBudget.setGpuBytes(PatchMeshLoader::getAllocatedGpuSize());
 
-		for (int i = 0; i < 6; i++) {
-			mSurfaceSide[i]->updateStitching();
-			mOceanSide[i]->updateStitching();
-			mSkySide[i]->updateStitching();
+		if (mBudget.isOverBudget())
+		{
+			enforceBudget();
 		}
+
+		// Only patches that gained or lost a neighbour above
+		Patch::updateDirtyStitching();
 	}
 
-	bool Planet::notifyPreRender()
+	static bool lessRecentlyVisible(Patch * a, Patch * b)
 	{
-		//if (!mStaticGeometry)
-		//{
-		//	mStaticGeometry = mMgr->createStaticGeometry("PlanetStaticGeometry");
-		//	mStaticGeometrySceneNode = mSceneNode->getParentSceneNode()->createChildSceneNode();
-		//}
-
-		//bool geometryUpdated = false;
+		return a->getLastVisibleFrame() < b->getLastVisibleFrame();
+	}
 
+	void Planet::enforceBudget()
+	{
+		std::vector<Patch *> candidates;
 		for (int i = 0; i < 6; i++)
 		{
-			mSurfaceSide[i]->notifyPreRender();
-			mOceanSide[i]->notifyPreRender();
-			mSkySide[i]->notifyPreRender();
-
-			//if (mSurfaceSide[i]->geometryUpdated() ||
-			//	mOceanSide[i]->geometryUpdated() ||
-			//	mSkySide[i]->geometryUpdated())
-			//{
-			//	geometryUpdated = true;
-			//}
+			mSurfaceSide[i]->collectMergeCandidates(candidates);
 		}
 
-		//if (geometryUpdated)
-		//{
-		//	mStaticGeometry->reset();
+		// Least recently seen first
+		std::stable_sort(candidates.begin(), candidates.end(), lessRecentlyVisible);
 
-		//	mStaticGeometry->addSceneNode(mSceneNode);
-		//	mStaticGeometry->build();
-		//}
+		PatchBudget::Usage usage = mBudget.getUsage();
 
-		//mStaticGeometrySceneNode->setPosition(mSceneNode->getPosition());
-		//mStaticGeometrySceneNode->setOrientation(mSceneNode->getOrientation());
-		//mSceneNode->getParentSceneNode()->removeChild(mSceneNode);
+		// Earlier merges may have left whole buffers unused
+		if (mBudget.isOverGpuLimit())
+		{
+			size_t freed = PatchMeshLoader::trimVertexBufferPools();
+			usage.gpuBytes -= std::min(usage.gpuBytes, freed);
+			mBudget.setGpuBytes(usage.gpuBytes);
+		}
 
-		return true;
+		int coarsened = 0;
+		for (std::vector<Patch *>::iterator i = candidates.begin();
+			i != candidates.end() && mBudget.getLoad(usage) > PatchBudget::LOW_WATER_MARK;
+			++i)
+		{
+			// Those already merging count too, they just haven't got
+			// there yet
+			if (!(*i)->isCoarsening())
+			{
+				(*i)->coarsen();
+				coarsened++;
+			}
+
+			usage -= (*i)->getChildrenUsage();
+		}
+
+		if (coarsened > 0)
+		{
+			Ogre::LogManager::getSingleton().logMessage("OgrePlanet: over the patch budget (" +
+				PatchBudget::toString(mBudget.getUsage()) + "), merging " +
+				Ogre::StringConverter::toString(coarsened) + " off screen subtrees.");
+		}
 	}
 
-	bool Planet::notifyPostRender()
+	void Planet::setSubmergedMargin(Ogre::Real margin)
 	{
-		//for (int i = 0; i < 6; i++)
-		//{
-		//	mSurfaceSide[i]->notifyPostRender();
-		//	mOceanSide[i]->notifyPostRender();
-		//	mSkySide[i]->notifyPostRender();
-		//}
-
-		//mStaticGeometrySceneNode->getParentSceneNode()->addChild(mSceneNode);
+		mSubmergedMargin = margin;
 
-		return true;
+		for (int i = 0; i < 6; i++)
+		{
+			mSurfaceSide[i]->setSeaLevel(mBaseRadius, mSubmergedMargin);
+		}
 	}
 }
\ No newline at end of file
@@ -35,32 +35,49 @@ namespace OgrePlanet
 	class Planet
 	{
 	public:
+		// The resolutions give the quads per patch of each layer, they are
+		// copied
 		Planet(
 			Ogre::SceneManager * mgr,
 			Ogre::SceneNode * sceneNode,
 			const Ogre::Real baseRadius,
 			const Ogre::Real scalingFactor,
-			DataSource * dataSource);
+			DataSource * dataSource,
+			const PatchResolution & surfaceResolution = PatchResolution(),
+			const PatchResolution & oceanResolution = PatchResolution(),
+			const PatchResolution & skyResolution = PatchResolution());
 		~Planet();
 
 		void setCameraPosition(const Ogre::Vector3 & position);
+		// How far below the ocean the terrain has to be to be culled
+		// while the camera is above water, see Patch::setSeaLevel()
+		void setSubmergedMargin(Ogre::Real margin);
+		// Limits on the memory and number of patches of all layers, and
+		// what they currently use. Over budget, the patches that have
+		// been off screen the longest are merged.
+		PatchBudget & getBudget() { return mBudget; }
 		void dumpPlanetTextures();
-		bool notifyPreRender();
-		bool notifyPostRender();
 	protected:
 	private:
 		bool allTexturesPrepared();
+		// Merges off screen subtrees until the usage is back below
+		// PatchBudget::LOW_WATER_MARK
+		void enforceBudget();
 
 		Patch * mSurfaceSide[6];
 		Ogre::TexturePtr mCurrentSurfaceSideTexture[6];
 		Ogre::TexturePtr mNextSurfaceSideTexture[6];
 		Ogre::MaterialPtr mSurfaceMaterial[6];
+		// Attached to the surface patches, see Patch::attach()
 		Patch * mOceanSide[6];
 		Patch * mSkySide[6];
+		PlanetRenderable * mPlanetRenderable;
 		Ogre::SceneNode * mSceneNode;
 		Ogre::SceneManager * mMgr;
 		Ogre::Real mBaseRadius;
 		Ogre::Real mScalingFactor;
+		Ogre::Real mSubmergedMargin;
+		PatchBudget mBudget;
 		Ogre::Real mOldNearClipDistance;
 		Ogre::Real mOldFarClipDistance;
 		int mResolution;
@@ -81,8 +98,11 @@ namespace OgrePlanet
 		Ogre::Real mNear;
 		Ogre::Real mFar;
 		int mRepetition;
-		Ogre::StaticGeometry * mStaticGeometry;
-		Ogre::SceneNode * mStaticGeometrySceneNode;
+		// Quads per patch by depth for each layer, referenced by the
+		// patches
+		PatchResolution mSurfaceResolution;
+		PatchResolution mOceanResolution;
+		PatchResolution mSkyResolution;
 	};
 }
 
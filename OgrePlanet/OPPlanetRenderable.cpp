@@ -0,0 +1,307 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPPlanetRenderable.h"
+
+namespace OgrePlanet
+{
+	PatchRenderable::PatchRenderable(
+		PlanetRenderable * planet,
+		const Ogre::MeshPtr & mesh,
+		const Ogre::String & materialName,
+		Ogre::uint8 renderQueue,
+		Ogre::ushort priority) :
+	mPlanet(planet),
+		mMesh(mesh),
+		mRenderQueue(renderQueue),
+		mPriority(priority),
+		mCenter(Ogre::Vector3::ZERO),
+		mRadius(0.0),
+		mCulled(false),
+		mQueuedFrame(0),
+		mIndex(NOT_SHOWN)
+	{
+		setMaterialName(materialName);
+	}
+
+	PatchRenderable::~PatchRenderable()
+	{
+		if (isShown())
+		{
+			mPlanet->hidePatch(this);
+		}
+	}
+
+	void PatchRenderable::reset(const Ogre::MeshPtr & mesh,
+		const Ogre::String & materialName,
+		Ogre::uint8 renderQueue,
+		Ogre::ushort priority)
+	{
+		assert(!isShown());
+
+		mMesh = mesh;
+		mRenderQueue = renderQueue;
+		mPriority = priority;
+		mCenter = Ogre::Vector3::ZERO;
+		mBounds.setNull();
+		mRadius = 0.0;
+		mCulled = false;
+		mQueuedFrame = 0;
+		setMaterialName(materialName);
+	}
+
+	void PatchRenderable::setMaterialName(const Ogre::String & materialName)
+	{
+		if (!mMaterial.isNull() && mMaterial->getName() == materialName)
+		{
+			return;
+		}
+
+		mMaterial = Ogre::MaterialManager::getSingleton().getByName(materialName);
+		assert(!mMaterial.isNull());
+		mMaterial->load();
+	}
+
+	void PatchRenderable::setCenter(const Ogre::Vector3 & center, const Ogre::AxisAlignedBox & bounds)
+	{
+		mCenter = center;
+		mBounds = bounds;
+		mRadius = bounds.getHalfSize().length();
+	}
+
+	void PatchRenderable::setConstant(size_t index, const Ogre::Vector4 & value)
+	{
+		assert(isShown() && index < PlanetRenderable::PATCH_CONSTANT_COUNT);
+		mPlanet->getConstants(mIndex)[index] = value;
+	}
+
+	Ogre::AxisAlignedBox PatchRenderable::getWorldBoundingBox() const
+	{
+		Ogre::Matrix4 xform;
+		getWorldTransforms(&xform);
+
+		Ogre::AxisAlignedBox box(mBounds);
+		box.transformAffine(xform);
+		return box;
+	}
+
+	const Ogre::MaterialPtr & PatchRenderable::getMaterial() const
+	{
+		return mMaterial;
+	}
+
+	void PatchRenderable::getRenderOperation(Ogre::RenderOperation & op)
+	{
+		// Read from the mesh every time, stitching swaps its index buffer
+		mMesh->getSubMesh(0)->_getRenderOperation(op);
+	}
+
+	void PatchRenderable::getWorldTransforms(Ogre::Matrix4 * xform) const
+	{
+		*xform = mPlanet->_getParentNodeFullTransform() * Ogre::Matrix4::getTrans(mCenter);
+	}
+
+	Ogre::Real PatchRenderable::getSquaredViewDepth(const Ogre::Camera * cam) const
+	{
+		Ogre::Vector3 position = mPlanet->_getParentNodeFullTransform() * mCenter;
+		return (position - cam->getDerivedPosition()).squaredLength();
+	}
+
+	const Ogre::LightList & PatchRenderable::getLights() const
+	{
+		return mPlanet->queryLights();
+	}
+
+	void PatchRenderable::_updateCustomGpuParameter(
+		const Ogre::GpuProgramParameters::AutoConstantEntry & constantEntry,
+		Ogre::GpuProgramParameters * params) const
+	{
+		if (isShown() && constantEntry.data < PlanetRenderable::PATCH_CONSTANT_COUNT)
+		{
+			params->_writeRawConstant(constantEntry.physicalIndex,
+				mPlanet->getConstants(mIndex)[constantEntry.data],
+				constantEntry.elementCount);
+		}
+	}
+
+	const Ogre::String PlanetRenderable::MOVABLE_TYPE = "OgrePlanetRenderable";
+
+	PlanetRenderable::PlanetRenderable(const Ogre::String & name) :
+	Ogre::MovableObject(name),
+		mCamera(0)
+	{
+		// Patches are culled one by one in _updateRenderQueue()
+		mBoundingBox.setInfinite();
+	}
+
+	PlanetRenderable::~PlanetRenderable()
+	{
+		while (!mPatches.empty())
+		{
+			hidePatch(mPatches.back());
+		}
+
+		for (std::vector<PatchRenderable *>::iterator i = mFreePatches.begin(); i != mFreePatches.end(); ++i)
+		{
+			delete *i;
+		}
+	}
+
+	PatchRenderable * PlanetRenderable::createPatch(const Ogre::MeshPtr & mesh,
+		const Ogre::String & materialName,
+		Ogre::uint8 renderQueue,
+		Ogre::ushort priority)
+	{
+		if (mFreePatches.empty())
+		{
+			return new PatchRenderable(this, mesh, materialName, renderQueue, priority);
+		}
+
+		PatchRenderable * patch = mFreePatches.back();
+		mFreePatches.pop_back();
+		patch->reset(mesh, materialName, renderQueue, priority);
+		return patch;
+	}
+
+	void PlanetRenderable::destroyPatch(PatchRenderable * patch)
+	{
+		if (patch->isShown())
+		{
+			hidePatch(patch);
+		}
+
+		// Don't keep the mesh alive, it is freed separately
+		patch->mMesh.setNull();
+		mFreePatches.push_back(patch);
+	}
+
+	void PlanetRenderable::showPatch(PatchRenderable * patch)
+	{
+		assert(!patch->isShown());
+
+		patch->mIndex = mPatches.size();
+		mPatches.push_back(patch);
+		mConstants.resize(mPatches.size() * PATCH_CONSTANT_COUNT, Ogre::Vector4::ZERO);
+	}
+
+	void PlanetRenderable::hidePatch(PatchRenderable * patch)
+	{
+		assert(patch->isShown() && mPatches[patch->mIndex] == patch);
+
+		// Move the last patch, and its constants, into the hole
+		PatchRenderable * last = mPatches.back();
+		if (last != patch)
+		{
+			size_t index = patch->mIndex;
+			mPatches[index] = last;
+			std::copy(getConstants(last->mIndex), getConstants(last->mIndex) + PATCH_CONSTANT_COUNT, getConstants(index));
+			last->mIndex = index;
+		}
+
+		mPatches.pop_back();
+		mConstants.resize(mPatches.size() * PATCH_CONSTANT_COUNT);
+		patch->mIndex = PatchRenderable::NOT_SHOWN;
+	}
+
+	const Ogre::String & PlanetRenderable::getMovableType() const
+	{
+		return MOVABLE_TYPE;
+	}
+
+	const Ogre::AxisAlignedBox & PlanetRenderable::getBoundingBox() const
+	{
+		return mBoundingBox;
+	}
+
+	Ogre::Real PlanetRenderable::getBoundingRadius() const
+	{
+		return 0.0;
+	}
+
+	void PlanetRenderable::_notifyCurrentCamera(Ogre::Camera * cam)
+	{
+		Ogre::MovableObject::_notifyCurrentCamera(cam);
+		mCamera = cam;
+	}
+
+	void PlanetRenderable::_updateRenderQueue(Ogre::RenderQueue * queue)
+	{
+		Ogre::Real baseRadius = 6371.0; // Hack, because otherwise atmosphere isn't culled correctly
+											// (It has another baseRadius...)
+
+		// Horizon culling, the part that is the same for all patches
+		Ogre::Vector3 planetPosition = getParentNode()->_getDerivedPosition();
+		Ogre::Quaternion planetOrientation = getParentNode()->_getDerivedOrientation();
+		Ogre::Vector3 planetDirection = planetPosition.normalisedCopy();
+
+		Ogre::Real cosAngleToPlanetHorizon = Ogre::Math::Sqrt(planetPosition.squaredLength() - baseRadius*baseRadius) / planetPosition.length();
+		Ogre::Radian angleToPlanetHorizon = Ogre::Math::ACos(cosAngleToPlanetHorizon);
+		Ogre::Real distanceToPlanetHorizon = Ogre::Math::Sqrt(planetPosition.squaredLength() - baseRadius*baseRadius);
+
+		unsigned long frame = Ogre::Root::getSingleton().getNextFrameNumber();
+
+		for (std::vector<PatchRenderable *>::iterator i = mPatches.begin(); i != mPatches.end(); ++i)
+		{
+			PatchRenderable * patch = *i;
+
+			if (patch->mCulled)
+			{
+				continue;
+			}
+
+			Ogre::Vector3 patchPosition = planetPosition + (planetOrientation * patch->mCenter);
+			Ogre::Vector3 patchDirection = patchPosition.normalisedCopy();
+			Ogre::Real patchRadius = patch->mRadius;
+
+			Ogre::Real cosAngleToPatchHorizon = Ogre::Math::Sqrt(patchPosition.squaredLength() - patchRadius*patchRadius) / patchPosition.length();
+			Ogre::Radian angleToPatchHorizon = Ogre::Math::ACos(cosAngleToPatchHorizon);
+			Ogre::Radian angleBetweenPlanetAndPatch = Ogre::Math::ACos(planetDirection.dotProduct(patchDirection));
+
+			bool isBehindHorizonPlane = ((patchPosition.dotProduct(planetDirection) - patchRadius) > (distanceToPlanetHorizon * cosAngleToPlanetHorizon));
+			bool isInHorizonCone = ((angleBetweenPlanetAndPatch + angleToPatchHorizon) < angleToPlanetHorizon);
+
+			if (isBehindHorizonPlane && isInHorizonCone)
+			{
+				continue;
+			}
+
+			if (mCamera && !mCamera->isVisible(patch->getWorldBoundingBox()))
+			{
+				continue;
+			}
+
+			queue->addRenderable(patch, patch->mRenderQueue, patch->mPriority);
+			patch->mQueuedFrame = frame;
+		}
+	}
+
+	void PlanetRenderable::visitRenderables(Ogre::Renderable::Visitor * visitor, bool debugRenderables)
+	{
+		for (std::vector<PatchRenderable *>::iterator i = mPatches.begin(); i != mPatches.end(); ++i)
+		{
+			if (!(*i)->mCulled)
+			{
+				visitor->visit(*i, 0, false);
+			}
+		}
+	}
+}
@@ -0,0 +1,153 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef PLANETRENDERABLE_H
+#define PLANETRENDERABLE_H
+
+#include <Ogre.h>
+
+#include <vector>
+
+namespace OgrePlanet
+{
+	class PlanetRenderable;
+
+	// What is drawn of one patch. Not a scene graph object: the
+	// PlanetRenderable queues it directly while the patch is shown, and
+	// its custom GPU parameters are read from the planet's constant
+	// array instead of a per renderable map.
+	class PatchRenderable : public Ogre::Renderable
+	{
+	public:
+		PatchRenderable(
+			PlanetRenderable * planet,
+			const Ogre::MeshPtr & mesh,
+			const Ogre::String & materialName,
+			Ogre::uint8 renderQueue,
+			Ogre::ushort priority);
+		~PatchRenderable();
+
+		void setMaterialName(const Ogre::String & materialName);
+		// Where the mesh sits relative to the planet, and its bounds
+		// relative to that
+		void setCenter(const Ogre::Vector3 & center, const Ogre::AxisAlignedBox & bounds);
+		// Sets the value of "custom <index>" in the vertex and fragment
+		// programs. Only possible while the patch is shown.
+		void setConstant(size_t index, const Ogre::Vector4 & value);
+		bool isShown() const { return mIndex != NOT_SHOWN; }
+		// A culled patch stays shown, but isn't queued for rendering
+		void setCulled(bool culled) { mCulled = culled; }
+		bool isCulled() const { return mCulled; }
+		// Frame number (see Ogre::Root::getNextFrameNumber()) of the last
+		// frame the patch was queued for rendering in, 0 if never
+		unsigned long getQueuedFrame() const { return mQueuedFrame; }
+		Ogre::AxisAlignedBox getWorldBoundingBox() const;
+
+		const Ogre::MaterialPtr & getMaterial() const;
+		void getRenderOperation(Ogre::RenderOperation & op);
+		void getWorldTransforms(Ogre::Matrix4 * xform) const;
+		Ogre::Real getSquaredViewDepth(const Ogre::Camera * cam) const;
+		const Ogre::LightList & getLights() const;
+		void _updateCustomGpuParameter(
+			const Ogre::GpuProgramParameters::AutoConstantEntry & constantEntry,
+			Ogre::GpuProgramParameters * params) const;
+
+	private:
+		friend class PlanetRenderable;
+
+		static const size_t NOT_SHOWN = ~(size_t) 0;
+
+		// Reinitialises a recycled patch, see PlanetRenderable::createPatch()
+		void reset(const Ogre::MeshPtr & mesh,
+			const Ogre::String & materialName,
+			Ogre::uint8 renderQueue,
+			Ogre::ushort priority);
+
+		PlanetRenderable * mPlanet;
+		Ogre::MeshPtr mMesh;
+		Ogre::MaterialPtr mMaterial;
+		Ogre::uint8 mRenderQueue;
+		Ogre::ushort mPriority;
+		Ogre::Vector3 mCenter;
+		Ogre::AxisAlignedBox mBounds;
+		Ogre::Real mRadius;
+		bool mCulled;
+		unsigned long mQueuedFrame;
+		// Position in the planet's list of shown patches
+		size_t mIndex;
+	};
+
+	// One movable object for all patches of a planet. Shown patches are
+	// kept in a flat list, which is horizon and frustum culled and queued
+	// each frame without any per patch scene nodes or entities.
+	//
+	// The custom GPU parameters of shown patches live in one array, in
+	// the same order as the list, so a patch's constants are found by
+	// its position and hiding a patch just moves the last one into its
+	// place.
+	class PlanetRenderable : public Ogre::MovableObject
+	{
+	public:
+		// Highest custom parameter index + 1 used by the materials
+		static const size_t PATCH_CONSTANT_COUNT = 15;
+		static const Ogre::String MOVABLE_TYPE;
+
+		PlanetRenderable(const Ogre::String & name);
+		~PlanetRenderable();
+
+		// Patches are recycled, so splitting and merging doesn't allocate
+		// them or look up their material by name each time. A destroyed
+		// patch is hidden and kept for the next createPatch(), the rest
+		// are deleted with the planet.
+		PatchRenderable * createPatch(const Ogre::MeshPtr & mesh,
+			const Ogre::String & materialName,
+			Ogre::uint8 renderQueue,
+			Ogre::ushort priority);
+		void destroyPatch(PatchRenderable * patch);
+
+		void showPatch(PatchRenderable * patch);
+		void hidePatch(PatchRenderable * patch);
+		size_t getShownPatchCount() const { return mPatches.size(); }
+
+		const Ogre::String & getMovableType() const;
+		const Ogre::AxisAlignedBox & getBoundingBox() const;
+		Ogre::Real getBoundingRadius() const;
+		void _notifyCurrentCamera(Ogre::Camera * cam);
+		void _updateRenderQueue(Ogre::RenderQueue * queue);
+		void visitRenderables(Ogre::Renderable::Visitor * visitor, bool debugRenderables = false);
+
+	private:
+		friend class PatchRenderable;
+
+		Ogre::Vector4 * getConstants(size_t index) { return &mConstants[index * PATCH_CONSTANT_COUNT]; }
+		const Ogre::Vector4 * getConstants(size_t index) const { return &mConstants[index * PATCH_CONSTANT_COUNT]; }
+
+		std::vector<PatchRenderable *> mPatches;
+		// See destroyPatch()
+		std::vector<PatchRenderable *> mFreePatches;
+		std::vector<Ogre::Vector4> mConstants;
+		Ogre::AxisAlignedBox mBoundingBox;
+		Ogre::Camera * mCamera;
+	};
+}
+
+#endif // PLANETRENDERABLE_H
@@ -30,7 +30,7 @@ namespace OgrePlanet
 		Ogre::Vector3 & max,
 		Ogre::Real baseRadius,
 		Ogre::Real scalingFactor) :
-	HeightDataResourceLoader(dataSource, quads, min, max, 1, boost::shared_array<Ogre::Real>(new Ogre::Real[(quads+1) * (quads+1)])),
+	HeightDataResourceLoader(dataSource, quads, min, max, 1),
 		mBaseRadius(baseRadius),
 		mScalingFactor(scalingFactor),
 		mColorDeeps(0.0, 0.0, 128.0/255.0),
@@ -44,13 +44,25 @@ namespace OgrePlanet
 	{
 	}
 
-	void PlanetTextureLoader::loadResource(Ogre::Resource *resource)
+	void PlanetTextureLoader::prepareGeometry(Ogre::Resource * resource,
+		const float * xs,
+		const float * ys,
+		const float * zs)
 	{
 		Ogre::Texture * texturePtr = static_cast<Ogre::Texture *>(resource);
 
-		Ogre::Image::Box lockBox(0, 0, 0, texturePtr->getWidth(), texturePtr->getHeight(), texturePtr->getDepth());
-		Ogre::PixelBox pixelBox = texturePtr->getBuffer()->lock(lockBox, Ogre::HardwareBuffer::HBL_DISCARD);
-		Ogre::uint32 * pDest = static_cast<Ogre::uint32 *>(pixelBox.data);
+		if (isConstant())
+		{
+			// Not sampled, the colours below read the heights
+			mData.assign((mQuads + 3) * (mQuads + 3), mConstantHeight);
+		}
+
+		// Bake the diffuse and normal maps here, on the worker thread, so
+		// that loadResource() only has to copy them into the texture
+		mPixels.resize(2 * (mQuads + 1) * (mQuads + 1));
+		Ogre::uint32 * pDest = &mPixels[0];
+		const int slicePitch = (mQuads + 1) * (mQuads + 1);
+		const int rowPitch = mQuads + 1;
 
 		for (int y = 0; y < (mQuads + 1); y++)
 		{
@@ -62,8 +74,8 @@ namespace OgrePlanet
 				//pos = unitSpherePos[index] * (mBaseRadius + height[index] * mScalingFactor);
 
 				int diffuseSlice = 0;
-				int normalSlice = pixelBox.slicePitch;
-				int row = y * pixelBox.rowPitch;
+				int normalSlice = slicePitch;
+				int row = y * rowPitch;
 				Ogre::Real h = mData[index];
 				Ogre::ColourValue lowColor;
 				Ogre::ColourValue highColor;
@@ -142,9 +154,9 @@ namespace OgrePlanet
 				Ogre::ColourValue color = lerpV * highColor + (1.0 - lerpV) * lowColor;
 				Ogre::PixelUtil::packColour(color, texturePtr->getFormat(), &(pDest[diffuseSlice + row + x]));
 
-				Ogre::Vector3 thisPos = (mBaseRadius + mScalingFactor * h) * mUnitSpherePos[index];
-				Ogre::Vector3 nextXPos = (mBaseRadius + mScalingFactor * mData[nextXIndex]) * mUnitSpherePos[nextXIndex];
-				Ogre::Vector3 nextYPos = (mBaseRadius + mScalingFactor * mData[nextYIndex]) * mUnitSpherePos[nextYIndex];
+				Ogre::Vector3 thisPos = (mBaseRadius + mScalingFactor * h) * Ogre::Vector3(xs[index], ys[index], zs[index]);
+				Ogre::Vector3 nextXPos = (mBaseRadius + mScalingFactor * mData[nextXIndex]) * Ogre::Vector3(xs[nextXIndex], ys[nextXIndex], zs[nextXIndex]);
+				Ogre::Vector3 nextYPos = (mBaseRadius + mScalingFactor * mData[nextYIndex]) * Ogre::Vector3(xs[nextYIndex], ys[nextYIndex], zs[nextYIndex]);
 
 				Ogre::Vector3 normal = (nextYPos - thisPos).crossProduct(nextXPos - thisPos).normalisedCopy();
 				Ogre::Vector3 bakedNormal = (normal + Ogre::Vector3::UNIT_SCALE) / 2.0;
@@ -153,7 +165,30 @@ namespace OgrePlanet
 				Ogre::PixelUtil::packColour(normalColor, texturePtr->getFormat(), &(pDest[normalSlice + row + x]));
 			}
 		}
+	}
+
+	void PlanetTextureLoader::loadResource(Ogre::Resource *resource)
+	{
+		Ogre::Texture * texturePtr = static_cast<Ogre::Texture *>(resource);
+
+		Ogre::Image::Box lockBox(0, 0, 0, texturePtr->getWidth(), texturePtr->getHeight(), texturePtr->getDepth());
+		Ogre::PixelBox pixelBox = texturePtr->getBuffer()->lock(lockBox, Ogre::HardwareBuffer::HBL_DISCARD);
+		Ogre::uint32 * pDest = static_cast<Ogre::uint32 *>(pixelBox.data);
+
+		// Pixels were baked in prepareGeometry()
+		const Ogre::uint32 * pSrc = &mPixels[0];
+		for (int slice = 0; slice < 2; slice++)
+		{
+			for (int y = 0; y < (mQuads + 1); y++)
+			{
+				std::copy(pSrc, pSrc + (mQuads + 1), pDest + slice * pixelBox.slicePitch + y * pixelBox.rowPitch);
+				pSrc += mQuads + 1;
+			}
+		}
 
 		texturePtr->getBuffer()->unlock();
+
+		// Done with the pixels, release them to conserve memory
+		std::vector<Ogre::uint32>().swap(mPixels);
 	}
 }
\ No newline at end of file
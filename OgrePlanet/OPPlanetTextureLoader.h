@@ -38,6 +38,12 @@ namespace OgrePlanet
 			Ogre::Real scalingFactor);
 		void loadResource(Ogre::Resource * resource);
 
+	protected:
+		void prepareGeometry(Ogre::Resource * resource,
+			const float * xs,
+			const float * ys,
+			const float * zs);
+
 	private:
 		const Ogre::Real mBaseRadius;
 		const Ogre::Real mScalingFactor;
@@ -49,6 +55,9 @@ namespace OgrePlanet
 		Ogre::ColourValue mColorDirt;
 		Ogre::ColourValue mColorRock;
 		Ogre::ColourValue mColorSnow;
+		// Diffuse map followed by normal map, from prepareGeometry()
+		// until loadResource() has copied them into the texture
+		std::vector<Ogre::uint32> mPixels;
 	};
 }
 
@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPQuantizedHeights.h"
+
+#include <algorithm>
+
+namespace OgrePlanet
+{
+	void QuantizedHeights::encode(const float * heights, int n)
+	{
+		values.resize(n);
+		if (n == 0)
+		{
+			return;
+		}
+
+		float low = *std::min_element(heights, heights + n);
+		float high = *std::max_element(heights, heights + n);
+		offset = low;
+		scale = (high - low) / 65535.0f;
+
+		const float invScale = (scale > 0.0f ? 1.0f / scale : 0.0f);
+		for (int i = 0; i < n; i++)
+		{
+			// Rounded, and clamped in case of rounding at the top
+			float value = (heights[i] - low) * invScale + 0.5f;
+			values[i] = (Ogre::uint16) std::min(value, 65535.0f);
+		}
+	}
+
+	void QuantizedHeights::assign(float height, int n)
+	{
+		values.assign(n, 0);
+		offset = height;
+		scale = 0.0f;
+	}
+
+	void QuantizedHeights::clear()
+	{
+		std::vector<Ogre::uint16>().swap(values);
+		offset = 0.0f;
+		scale = 0.0f;
+	}
+
+	float QuantizedHeights::getMax() const
+	{
+		return values.empty() ? offset : offset + scale * *std::max_element(values.begin(), values.end());
+	}
+}
@@ -0,0 +1,59 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef QUANTIZEDHEIGHTS_H
+#define QUANTIZEDHEIGHTS_H
+
+#include <Ogre.h>
+
+#include <vector>
+
+namespace OgrePlanet
+{
+	// Heights of one patch as 16 bit values, height = offset + scale *
+	// value. The heights of a patch span a small range, so the error (at
+	// most half of scale) is far below anything a vertex could show.
+	// Patches keep their height data like this, children copy from it
+	// and the mesh kernels read it directly.
+	struct QuantizedHeights
+	{
+		QuantizedHeights() : offset(0.0f), scale(0.0f) {}
+
+		// Picks offset and scale to cover the range of the n heights
+		void encode(const float * heights, int n);
+		// n heights that are all the same
+		void assign(float height, int n);
+		void clear();
+
+		float decode(int i) const { return offset + scale * values[i]; }
+		float getMax() const;
+		bool empty() const { return values.empty(); }
+		// In bytes
+		size_t getSize() const { return values.size() * sizeof(Ogre::uint16); }
+
+		std::vector<Ogre::uint16> values;
+		float offset;
+		float scale;
+	};
+}
+
+#endif // QUANTIZEDHEIGHTS_H
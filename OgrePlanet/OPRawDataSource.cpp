@@ -59,15 +59,33 @@ namespace OgrePlanet
 
 		//return ((Ogre::Real) data)/8800;
 
+		Ogre::Image heightMap;
+		heightMap.load("earthHeightmap.jpg", Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+
+		return lookupValue(heightMap.getPixelBox(), position);
+	}
+
+	void RawDataSource::sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n)
+	{
+		// Load the height map once for the whole batch
+		Ogre::Image heightMap;
+		heightMap.load("earthHeightmap.jpg", Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+		Ogre::PixelBox pb = heightMap.getPixelBox();
+
+		for (int i = 0; i < n; i++)
+		{
+			out[i] = lookupValue(pb, Ogre::Vector3(xs[i], ys[i], zs[i]));
+		}
+	}
+
+	Ogre::Real RawDataSource::lookupValue(const Ogre::PixelBox & pb, const Ogre::Vector3 &position)
+	{
 		Ogre::Vector3 sphericalPos = cartesianToSpherical(position);
 
 		// Scale theta and phi to [0, 1] range
 		Ogre::Real x = (sphericalPos.x + Ogre::Math::PI) / Ogre::Math::TWO_PI;
 		Ogre::Real y = (sphericalPos.y + Ogre::Math::HALF_PI) / Ogre::Math::PI;
 
-		Ogre::Image heightMap;
-		heightMap.load("earthHeightmap.jpg", Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
-		Ogre::PixelBox pb = heightMap.getPixelBox();
 		BYTE p = ((BYTE *)(pb.data))[pb.getWidth() * int(pb.getHeight() * y) + int(pb.getWidth() * x)];
 
 		return p;
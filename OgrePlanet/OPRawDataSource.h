@@ -35,9 +35,12 @@ namespace OgrePlanet
 		RawDataSource(const Ogre::String &fileName, int width, int height);
 		~RawDataSource();
 		Ogre::Real getValue(const Ogre::Vector3 &position);
+		void sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n);
+		bool isIOBound() { return true; }
 	protected:
 	private:
 		Ogre::Vector3 cartesianToSpherical(const Ogre::Vector3 &position);
+		Ogre::Real lookupValue(const Ogre::PixelBox & pb, const Ogre::Vector3 &position);
 
 		std::ifstream f;
 		int mWidth;
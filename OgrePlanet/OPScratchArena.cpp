@@ -0,0 +1,118 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPScratchArena.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace OgrePlanet
+{
+	boost::thread_specific_ptr<ScratchArena> ScratchArena::msArena;
+	// std::max() takes it by reference
+	const size_t ScratchArena::BLOCK_SIZE;
+
+	ScratchArena::ScratchArena() :
+	mBlock(0),
+		mOffset(0)
+	{
+	}
+
+	ScratchArena::~ScratchArena()
+	{
+		for (size_t i = 0; i < mBlocks.size(); i++)
+		{
+			delete [] mBlocks[i].data;
+		}
+	}
+
+	ScratchArena & ScratchArena::get()
+	{
+		ScratchArena * arena = msArena.get();
+		if (!arena)
+		{
+			arena = new ScratchArena();
+			msArena.reset(arena);
+		}
+		return *arena;
+	}
+
+	void * ScratchArena::allocateBytes(size_t bytes)
+	{
+		bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+		// Find a block with room, starting with the current one. Blocks
+		// after the current one are free (they're only kept around to be
+		// reused).
+		while (mBlock < mBlocks.size())
+		{
+			Block & block = mBlocks[mBlock];
+			char * aligned = block.data + ALIGNMENT - 1;
+			aligned -= (size_t)aligned % ALIGNMENT;
+			size_t start = (aligned - block.data) + mOffset;
+
+			if (start + bytes <= block.size)
+			{
+				mOffset += bytes;
+				return block.data + start;
+			}
+
+			mBlock++;
+			mOffset = 0;
+		}
+
+		// None of the blocks are large enough, add a new one
+		Block block;
+		block.size = std::max(BLOCK_SIZE, bytes + ALIGNMENT);
+		block.data = new char[block.size];
+		mBlocks.push_back(block);
+		mBlock = mBlocks.size() - 1;
+		mOffset = 0;
+
+		return allocateBytes(bytes);
+	}
+
+	ScratchArena::Marker ScratchArena::getMarker() const
+	{
+		Marker marker;
+		marker.block = mBlock;
+		marker.offset = mOffset;
+		return marker;
+	}
+
+	void ScratchArena::reset(const Marker & marker)
+	{
+		assert(marker.block < mBlock || (marker.block == mBlock && marker.offset <= mOffset));
+		mBlock = marker.block;
+		mOffset = marker.offset;
+	}
+
+	size_t ScratchArena::getCapacity() const
+	{
+		size_t capacity = 0;
+		for (size_t i = 0; i < mBlocks.size(); i++)
+		{
+			capacity += mBlocks[i].size;
+		}
+		return capacity;
+	}
+}
@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SCRATCHARENA_H
+#define SCRATCHARENA_H
+
+#include <boost/thread/tss.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace OgrePlanet
+{
+	// Bump allocator for temporary buffers used while generating a patch.
+	// Every thread has its own arena (see get()), so allocating takes no
+	// locks. Memory is handed out from large blocks which are kept when
+	// the arena is reset, so once the arena has grown to the size of a
+	// job, generating patches doesn't touch the heap at all.
+	//
+	// Allocations are released all at once, by resetting the arena to a
+	// marker. Use a Scope for that:
+	//
+	//	ScratchArena::Scope scope;
+	//	float * xs = scope.allocate<float>(n);
+	//	...
+	//	// xs is released when scope goes out of scope
+	//
+	// Memory is not initialised, and destructors are never run, so only
+	// use this for plain data.
+	class ScratchArena
+	{
+	public:
+		// Alignment of every allocation, enough for AVX loads and stores
+		static const size_t ALIGNMENT = 32;
+		// Size of each block, larger allocations get a block of their own
+		static const size_t BLOCK_SIZE = 256 * 1024;
+
+		struct Marker
+		{
+			size_t block;
+			size_t offset;
+		};
+
+		class Scope
+		{
+		public:
+			Scope() : mArena(ScratchArena::get()), mMarker(mArena.getMarker()) {}
+			~Scope() { mArena.reset(mMarker); }
+
+			template <typename T>
+			T * allocate(size_t count) { return mArena.allocate<T>(count); }
+
+		private:
+			Scope(const Scope &);
+			Scope & operator=(const Scope &);
+
+			ScratchArena & mArena;
+			Marker mMarker;
+		};
+
+		ScratchArena();
+		~ScratchArena();
+
+		// The calling thread's arena, created on first use
+		static ScratchArena & get();
+
+		void * allocateBytes(size_t bytes);
+
+		template <typename T>
+		T * allocate(size_t count)
+		{
+			return static_cast<T *>(allocateBytes(count * sizeof(T)));
+		}
+
+		Marker getMarker() const;
+		// Release everything allocated since marker was taken
+		void reset(const Marker & marker);
+
+		// Total size of the blocks owned by this arena
+		size_t getCapacity() const;
+
+	private:
+		ScratchArena(const ScratchArena &);
+		ScratchArena & operator=(const ScratchArena &);
+
+		struct Block
+		{
+			char * data;
+			size_t size;
+		};
+
+		std::vector<Block> mBlocks;
+		size_t mBlock;
+		size_t mOffset;
+
+		static boost::thread_specific_ptr<ScratchArena> msArena;
+	};
+}
+
+#endif // SCRATCHARENA_H
@@ -0,0 +1,155 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "OPCpuDispatch.h"
+
+#include <cassert>
+#include <cmath>
+
+#if OGREPLANET_HAVE_SSE
+#include <emmintrin.h>
+#endif
+
+namespace OgrePlanet
+{
+	// Everything here and in the kernel templates built from it is in an
+	// unnamed namespace. OPKernelsAVX2.cpp may be compiled with -mavx, and
+	// its copies of these inline functions must not stand in for the
+	// ones used by the SSE kernels.
+	namespace
+	{
+		// 1/sqrt(x), from the hardware estimate refined by one Newton-Raphson
+		// step. The scalar version uses the same instructions as the vector
+		// version, so that a vertex shared by two patches gets the same
+		// position regardless of which lane it ended up in.
+#if OGREPLANET_HAVE_SSE
+		inline __m128 reciprocalSqrt4(__m128 x)
+		{
+			const __m128 half = _mm_set1_ps(0.5f);
+			const __m128 threeHalves = _mm_set1_ps(1.5f);
+			__m128 r = _mm_rsqrt_ps(x);
+			return _mm_mul_ps(r, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, x), _mm_mul_ps(r, r))));
+		}
+
+		inline float reciprocalSqrt(float x)
+		{
+			float r;
+			_mm_store_ss(&r, reciprocalSqrt4(_mm_set_ss(x)));
+			return r;
+		}
+#else
+		inline float reciprocalSqrt(float x)
+		{
+			return 1.0f / std::sqrt(x);
+		}
+#endif
+
+		// Thin wrappers around one SIMD register type, so that a kernel can
+		// be written once as a template and instantiated for each instruction
+		// set. WIDTH is the number of floats per register. Tail is the type
+		// used for the elements left over at the end of a row; it gives the
+		// same result per element, so it doesn't matter which lane a value
+		// ends up in. end() is called before switching to Tail.
+
+		// Plain C++
+		struct SimdScalar
+		{
+			typedef float V;
+			typedef SimdScalar Tail;
+			enum { WIDTH = 1 };
+
+			static V load(const float * p) { return *p; }
+			// WIDTH unsigned shorts, converted to floats
+			static V loadUShort(const unsigned short * p) { return (float) *p; }
+			static void store(float * p, V v) { *p = v; }
+			static V set1(float f) { return f; }
+			static V add(V a, V b) { return a + b; }
+			static V sub(V a, V b) { return a - b; }
+			static V mul(V a, V b) { return a * b; }
+			static V min(V a, V b) { return (b < a ? b : a); }
+			static V max(V a, V b) { return (a < b ? b : a); }
+			static V rsqrt(V x) { return 1.0f / std::sqrt(x); }
+			// odd where x + lane is odd, otherwise even
+			static V selectOdd(V even, V odd, int x) { return (x & 1) ? odd : even; }
+			static void end() {}
+		};
+
+#if OGREPLANET_HAVE_SSE
+		// One float in the low lane of an SSE register, used for the leftovers
+		// of SimdSSE
+		struct SimdSSE1
+		{
+			typedef __m128 V;
+			typedef SimdSSE1 Tail;
+			enum { WIDTH = 1 };
+
+			static V load(const float * p) { return _mm_load_ss(p); }
+			static V loadUShort(const unsigned short * p) { return _mm_set_ss((float) *p); }
+			static void store(float * p, V v) { _mm_store_ss(p, v); }
+			static V set1(float f) { return _mm_set1_ps(f); }
+			static V add(V a, V b) { return _mm_add_ps(a, b); }
+			static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+			static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+			static V min(V a, V b) { return _mm_min_ps(a, b); }
+			static V max(V a, V b) { return _mm_max_ps(a, b); }
+			static V rsqrt(V x) { return reciprocalSqrt4(x); }
+			static V selectOdd(V even, V odd, int x) { return (x & 1) ? odd : even; }
+			static void end() {}
+		};
+
+		struct SimdSSE
+		{
+			typedef __m128 V;
+			typedef SimdSSE1 Tail;
+			enum { WIDTH = 4 };
+
+			static V load(const float * p) { return _mm_loadu_ps(p); }
+			static V loadUShort(const unsigned short * p)
+			{
+				__m128i s = _mm_loadl_epi64((const __m128i *) p);
+				return _mm_cvtepi32_ps(_mm_unpacklo_epi16(s, _mm_setzero_si128()));
+			}
+			static void store(float * p, V v) { _mm_storeu_ps(p, v); }
+			static V set1(float f) { return _mm_set1_ps(f); }
+			static V add(V a, V b) { return _mm_add_ps(a, b); }
+			static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+			static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+			static V min(V a, V b) { return _mm_min_ps(a, b); }
+			static V max(V a, V b) { return _mm_max_ps(a, b); }
+			static V rsqrt(V x) { return reciprocalSqrt4(x); }
+			static V selectOdd(V even, V odd, int x)
+			{
+				// Lanes alternate even, odd, even, odd
+				assert((x & 3) == 0);
+				const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(-1, 0, -1, 0));
+				return _mm_or_ps(_mm_and_ps(mask, odd), _mm_andnot_ps(mask, even));
+			}
+			static void end() {}
+		};
+#endif
+	}
+}
+
+#endif // SIMD_H
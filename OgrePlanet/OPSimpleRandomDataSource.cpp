@@ -34,4 +34,12 @@ namespace OgrePlanet
 	{
 		return mScalePoint.GetValue(position.x, position.y, position.z);
 	}
+
+	void SimpleRandomDataSource::sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			out[i] = (float)mScalePoint.GetValue(xs[i], ys[i], zs[i]);
+		}
+	}
 }
\ No newline at end of file
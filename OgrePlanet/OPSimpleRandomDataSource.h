@@ -34,6 +34,7 @@ namespace OgrePlanet
 	public:
 		SimpleRandomDataSource();
 		Ogre::Real getValue(const Ogre::Vector3 &position);
+		void sampleBatch(const float * xs, const float * ys, const float * zs, float * out, int n);
 	protected:
 	private:
 		noise::module::RidgedMulti mRidgedMulti;
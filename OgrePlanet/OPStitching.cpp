@@ -0,0 +1,194 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPStitching.h"
+
+namespace OgrePlanet
+{
+	namespace
+	{
+		// Grid position of the point t along a side, depth quads in from
+		// the edge. Sides run in +x or +y direction.
+		void sidePoint(int side, int quads, int t, int depth, int & x, int & y)
+		{
+			switch (side)
+			{
+			case STITCHING_SIDE_W:
+				x = depth;
+				y = t;
+				break;
+			case STITCHING_SIDE_N:
+				x = t;
+				y = depth;
+				break;
+			case STITCHING_SIDE_E:
+				x = quads - depth;
+				y = t;
+				break;
+			case STITCHING_SIDE_S:
+				x = t;
+				y = quads - depth;
+				break;
+			}
+		}
+
+		// Adds a triangle, wound like the interior quads
+		void addTriangle(int quads,
+			int ax, int ay,
+			int bx, int by,
+			int cx, int cy,
+			std::vector<Ogre::uint32> & indices)
+		{
+			if ((bx - ax) * (cy - ay) - (by - ay) * (cx - ax) > 0)
+			{
+				std::swap(bx, cx);
+				std::swap(by, cy);
+			}
+
+			indices.push_back(ay * (quads + 1) + ax);
+			indices.push_back(by * (quads + 1) + bx);
+			indices.push_back(cy * (quads + 1) + cx);
+		}
+	}
+
+	int StitchingIndices::getKey(const int levels[4])
+	{
+		int key = 0;
+		for (int side = 3; side >= 0; side--) {
+			assert(levels[side] >= 0 && levels[side] <= MAX_LEVEL);
+			key = key * (MAX_LEVEL + 1) + levels[side];
+		}
+		return key;
+	}
+
+	void StitchingIndices::getLevels(int key, int levels[4])
+	{
+		for (int side = 0; side < 4; side++) {
+			levels[side] = key % (MAX_LEVEL + 1);
+			key /= (MAX_LEVEL + 1);
+		}
+	}
+
+	void StitchingIndices::build(int quads, const int levels[4], std::vector<Ogre::uint32> & indices)
+	{
+		assert(quads % (1 << MAX_LEVEL) == 0);
+
+		// Stitched sides give up their outermost row of quads
+		int xMin = (levels[STITCHING_SIDE_W] > 0) ? 1 : 0;
+		int yMin = (levels[STITCHING_SIDE_N] > 0) ? 1 : 0;
+		int xMax = quads - ((levels[STITCHING_SIDE_E] > 0) ? 1 : 0);
+		int yMax = quads - ((levels[STITCHING_SIDE_S] > 0) ? 1 : 0);
+
+		for (int y = yMin; y < yMax; y++) {
+			for (int x = xMin; x < xMax; x++) {
+				indices.push_back(y * (quads + 1) + x);
+				indices.push_back((y + 1) * (quads + 1) + x);
+				indices.push_back(y * (quads + 1) + x + 1);
+				indices.push_back((y + 1) * (quads + 1) + x);
+				indices.push_back((y + 1) * (quads + 1) + x + 1);
+				indices.push_back(y * (quads + 1) + x + 1);
+			}
+		}
+
+		// The sides at the start and end of each side
+		static const int startSide[4] = { STITCHING_SIDE_N, STITCHING_SIDE_W, STITCHING_SIDE_N, STITCHING_SIDE_W };
+		static const int endSide[4] = { STITCHING_SIDE_S, STITCHING_SIDE_E, STITCHING_SIDE_S, STITCHING_SIDE_E };
+
+		for (int side = 0; side < 4; side++) {
+			if (levels[side] == 0) {
+				continue;
+			}
+
+			// Zip the coarse edge to the full resolution row inside it.
+			// The inner row ends one vertex early at a stitched corner,
+			// where the neighbouring strip takes over.
+			int step = 1 << levels[side];
+			int inner = (levels[startSide[side]] > 0) ? 1 : 0;
+			int innerEnd = quads - ((levels[endSide[side]] > 0) ? 1 : 0);
+			int outer = 0;
+
+			while (outer < quads || inner < innerEnd) {
+				int ax, ay, bx, by, cx, cy;
+				sidePoint(side, quads, outer, 0, ax, ay);
+				sidePoint(side, quads, inner, 1, bx, by);
+
+				// Step along the coarse edge once the inner row has
+				// reached the middle of the current coarse segment
+				if (inner == innerEnd || (outer < quads && 2 * inner >= 2 * outer + step)) {
+					sidePoint(side, quads, outer + step, 0, cx, cy);
+					outer += step;
+				} else {
+					sidePoint(side, quads, inner + 1, 1, cx, cy);
+					inner++;
+				}
+
+				addTriangle(quads, ax, ay, bx, by, cx, cy, indices);
+			}
+		}
+	}
+
+	void SkirtIndices::getGridPosition(int quads, int i, int & x, int & y)
+	{
+		const int gridVertices = (quads + 1) * (quads + 1);
+		if (i < gridVertices) {
+			x = i % (quads + 1);
+			y = i / (quads + 1);
+		} else {
+			i -= gridVertices;
+			sidePoint(i / (quads + 1), quads, i % (quads + 1), 0, x, y);
+		}
+	}
+
+	void SkirtIndices::build(int quads, std::vector<Ogre::uint32> & indices)
+	{
+		static const int noStitching[4] = { 0, 0, 0, 0 };
+		StitchingIndices::build(quads, noStitching, indices);
+
+		const int gridVertices = (quads + 1) * (quads + 1);
+
+		for (int side = 0; side < 4; side++) {
+			// Front faces of the patch have their normal pointing away
+			// from the viewer in grid space, which for the walls is
+			// inwards. The W and S walls already get that from the order
+			// below.
+			const bool flip = (side == STITCHING_SIDE_N || side == STITCHING_SIDE_E);
+
+			for (int t = 0; t < quads; t++) {
+				int x0, y0, x1, y1;
+				sidePoint(side, quads, t, 0, x0, y0);
+				sidePoint(side, quads, t + 1, 0, x1, y1);
+
+				Ogre::uint32 edge0 = y0 * (quads + 1) + x0;
+				Ogre::uint32 edge1 = y1 * (quads + 1) + x1;
+				Ogre::uint32 skirt0 = gridVertices + side * (quads + 1) + t;
+				Ogre::uint32 skirt1 = skirt0 + 1;
+
+				indices.push_back(edge0);
+				indices.push_back(flip ? edge1 : skirt0);
+				indices.push_back(flip ? skirt0 : edge1);
+				indices.push_back(edge1);
+				indices.push_back(flip ? skirt1 : skirt0);
+				indices.push_back(flip ? skirt0 : skirt1);
+			}
+		}
+	}
+}
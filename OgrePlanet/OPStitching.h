@@ -25,6 +25,8 @@ THE SOFTWARE.
 
 #include <Ogre.h>
 
+#include <vector>
+
 namespace OgrePlanet
 {
 	enum Stitching {
@@ -46,6 +48,68 @@ namespace OgrePlanet
 		STITCHING_WNES = 15,
 		
 	};
+
+	// Sides of a patch, in the bit order of Stitching
+	enum StitchingSide {
+		STITCHING_SIDE_W = 0,
+		STITCHING_SIDE_N = 1,
+		STITCHING_SIDE_E = 2,
+		STITCHING_SIDE_S = 3
+	};
+
+	// How cracks between patches of different size are hidden
+	enum CrackHiding {
+		// Edges along a coarser neighbour are triangulated to match it,
+		// see StitchingIndices. Patches track their neighbours and
+		// switch index buffers when a neighbour is split or merged.
+		CRACK_HIDING_STITCHING,
+		// Every patch has a wall hanging down from its edges that fills
+		// any crack, see SkirtIndices. One index buffer per number of
+		// quads and no neighbour tracking, for some extra fill.
+		CRACK_HIDING_SKIRTS
+	};
+
+	// Triangulates a patch of quads x quads quads whose neighbour on
+	// side i is levels[i] levels coarser (0 is the same size). Quads
+	// along a coarser side are replaced by a strip that only uses every
+	// 2^levels[i]-th vertex of that edge, so the edge matches the
+	// neighbour's. quads must be a multiple of 2^MAX_LEVEL.
+	class StitchingIndices
+	{
+	public:
+		// Largest level difference a side can be stitched across
+		static const int MAX_LEVEL = 3;
+		// Number of distinct level combinations, see getKey
+		static const int KEY_COUNT = (MAX_LEVEL + 1) * (MAX_LEVEL + 1) * (MAX_LEVEL + 1) * (MAX_LEVEL + 1);
+
+		// Index of a level combination in 0 .. KEY_COUNT-1
+		static int getKey(const int levels[4]);
+		static void getLevels(int key, int levels[4]);
+
+		// Appends the triangle list, indices into the (quads + 1)^2
+		// vertices of the patch in row order
+		static void build(int quads, const int levels[4], std::vector<Ogre::uint32> & indices);
+	};
+
+	// Triangulates a patch of quads x quads quads with skirts. The skirt
+	// vertices follow the (quads + 1)^2 vertices of the patch, a copy of
+	// each edge vertex moved down below the surface. The sides come in
+	// StitchingSide order, each running in +x or +y direction like the
+	// edge it hangs from.
+	class SkirtIndices
+	{
+	public:
+		// Skirt vertices of a patch, in addition to the grid
+		static int getVertexCount(int quads) { return 4 * (quads + 1); }
+
+		// Grid position of vertex i of a patch with skirts, the position
+		// of the edge vertex a skirt vertex hangs from
+		static void getGridPosition(int quads, int i, int & x, int & y);
+
+		// Appends the triangle list of the patch and its skirts, the
+		// skirts facing outwards
+		static void build(int quads, std::vector<Ogre::uint32> & indices);
+	};
 }
 
 #endif // STITCHING_H
\ No newline at end of file
@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPVertexBufferPool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+
+namespace OgrePlanet
+{
+	VertexBufferPool::VertexBufferPool(size_t vertexSize, size_t slotVertices) :
+	mVertexSize(vertexSize),
+		mSlotVertices(slotVertices)
+	{
+		mSlotsPerBuffer = std::min(BUFFER_SIZE / (vertexSize * slotVertices),
+			MAX_BUFFER_VERTICES / slotVertices);
+		mSlotsPerBuffer = std::max(mSlotsPerBuffer, (size_t) 1);
+	}
+
+	VertexBufferPool::~VertexBufferPool()
+	{
+		// Meshes still using a slot keep its buffer alive through their
+		// own reference, the pool just forgets about it
+		mFreeSlots.clear();
+		mBuffers.clear();
+	}
+
+	VertexBufferPool::Slot VertexBufferPool::allocate()
+	{
+		if (mFreeSlots.empty())
+		{
+			Ogre::HardwareVertexBufferSharedPtr buffer =
+				Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+				mVertexSize,
+				mSlotVertices * mSlotsPerBuffer,
+				Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+			mBuffers.push_back(buffer);
+
+			// Push in reverse, so slots are handed out from the start of
+			// the buffer
+			for (size_t i = mSlotsPerBuffer; i > 0; i--)
+			{
+				Slot slot;
+				slot.buffer = buffer;
+				slot.vertexStart = (i - 1) * mSlotVertices;
+				mFreeSlots.push_back(slot);
+			}
+		}
+
+		Slot slot = mFreeSlots.back();
+		mFreeSlots.pop_back();
+		return slot;
+	}
+
+	void VertexBufferPool::release(Slot & slot)
+	{
+		if (slot.isNull())
+		{
+			return;
+		}
+
+		assert(std::find(mBuffers.begin(), mBuffers.end(), slot.buffer) != mBuffers.end());
+		mFreeSlots.push_back(slot);
+		slot = Slot();
+	}
+
+	void VertexBufferPool::write(const Slot & slot, const void * vertices)
+	{
+		// Only this slot's range is locked. The buffers are in the
+		// managed pool, so this doesn't wait for draws using other slots.
+		slot.buffer->writeData(slot.vertexStart * mVertexSize,
+			mSlotVertices * mVertexSize,
+			vertices,
+			false);
+	}
+
+	size_t VertexBufferPool::trim()
+	{
+		std::map<Ogre::HardwareVertexBuffer *, size_t> freeSlots;
+		for (std::vector<Slot>::const_iterator i = mFreeSlots.begin(); i != mFreeSlots.end(); ++i)
+		{
+			freeSlots[i->buffer.get()]++;
+		}
+
+		std::vector<Ogre::HardwareVertexBufferSharedPtr> buffers;
+		for (std::vector<Ogre::HardwareVertexBufferSharedPtr>::iterator i = mBuffers.begin(); i != mBuffers.end(); ++i)
+		{
+			if (freeSlots[i->get()] < mSlotsPerBuffer)
+			{
+				buffers.push_back(*i);
+			}
+		}
+
+		if (buffers.size() == mBuffers.size())
+		{
+			return 0;
+		}
+
+		// Dropping the last references destroys the buffers
+		std::vector<Slot> slots;
+		for (std::vector<Slot>::iterator i = mFreeSlots.begin(); i != mFreeSlots.end(); ++i)
+		{
+			if (freeSlots[i->buffer.get()] < mSlotsPerBuffer)
+			{
+				slots.push_back(*i);
+			}
+		}
+
+		const size_t freed = (mBuffers.size() - buffers.size()) * getBufferSize();
+		mBuffers.swap(buffers);
+		mFreeSlots.swap(slots);
+		return freed;
+	}
+
+	size_t VertexBufferPool::getSlotsInUse() const
+	{
+		return mBuffers.size() * mSlotsPerBuffer - mFreeSlots.size();
+	}
+}
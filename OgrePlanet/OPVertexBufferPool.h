@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VERTEXBUFFERPOOL_H
+#define VERTEXBUFFERPOOL_H
+
+#include <Ogre.h>
+
+#include <vector>
+
+namespace OgrePlanet
+{
+	// Hands out fixed size ranges ("slots") of a few large vertex
+	// buffers, so patches don't have to create and destroy a vertex
+	// buffer each. A mesh uses a slot by binding its buffer and setting
+	// VertexData::vertexStart to the slot's first vertex, the index
+	// buffers stay relative to the slot. vertexStart applies to every
+	// stream of the mesh, so a stream shared with other meshes has to
+	// repeat its data for each of the getSlotsPerBuffer() slots.
+	//
+	// Buffers are created when all slots are in use and are kept until
+	// trim() finds all of their slots free, or the pool is destroyed.
+	// Every slot has the same size, so released slots can always be
+	// reused and the buffers never fragment.
+	//
+	// Not thread safe, only use it from the thread that loads meshes.
+	class VertexBufferPool
+	{
+	public:
+		// Approximate size of each buffer
+		static const size_t BUFFER_SIZE = 4 * 1024 * 1024;
+		// Most vertices in one buffer, so that base vertex + index stays
+		// within what hardware with 16 bit vertex indices can address
+		static const size_t MAX_BUFFER_VERTICES = 65535;
+
+		struct Slot
+		{
+			Slot() : vertexStart(0) {}
+			bool isNull() const { return buffer.isNull(); }
+
+			Ogre::HardwareVertexBufferSharedPtr buffer;
+			size_t vertexStart;
+		};
+
+		// Slots of slotVertices vertices of vertexSize bytes each
+		VertexBufferPool(size_t vertexSize, size_t slotVertices);
+		~VertexBufferPool();
+
+		Slot allocate();
+		// Returns the slot to the pool and nulls it
+		void release(Slot & slot);
+
+		// Copies slotVertices vertices into the slot
+		void write(const Slot & slot, const void * vertices);
+
+		// Destroys the buffers none of whose slots are in use, returns
+		// how many bytes that freed
+		size_t trim();
+
+		size_t getVertexSize() const { return mVertexSize; }
+		size_t getSlotVertices() const { return mSlotVertices; }
+		size_t getSlotsPerBuffer() const { return mSlotsPerBuffer; }
+		size_t getBufferCount() const { return mBuffers.size(); }
+		// In bytes
+		size_t getBufferSize() const { return mVertexSize * mSlotVertices * mSlotsPerBuffer; }
+		size_t getSlotsInUse() const;
+
+	private:
+		VertexBufferPool(const VertexBufferPool &);
+		VertexBufferPool & operator=(const VertexBufferPool &);
+
+		const size_t mVertexSize;
+		const size_t mSlotVertices;
+		size_t mSlotsPerBuffer;
+		std::vector<Ogre::HardwareVertexBufferSharedPtr> mBuffers;
+		std::vector<Slot> mFreeSlots;
+	};
+}
+
+#endif // VERTEXBUFFERPOOL_H
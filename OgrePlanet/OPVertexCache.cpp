@@ -0,0 +1,214 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "OPVertexCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+namespace OgrePlanet
+{
+	namespace
+	{
+		// Scoring constants from the paper
+		const int CACHE_SIZE = 32;
+		const float CACHE_DECAY_POWER = 1.5f;
+		const float LAST_TRIANGLE_SCORE = 0.75f;
+		const float VALENCE_BOOST_SCALE = 2.0f;
+		const float VALENCE_BOOST_POWER = 0.5f;
+
+		float vertexScore(int cachePosition, int remainingTriangles)
+		{
+			if (remainingTriangles == 0)
+			{
+				// Nothing left to draw with this vertex
+				return -1.0f;
+			}
+
+			float score = 0.0f;
+
+			if (cachePosition >= 0)
+			{
+				if (cachePosition < 3)
+				{
+					// Used by the last triangle, a fixed score keeps the
+					// algorithm from preferring strips too much
+					score = LAST_TRIANGLE_SCORE;
+				}
+				else
+				{
+					float scaler = 1.0f / (CACHE_SIZE - 3);
+					score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+				}
+			}
+
+			// Finish off vertices with few triangles left before they
+			// become lone stragglers
+			score += VALENCE_BOOST_SCALE * std::pow((float) remainingTriangles, -VALENCE_BOOST_POWER);
+
+			return score;
+		}
+	}
+
+	void VertexCache::optimise(std::vector<Ogre::uint32> & indices, size_t vertexCount)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+		{
+			return;
+		}
+
+		// Triangles using each vertex, the live ones first
+		std::vector<int> remaining(vertexCount, 0);
+		for (size_t i = 0; i < indices.size(); i++) {
+			remaining[indices[i]]++;
+		}
+
+		std::vector<size_t> firstTriangle(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++) {
+			firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+		}
+
+		std::vector<size_t> vertexTriangles(indices.size());
+		std::vector<size_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++) {
+			vertexTriangles[fill[indices[i]]++] = i / 3;
+		}
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> score(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++) {
+			score[v] = vertexScore(-1, remaining[v]);
+		}
+
+		std::vector<float> triangleScore(triangleCount);
+		for (size_t t = 0; t < triangleCount; t++) {
+			triangleScore[t] = score[indices[3*t]] + score[indices[3*t + 1]] + score[indices[3*t + 2]];
+		}
+
+		std::vector<bool> added(triangleCount, false);
+		std::vector<Ogre::uint32> cache;
+		std::vector<Ogre::uint32> newCache;
+		std::vector<Ogre::uint32> result;
+		result.reserve(indices.size());
+
+		int best = -1;
+		size_t scanStart = 0;
+
+		for (size_t n = 0; n < triangleCount; n++) {
+			if (best < 0)
+			{
+				// Nothing in the cache to continue from, take the best
+				// triangle anywhere
+				float bestScore = -1.0f;
+				while (added[scanStart]) {
+					scanStart++;
+				}
+				for (size_t t = scanStart; t < triangleCount; t++) {
+					if (!added[t] && triangleScore[t] > bestScore) {
+						bestScore = triangleScore[t];
+						best = (int) t;
+					}
+				}
+			}
+
+			const Ogre::uint32 * triangle = &indices[3 * best];
+			added[best] = true;
+			result.insert(result.end(), triangle, triangle + 3);
+
+			// Remove the triangle from the live list of its vertices
+			for (int i = 0; i < 3; i++) {
+				Ogre::uint32 v = triangle[i];
+				size_t * live = &vertexTriangles[firstTriangle[v]];
+				size_t * liveEnd = live + remaining[v];
+				std::iter_swap(std::find(live, liveEnd, (size_t) best), liveEnd - 1);
+				remaining[v]--;
+			}
+
+			// The triangle's vertices move to the front of the cache
+			newCache.assign(triangle, triangle + 3);
+			for (size_t i = 0; i < cache.size(); i++) {
+				if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2]) {
+					newCache.push_back(cache[i]);
+				}
+			}
+			cache.swap(newCache);
+
+			// Rescore everything that was in the cache, including the
+			// vertices that just fell out of it
+			for (size_t i = 0; i < cache.size(); i++) {
+				cachePosition[cache[i]] = (i < (size_t) CACHE_SIZE) ? (int) i : -1;
+			}
+			for (size_t i = 0; i < cache.size(); i++) {
+				Ogre::uint32 v = cache[i];
+				score[v] = vertexScore(cachePosition[v], remaining[v]);
+			}
+
+			best = -1;
+			float bestScore = -1.0f;
+			for (size_t i = 0; i < cache.size(); i++) {
+				Ogre::uint32 v = cache[i];
+				for (int j = 0; j < remaining[v]; j++) {
+					size_t t = vertexTriangles[firstTriangle[v] + j];
+					triangleScore[t] = score[indices[3*t]] + score[indices[3*t + 1]] + score[indices[3*t + 2]];
+					if (triangleScore[t] > bestScore) {
+						bestScore = triangleScore[t];
+						best = (int) t;
+					}
+				}
+			}
+
+			if (cache.size() > (size_t) CACHE_SIZE)
+			{
+				cache.resize(CACHE_SIZE);
+			}
+		}
+
+		indices.swap(result);
+	}
+
+	float VertexCache::getACMR(const std::vector<Ogre::uint32> & indices, size_t cacheSize)
+	{
+		if (indices.empty())
+		{
+			return 0.0f;
+		}
+
+		std::deque<Ogre::uint32> fifo;
+		size_t misses = 0;
+
+		for (size_t i = 0; i < indices.size(); i++) {
+			if (std::find(fifo.begin(), fifo.end(), indices[i]) == fifo.end())
+			{
+				misses++;
+				fifo.push_back(indices[i]);
+				if (fifo.size() > cacheSize)
+				{
+					fifo.pop_front();
+				}
+			}
+		}
+
+		return (float) misses / (indices.size() / 3);
+	}
+}
@@ -0,0 +1,52 @@
+/*
+Copyright (c) 2010 Anders Lingfors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VERTEXCACHE_H
+#define VERTEXCACHE_H
+
+#include <Ogre.h>
+
+#include <vector>
+
+namespace OgrePlanet
+{
+	// Post transform vertex cache helpers for triangle lists
+	class VertexCache
+	{
+	public:
+		// FIFO size used by getACMR, a conservative guess for current
+		// hardware
+		static const size_t DEFAULT_CACHE_SIZE = 16;
+
+		// Reorders the triangles (not the vertices) for cache locality,
+		// using Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+		// Winding is kept.
+		static void optimise(std::vector<Ogre::uint32> & indices, size_t vertexCount);
+
+		// Average cache miss ratio: vertices transformed per triangle
+		// with a FIFO cache of cacheSize vertices. 0.5 is the ideal for
+		// a large grid, 3 means no reuse at all.
+		static float getACMR(const std::vector<Ogre::uint32> & indices, size_t cacheSize = DEFAULT_CACHE_SIZE);
+	};
+}
+
+#endif // VERTEXCACHE_H
@@ -19,6 +19,7 @@
 // THE SOFTWARE.
 
 #include "functions.hlsl"
+#include "OPPackedVertex.hlsl"
 
 static const float planetRadius = 6371.0;
 static const float maxHeight = 8.848;
@@ -63,6 +64,42 @@ VS_OUTPUT main_vp(
 	return output;
 }
 
+VS_OUTPUT main_packed_vp(
+		VS_PACKED_INPUT packed,
+
+		uniform float4x4 worldViewProj,
+		uniform float baseRadius,
+		uniform float farClipDistance,
+		uniform float4 positionScale)
+{
+	VS_INPUT input;
+	input.position = unpackPosition(packed, positionScale);
+	input.normal = octDecode(packed.normals.xy / 32767.0);
+	input.texCoord = float2(0.0, 0.0);
+
+	return main_vp(input, worldViewProj, baseRadius, farClipDistance);
+}
+
+VS_OUTPUT main_height_vp(
+		VS_HEIGHT_INPUT height,
+
+		uniform float4x4 worldViewProj,
+		uniform float baseRadius,
+		uniform float farClipDistance,
+		uniform float4 cubeOrigin,
+		uniform float4 cubeStepX,
+		uniform float4 cubeStepY,
+		uniform float4 radiusScale,
+		uniform float4 meshCenter)
+{
+	VS_INPUT input;
+	input.position = unpackHeightPosition(height, cubeOrigin, cubeStepX, cubeStepY, radiusScale, meshCenter);
+	input.normal = octDecode(height.height.zw / 32767.0);
+	input.texCoord = float2(0.0, 0.0);
+
+	return main_vp(input, worldViewProj, baseRadius, farClipDistance);
+}
+
 float4 main_fp(PS_INPUT input,
 	
 		uniform float3 globalAmbient,
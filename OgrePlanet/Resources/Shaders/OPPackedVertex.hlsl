@@ -0,0 +1,146 @@
+// Copyright (c) 2010 Anders Lingfors
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Unpacking of the packed and height only patch vertex formats, written
+// by PatchMeshKernel::packVertices and PatchMeshKernel::packHeights. The
+// per patch parameters are set by Patch as custom parameters:
+//   custom 7: positionScale, position scale (xyz), geomorph delta scale (w)
+//   custom 8: texCoordRange, texture coordinate min (xy) and size (zw)
+//   custom 9: gridSize, quads (x)
+// and for the height only format
+//   custom 10: cubeOrigin, cube position of grid point (0, 0) (xyz),
+//              CubeMapping (w)
+//   custom 11: cubeStepX, cube position step per grid x (xyz)
+//   custom 12: cubeStepY, cube position step per grid y (xyz)
+//   custom 13: radiusScale, radius offset (x), radius scale (y),
+//              geomorph delta scale (z)
+//   custom 14: meshCenter, the planet space origin of the mesh (xyz)
+
+struct VS_PACKED_INPUT
+{
+	float4 position : POSITION;		// position (xyz), grid x (w)
+	float4 normals : NORMAL;		// octahedral normal (xy) and geomorph normal (zw)
+	float4 morph : TEXCOORD1;		// geomorph position delta (xyz), grid y (w)
+};
+
+float3 octDecode(float2 e)
+{
+	float3 n = float3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * (n.xy >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
+// Texture coordinate (xy) and edge flags (zw) of a grid point
+float4 gridTexCoord(float2 grid, float4 texCoordRange, float quads)
+{
+	float4 texCoord;
+	texCoord.xy = texCoordRange.xy + (grid / quads) * texCoordRange.zw;
+	// Edge flags, 0 on the first row/column, 1 on the last, 0.5 inside
+	texCoord.zw = 0.5 + 0.5 * (grid > quads - 0.5) - 0.5 * (grid < 0.5);
+	return texCoord;
+}
+
+float4 unpackPosition(VS_PACKED_INPUT input, float4 positionScale)
+{
+	return float4(input.position.xyz * positionScale.xyz, 1.0);
+}
+
+// Rebuilds the attributes of the float vertex format
+void unpackVertex(VS_PACKED_INPUT input,
+		float4 positionScale,
+		float4 texCoordRange,
+		float quads,
+		out float4 position,
+		out float3 normal,
+		out float4 texCoord,
+		out float4 interpolatedPosition,
+		out float3 interpolatedNormal)
+{
+	position = unpackPosition(input, positionScale);
+	interpolatedPosition = float4(position.xyz + input.morph.xyz * positionScale.w, 1.0);
+
+	normal = octDecode(input.normals.xy / 32767.0);
+	interpolatedNormal = octDecode(input.normals.zw / 32767.0);
+
+	texCoord = gridTexCoord(float2(input.position.w, input.morph.w), texCoordRange, quads);
+}
+
+struct VS_HEIGHT_INPUT
+{
+	float4 grid : POSITION;			// grid x and y, shared by all patches
+	float4 height : TEXCOORD0;		// radius, geomorph radius delta, octahedral normal (zw)
+};
+
+// Direction from the planet centre to a grid point, projected onto the
+// sphere as HeightDataResourceLoader does
+float3 gridDirection(float2 grid, float4 cubeOrigin, float4 cubeStepX, float4 cubeStepY)
+{
+	float3 cube = cubeOrigin.xyz + grid.x * cubeStepX.xyz + grid.y * cubeStepY.xyz;
+	if (cubeOrigin.w > 0.5) {
+		// CUBE_MAPPING_TANGENT, tan(+-pi/4) leaves the face normal
+		// coordinate at +-1
+		cube = tan(cube * 0.78539816);
+	}
+	return normalize(cube);
+}
+
+float4 unpackHeightPosition(VS_HEIGHT_INPUT input,
+		float4 cubeOrigin,
+		float4 cubeStepX,
+		float4 cubeStepY,
+		float4 radiusScale,
+		float4 meshCenter)
+{
+	float3 direction = gridDirection(input.grid.xy, cubeOrigin, cubeStepX, cubeStepY);
+	float radius = radiusScale.x + input.height.x * radiusScale.y;
+	return float4(direction * radius - meshCenter.xyz, 1.0);
+}
+
+// Rebuilds the attributes of the float vertex format
+void unpackHeightVertex(VS_HEIGHT_INPUT input,
+		float4 cubeOrigin,
+		float4 cubeStepX,
+		float4 cubeStepY,
+		float4 radiusScale,
+		float4 meshCenter,
+		float4 texCoordRange,
+		float quads,
+		out float4 position,
+		out float3 normal,
+		out float4 texCoord,
+		out float4 interpolatedPosition,
+		out float3 interpolatedNormal)
+{
+	float2 grid = input.grid.xy;
+	float3 direction = gridDirection(grid, cubeOrigin, cubeStepX, cubeStepY);
+
+	float radius = radiusScale.x + input.height.x * radiusScale.y;
+	float morphRadius = radius + input.height.y * radiusScale.z;
+	position = float4(direction * radius - meshCenter.xyz, 1.0);
+	interpolatedPosition = float4(direction * morphRadius - meshCenter.xyz, 1.0);
+
+	// Only one normal is stored
+	normal = octDecode(input.height.zw / 32767.0);
+	interpolatedNormal = normal;
+
+	texCoord = gridTexCoord(grid, texCoordRange, quads);
+}
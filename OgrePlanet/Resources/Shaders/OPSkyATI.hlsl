@@ -19,6 +19,7 @@
 // THE SOFTWARE.
 
 #include "functions.hlsl"
+#include "OPPackedVertex.hlsl"
 
 float4x4 worldViewProj;
 float4 lightPosition;
@@ -64,6 +65,30 @@ VS_OUTPUT vs_main(VS_INPUT input,
 	return output;
 }
 
+VS_OUTPUT vs_packed_main(VS_PACKED_INPUT packed,
+		uniform float farClipDistance,
+		uniform float4 positionScale)
+{
+	VS_INPUT input;
+	input.position = unpackPosition(packed, positionScale);
+
+	return vs_main(input, farClipDistance);
+}
+
+VS_OUTPUT vs_height_main(VS_HEIGHT_INPUT height,
+		uniform float farClipDistance,
+		uniform float4 cubeOrigin,
+		uniform float4 cubeStepX,
+		uniform float4 cubeStepY,
+		uniform float4 radiusScale,
+		uniform float4 meshCenter)
+{
+	VS_INPUT input;
+	input.position = unpackHeightPosition(height, cubeOrigin, cubeStepX, cubeStepY, radiusScale, meshCenter);
+
+	return vs_main(input, farClipDistance);
+}
+
 float4 ps_main(PS_INPUT input) : COLOR0
 {
 	float3 sunDir = normalize(lightPosition.xyz);
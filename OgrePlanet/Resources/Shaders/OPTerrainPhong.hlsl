@@ -20,6 +20,7 @@
 
 #include "functions.hlsl"
 #include "OPNoise.hlsl"
+#include "OPPackedVertex.hlsl"
 
 sampler2D grassTexture : register(s2);
 sampler2D rockTexture : register(s3);
@@ -81,6 +82,40 @@ VS_OUTPUT main_vp(VS_INPUT input,
 	return output;
 }
 
+VS_OUTPUT main_packed_vp(VS_PACKED_INPUT packed,
+		uniform float4x4 worldViewProj,
+		uniform float farClipDistance,
+		uniform float4 stitch,
+		uniform float4 positionScale,
+		uniform float4 texCoordRange,
+		uniform float4 gridSize)
+{
+	VS_INPUT input;
+	unpackVertex(packed, positionScale, texCoordRange, gridSize.x,
+		input.position, input.normal, input.texCoord, input.interpolatedPosition, input.interpolatedNormal);
+
+	return main_vp(input, worldViewProj, farClipDistance, stitch);
+}
+
+VS_OUTPUT main_height_vp(VS_HEIGHT_INPUT height,
+		uniform float4x4 worldViewProj,
+		uniform float farClipDistance,
+		uniform float4 stitch,
+		uniform float4 texCoordRange,
+		uniform float4 gridSize,
+		uniform float4 cubeOrigin,
+		uniform float4 cubeStepX,
+		uniform float4 cubeStepY,
+		uniform float4 radiusScale,
+		uniform float4 meshCenter)
+{
+	VS_INPUT input;
+	unpackHeightVertex(height, cubeOrigin, cubeStepX, cubeStepY, radiusScale, meshCenter, texCoordRange, gridSize.x,
+		input.position, input.normal, input.texCoord, input.interpolatedPosition, input.interpolatedNormal);
+
+	return main_vp(input, worldViewProj, farClipDistance, stitch);
+}
+
 float4 main_fp(PS_INPUT input,
 		uniform float3 viewPosition,
 		uniform float3 lightPosition,